@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: MIT
-// Copyright (c) 2024 Aymeric Wibo
+// Copyright (c) 2024-2026 Aymeric Wibo
 
 #include <common.h>
 
@@ -47,11 +47,11 @@ int bsys_dep_tree(bsys_t const* bsys, int argc, char* argv[]) {
 	// Create dependency tree.
 
 	bool circular;
-	tree = bsys->dep_tree(argc, hashes, &circular);
+	tree = bsys->dep_tree(argc, hashes, &circular, NULL);
 	free(hashes);
 
 	if (tree == NULL && circular) {
-		printf(BOB_DEPS_CIRCULAR);
+		log_rawf(stdout, BOB_DEPS_CIRCULAR);
 		return 0;
 	}
 
@@ -66,21 +66,26 @@ int bsys_dep_tree(bsys_t const* bsys, int argc, char* argv[]) {
 no_tree:;
 
 	char* const STR_CLEANUP serialized = tree == NULL ? strdup_c("") : dep_node_serialize(tree);
-	printf(DEP_TAG_START "%s" DEP_TAG_END, serialized);
+	log_rawf(stdout, DEP_TAG_START "%s" DEP_TAG_END, serialized);
 
 	deps_tree_free(tree);
 	return rv;
 }
 
 static int do_build_deps(bsys_t const* bsys) {
-	if (bsys->dep_tree == NULL || bsys->build_deps == NULL) {
+	if (bsys->dep_tree == NULL) {
 		return 0;
 	}
 
-	// Create dependency tree.
+	// Create dependency tree, building each dependency as soon as its own subtree is known.
+	// Even if this fails, we must still wait for the dependencies which already started building.
+
+	deps_builder_t* const builder = deps_build_start();
 
 	bool circular;
-	dep_node_t* const tree = bsys->dep_tree(0, NULL, &circular);
+	dep_node_t* const tree = bsys->dep_tree(0, NULL, &circular, builder);
+
+	int const rv = deps_build_wait(builder);
 
 	if (tree == NULL) {
 		if (circular) {
@@ -91,10 +96,6 @@ static int do_build_deps(bsys_t const* bsys) {
 	}
 
 	assert(!circular);
-
-	// Build each dependency.
-
-	int const rv = bsys->build_deps(tree);
 	deps_tree_free(tree);
 
 	return rv;
@@ -169,6 +170,70 @@ static void prepend_env(char const* name, char const* fmt, ...) {
 	}
 }
 
+static int staged_install(bsys_t const* bsys) {
+	// Install to a staging directory first, and then merge that into the prefix.
+	// The merge leaves files which are identical in the prefix untouched, so that their mtimes only change when their contents do.
+	// Otherwise, everything linking against a library installed by this project would be relinked every time it's reinstalled.
+	// If the user set 'DESTDIR' themselves, respect that instead.
+
+	if (getenv("DESTDIR") != NULL) {
+		return bsys->install();
+	}
+
+	char* STR_CLEANUP err = NULL;
+	char* STR_CLEANUP destdir = NULL;
+	asprintf_c(&destdir, "%s/%s.destdir", abs_out_path, bsys->key);
+
+	if (rm(destdir, &err) < 0) {
+		LOG_FATAL("Failed to remove staging directory '%s': %s", destdir, err);
+		return -1;
+	}
+
+	setenv("DESTDIR", destdir, true);
+	int const rv = bsys->install();
+	unsetenv("DESTDIR");
+
+	if (rv < 0) {
+		return -1;
+	}
+
+	// Some projects don't actually honour 'DESTDIR', in which case they've already installed everything to the prefix directly and there's nothing to merge.
+
+	char* STR_CLEANUP staged = NULL;
+	asprintf_c(&staged, "%s%s", destdir, install_prefix);
+
+	struct stat sb;
+
+	if (stat(staged, &sb) < 0) {
+		return 0;
+	}
+
+	size_t changed;
+
+	if (merge_tree(staged, install_prefix, false, &changed, &err) < 0) {
+		LOG_FATAL("Failed to merge staging directory '%s' into '%s': %s", staged, install_prefix, err);
+		return -1;
+	}
+
+	cmd_forget_bins();
+	dep_record_installed_tree(staged, "", install_prefix);
+
+	if (dep_record_write_installed() < 0) {
+		return -1;
+	}
+
+	LOG_SUCCESS("Merged staged installation into '%s' (%zu file%s changed).", install_prefix, changed, changed == 1 ? "" : "s");
+
+	free(err);
+	err = NULL;
+
+	if (rm(destdir, &err) < 0) {
+		LOG_WARN("Failed to remove staging directory '%s': %s", destdir, err);
+	}
+
+	return 0;
+}
+
 static int install(bsys_t const* bsys, bool default_to_tmp_prefix) {
 	if (bsys->install == NULL) {
 		LOG_WARN("%s: build system does not have an install step; nothing to install!", bsys->name);
@@ -196,6 +261,10 @@ static int install(bsys_t const* bsys, bool default_to_tmp_prefix) {
 
 	// Actually install.
 
+	if (bsys->supports_destdir) {
+		return staged_install(bsys);
+	}
+
 	return bsys->install();
 }
 
@@ -274,3 +343,12 @@ int bsys_clean(bsys_t const* bsys) {
 
 	return bsys->clean();
 }
+
+int bsys_gc(bsys_t const* bsys) {
+	if (bsys->gc == NULL) {
+		LOG_WARN("%s build system does not support garbage collection; nothing to collect!", bsys->name);
+		return 0;
+	}
+
+	return bsys->gc();
+}
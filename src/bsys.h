@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: MIT
-// Copyright (c) 2024 Aymeric Wibo
+// Copyright (c) 2024-2026 Aymeric Wibo
 
 #pragma once
 
@@ -18,15 +18,28 @@ struct bsys_t {
 	 */
 	bool supports_config;
 
+	/**
+	 * Whether this build system's install step honours the DESTDIR envvar.
+	 * If so, installations are staged and then merged into the prefix, leaving identical files untouched.
+	 */
+	bool supports_destdir;
+
 	bool (*identify)(void);
 	int (*setup)(void);
-	dep_node_t* (*dep_tree)(size_t path_len, uint64_t* path_hashes, bool* circular);
-	int (*build_deps)(dep_node_t* tree);
+	dep_node_t* (*dep_tree)(size_t path_len, uint64_t* path_hashes, bool* circular, deps_builder_t* builder);
 	int (*build)(void);
 	int (*install)(void);
 	int (*clean)(void);
+	int (*gc)(void);
 	int (*run)(int argc, char* argv[]);
 	void (*destroy)(void);
+
+	/**
+	 * Set aside the build system's global state so that another project can be set up in the same process, and restore it afterwards.
+	 * Only needed for build systems which keep any.
+	 */
+	void* (*suspend)(void);
+	void (*resume)(void* state);
 };
 
 extern bsys_t const BSYS_BOB;
@@ -56,3 +69,4 @@ int bsys_run(bsys_t const* bsys, int argc, char* argv[]);
 int bsys_sh(bsys_t const* bsys, int argc, char* argv[]);
 int bsys_install(bsys_t const* bsys);
 int bsys_clean(bsys_t const* bsys);
+int bsys_gc(bsys_t const* bsys);
@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: MIT
-// Copyright (c) 2024-2025 Aymeric Wibo
+// Copyright (c) 2024-2026 Aymeric Wibo
 
 #include <common.h>
 
@@ -12,6 +12,8 @@
 #include <fsutil.h>
 #include <install.h>
 #include <logging.h>
+#include <manifest.h>
+#include <pgo.h>
 #include <str.h>
 
 #include <class/class.h>
@@ -71,10 +73,23 @@ static int external_fn_cb(flamingo_t* flamingo, flamingo_val_t* callable, void*
 	return flamingo_raise_error(flamingo, "Bob doesn't support the '%.*s' external function call (%zu arguments passed)", (int) name_size, name, args->count);
 }
 
+static void populate_class(bob_class_t* bob_class, flamingo_val_t* class) {
+	flamingo_scope_t* const scope = class->fn.scope;
+	bob_class->class_val = class;
+
+	if (bob_class->populate == NULL) {
+		return;
+	}
+
+	for (size_t i = 0; i < scope->vars_size; i++) {
+		flamingo_var_t* const var = &scope->vars[i];
+		bob_class->populate(var->key, var->key_size, var->val);
+	}
+}
+
 static int class_decl_cb(flamingo_t* flamingo, flamingo_val_t* class, void* data) {
 	char* const name = class->name;
 	size_t const name_size = class->name_size;
-	flamingo_scope_t* const scope = class->fn.scope;
 
 	for (size_t i = 0; i < sizeof(BOB_CLASSES) / sizeof(BOB_CLASSES[0]); i++) {
 		bob_class_t* const bob_class = BOB_CLASSES[i];
@@ -83,15 +98,7 @@ static int class_decl_cb(flamingo_t* flamingo, flamingo_val_t* class, void* data
 			continue;
 		}
 
-		bob_class->class_val = class;
-
-		for (size_t j = 0; j < scope->vars_size; j++) {
-			flamingo_var_t* const var = &scope->vars[j];
-
-			if (bob_class->populate != NULL) {
-				bob_class->populate(var->key, var->key_size, var->val);
-			}
-		}
+		populate_class(bob_class, class);
 	}
 
 	return 0;
@@ -224,7 +231,7 @@ err_fopen:
 	return rv;
 }
 
-static dep_node_t* dep_tree(size_t path_len, uint64_t* path_hashes, bool* circular) {
+static dep_node_t* dep_tree(size_t path_len, uint64_t* path_hashes, bool* circular, deps_builder_t* builder) {
 	// Find dependencies vector.
 
 	flamingo_scope_t* const scope = flamingo.env->scope_stack[0];
@@ -268,7 +275,7 @@ found:
 		}
 	}
 
-	return get_deps_tree(vec->val, path_len, path_hashes, circular);
+	return get_deps_tree(vec->val, path_len, path_hashes, circular, builder);
 }
 
 static int build(void) {
@@ -276,7 +283,20 @@ static int build(void) {
 		return -1;
 	}
 
-	return run_build_steps();
+	// Keep 'bob gc' from removing cookies from under us until our manifest is written.
+
+	int const lock_fd = manifest_lock(false);
+	int rv = run_build_steps();
+
+	if (rv == 0) {
+		rv = manifest_write();
+	}
+
+	if (lock_fd >= 0) {
+		close(lock_fd);
+	}
+
+	return rv;
 }
 
 static int clean(void) {
@@ -285,7 +305,7 @@ static int clean(void) {
 	LOG_INFO("Will remove \"%s\". ^C to cancel now.", abs_out_path);
 	getchar();
 
-	if (rm(abs_out_path, &err) < 0) {
+	if (rm_background(abs_out_path, &err) < 0) {
 		LOG_FATAL("Failed to clean output directory (\"%s\"): %s", abs_out_path, err);
 		return -1;
 	}
@@ -327,6 +347,29 @@ static int run(int argc, char* argv[]) {
 
 found:;
 
+	// When training an instrumented build for PGO, the build script can ask for a different command than the default run command (e.g. a benchmark).
+
+	if (pgo_mode == PGO_GENERATE) {
+		for (size_t i = 0; i < scope->vars_size; i++) {
+			flamingo_var_t* const train = &scope->vars[i];
+
+			if (flamingo_cstrcmp(train->key, "pgo_train", train->key_size) != 0) {
+				continue;
+			}
+
+			if (train->val->kind != FLAMINGO_VAL_KIND_VEC) {
+				LOG_FATAL("PGO training vector must be a vector.");
+				return -1;
+			}
+
+			if (train->val->vec.count > 0) {
+				vec = train;
+			}
+
+			break;
+		}
+	}
+
 	// Start by adding the arguments in the run vector.
 
 	for (size_t i = 0; i < vec->val->vec.count; i++) {
@@ -371,16 +414,71 @@ static void destroy(void) {
 	flamingo_destroy(&flamingo);
 }
 
+#define CLASS_COUNT (sizeof(BOB_CLASSES) / sizeof(BOB_CLASSES[0]))
+
+typedef struct {
+	bool consistent;
+	char* src;
+	size_t src_size;
+	flamingo_t flamingo;
+	flamingo_val_t* class_vals[CLASS_COUNT];
+} suspended_t;
+
+static void* suspend(void) {
+	suspended_t* const state = malloc_c(sizeof *state);
+
+	state->consistent = consistent;
+	state->src = src;
+	state->src_size = src_size;
+	state->flamingo = flamingo;
+
+	for (size_t i = 0; i < CLASS_COUNT; i++) {
+		state->class_vals[i] = BOB_CLASSES[i]->class_val;
+		BOB_CLASSES[i]->class_val = NULL;
+	}
+
+	consistent = false;
+
+	return state;
+}
+
+static void resume(void* data) {
+	suspended_t* const state = data;
+
+	consistent = state->consistent;
+	src = state->src;
+	src_size = state->src_size;
+	flamingo = state->flamingo;
+
+	// Classes hold on to values from their declarations (e.g. static methods), so those need to be pointed back at this build script's.
+
+	for (size_t i = 0; i < CLASS_COUNT; i++) {
+		flamingo_val_t* const class = state->class_vals[i];
+
+		if (class != NULL) {
+			populate_class(BOB_CLASSES[i], class);
+		}
+
+		else {
+			BOB_CLASSES[i]->class_val = NULL;
+		}
+	}
+
+	free(state);
+}
+
 bsys_t const BSYS_BOB = {
 	.name = "Bob",
 	.key = "bob",
 	.identify = identify,
 	.setup = setup,
 	.dep_tree = dep_tree,
-	.build_deps = deps_build,
 	.build = build,
 	.install = install_all,
 	.clean = clean,
+	.gc = manifest_gc,
 	.run = run,
 	.destroy = destroy,
+	.suspend = suspend,
+	.resume = resume,
 };
@@ -88,6 +88,7 @@ bsys_t const BSYS_CMAKE = {
 	.name = "CMake",
 	.key = "cmake",
 	.supports_config = true,
+	.supports_destdir = true,
 	.identify = identify,
 	.setup = setup,
 	.build = build,
@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: MIT
-// Copyright (c) 2025 Aymeric Wibo
+// Copyright (c) 2025-2026 Aymeric Wibo
 
 #include <common.h>
 
@@ -19,6 +19,7 @@
 // - Check if regular make command on system is GNU make and use that if gmake doesn't exist.
 // - Hook into cleaning, since gmake artifacts are not in bsys_out_path.
 // - TODO DESTDIR or PREFIX? ZSTD claims to follow the standard conventions but DESTDIR doesn't work.
+//   We pass both, as a Makefile which ignores DESTDIR just ends up installing directly to the prefix (see 'staged_install()' in src/bsys.c).
 
 #define BUILD_PATH "Makefile"
 
@@ -81,6 +82,7 @@ static int install(void) {
 bsys_t const BSYS_GMAKE = {
 	.name = "Make (GNU)",
 	.key = "gmake",
+	.supports_destdir = true,
 	.identify = identify,
 	.setup = setup,
 	.build = build,
@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: MIT
-// Copyright (c) 2024 Aymeric Wibo
+// Copyright (c) 2024-2026 Aymeric Wibo
 
 #include <common.h>
 
@@ -115,6 +115,7 @@ static int install(void) {
 bsys_t const BSYS_MESON = {
 	.name = "Meson",
 	.key = "meson",
+	.supports_destdir = true,
 	.identify = identify,
 	.setup = setup,
 	.build = build,
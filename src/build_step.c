@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: MIT
-// Copyright (c) 2024 Aymeric Wibo
+// Copyright (c) 2024-2026 Aymeric Wibo
 
 #include <alloc.h>
 #include <build_step.h>
@@ -19,7 +19,7 @@ static int merge(void* data) {
 	return 0;
 }
 
-int add_build_step(uint64_t unique, char const* name, build_step_cb_t cb, void* data) {
+int add_build_step(uint64_t unique, char const* name, build_step_cb_t cb, build_step_free_cb_t free_cb, void* data) {
 	// Check if the last build step is the same as this one.
 	// If it is, merge the two.
 
@@ -32,6 +32,7 @@ int add_build_step(uint64_t unique, char const* name, build_step_cb_t cb, void*
 	if (last->unique == unique) {
 		assert(strcmp(last->name, name) == 0);
 		assert(cb == last->cb);
+		assert(free_cb == last->free_cb);
 
 		return merge(data);
 	}
@@ -46,6 +47,7 @@ no_last:
 	step->unique = unique;
 	step->name = name;
 	step->cb = cb;
+	step->free_cb = free_cb;
 	step->data_count = 1;
 
 	step->data = malloc_c(sizeof *build_steps->data);
@@ -60,11 +62,18 @@ void free_build_steps(void) {
 	}
 
 	for (size_t i = 0; i < build_step_count; i++) {
-		free(build_steps[i].data);
+		build_step_t* const step = &build_steps[i];
+
+		for (size_t j = 0; step->free_cb != NULL && j < step->data_count; j++) {
+			step->free_cb(step->data[j]);
+		}
+
+		free(step->data);
 	}
 
 	free(build_steps);
 	build_steps = NULL;
+	build_step_count = 0;
 }
 
 int run_build_steps(void) {
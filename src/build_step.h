@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: MIT
-// Copyright (c) 2024 Aymeric Wibo
+// Copyright (c) 2024-2026 Aymeric Wibo
 
 #pragma once
 
@@ -7,17 +7,22 @@
 #include <stdlib.h>
 
 typedef int (*build_step_cb_t)(size_t data_count, void** data);
+typedef void (*build_step_free_cb_t)(void* data);
 
 typedef struct {
 	uint64_t unique;
 	char const* name;
 	build_step_cb_t cb;
+	build_step_free_cb_t free_cb; // Called on each piece of data when the build steps are freed, if not NULL.
 
 	size_t data_count;
 	void** data;
 } build_step_t;
 
-int add_build_step(uint64_t unique, char const* name, build_step_cb_t cb, void* data);
+extern size_t build_step_count;
+extern build_step_t* build_steps;
+
+int add_build_step(uint64_t unique, char const* name, build_step_cb_t cb, build_step_free_cb_t free_cb, void* data);
 void free_build_steps(void);
 
 int run_build_steps(void);
@@ -52,7 +52,7 @@ static int build(flamingo_arg_list_t* args, flamingo_val_t** rv) {
 
 	// Add build step.
 
-	return add_build_step(strhash(CARGO), "Cargo build", build_step, NULL);
+	return add_build_step(strhash(CARGO), "Cargo build", build_step, NULL, NULL);
 }
 
 static void populate(char* key, size_t key_size, flamingo_val_t* val) {
@@ -14,7 +14,9 @@
 #include <logging.h>
 #include <ncpu.h>
 #include <pool.h>
+#include <progress.h>
 #include <str.h>
+#include <toolchain.h>
 
 #include <assert.h>
 #include <errno.h>
@@ -32,21 +34,34 @@ typedef struct {
 
 typedef struct {
 	state_t* state;
-	pthread_mutex_t logging_lock;
+
+	// Flags the build script passed along with those added by build modes (e.g. LTO).
+
+	flamingo_val_t* flags;
 
 	flamingo_val_t* src_vec;
 	flamingo_val_t* out_vec;
 } build_step_state_t;
 
-typedef struct {
+// Compile tasks don't hold on to a businessman while their commands run.
+// Instead, they're split into steps which each start a command and defer the task until it's done (see 'pool_defer()').
+
+typedef struct compile_task_t compile_task_t;
+
+struct compile_task_t {
 	build_step_state_t* bss;
+	pool_t* pool;
+	progress_t* progress;
 
 	char* src;
 	char* out;
-} compile_task_t;
+
+	cmd_t cmd;
+	task_fn_t next;
+};
 
 static void add_flags(cmd_t* cmd, compile_task_t* task) {
-	flamingo_val_t* const flags = task->bss->state->flags;
+	flamingo_val_t* const flags = task->bss->flags;
 
 	for (size_t i = 0; i < flags->vec.count; i++) {
 		flamingo_val_t* const flag = flags->vec.elems[i];
@@ -77,29 +92,32 @@ static void add_common(cmd_t* cmd) {
 	cmd_addf(cmd, "-isystem%s/include", install_prefix);
 }
 
-static void get_include_deps(compile_task_t* task, char* cc) {
-	// Figure out the include dependencies.
-	// For this, parse the Makefile rule output by the preprocessor.
-	// See: https://gcc.gnu.org/onlinedocs/gcc/Preprocessor-Options.html#Preprocessor-Options
-	// Also see: https://wiki.sei.cmu.edu/confluence/display/c/STR06-C.+Do+not+assume+that+strtok%28%29+leaves+the+parse+string+unchanged
-	// -MM: Output the dependencies to stdout, and imply the -E switch (i.e. preprocess only).
-	// -MT "": Exclude the source file from the output.
-	// TODO Can we do this in parallel easily with 'cmd_exec_async'?
+static void resume(cmd_t* cmd, void* data) {
+	compile_task_t* const task = data;
+	pool_resume(task->pool, task->next, task);
+}
 
-	cmd_t CMD_CLEANUP cmd = {0};
-	cmd_create(&cmd, cc, "-MM", "-MT", "", task->src, NULL);
-	add_flags(&cmd, task);
-	add_common(&cmd);
-	cmd_set_redirect(&cmd, CMD_REDIRECT, CMD_FORCE_REDIRECT);
+static void exec_then(compile_task_t* task, task_fn_t next) {
+	// Defer before starting the command, as the continuation could otherwise run (and finish) before we've even returned.
+	// If the command can't be spawned, just continue straight away with the failure.
 
-	int const rv = cmd_exec(&cmd);
+	task->next = next;
+	pool_defer(task->pool);
+
+	if (cmd_exec_cb(&task->cmd, resume, task) < 0) {
+		pool_resume(task->pool, next, task);
+	}
+}
+
+static void write_include_deps(compile_task_t* task) {
+	int const rv = task->cmd.rv;
 
 	if (rv < 0) {
-		LOG_WARN("Couldn't figure out include dependencies for %s - modifications to included files will not trigger a rebuild!", task->src, cc);
+		LOG_WARN("Couldn't figure out include dependencies for %s - modifications to included files will not trigger a rebuild!", task->src);
 		return;
 	}
 
-	char* const out = cmd_read_out(&cmd);
+	char* const out = cmd_read_out(&task->cmd);
 
 	// Open file for writing out include deps.
 
@@ -132,37 +150,26 @@ static void get_include_deps(compile_task_t* task, char* cc) {
 		fprintf(f, "%s\n", header);
 	}
 
+	set_owner_fd(fileno(f), deps_path);
 	fclose(f);
-	set_owner(deps_path);
 }
 
-static bool compile_task(void* data) {
-	compile_task_t* const task = data;
-	bool stop = false;
-
-	// Log that we're compiling.
-
-	pthread_mutex_lock(&task->bss->logging_lock);
-	LOG_INFO("%s" CLEAR ": Compiling...", task->src);
-	pthread_mutex_unlock(&task->bss->logging_lock);
-
-	// Get compiler command to use.
+static void free_task(compile_task_t* task) {
+	cmd_free(&task->cmd);
 
-	char* cc = getenv("CC");
-	cc = cc == NULL ? "cc" : cc;
-
-	// Get the include dependencies.
+	free(task->src);
+	free(task->out);
 
-	get_include_deps(task, cc);
+	free(task);
+}
 
-	// Run compilation command.
+static bool compiled(void* data) {
+	compile_task_t* const task = data;
+	bool stop = false;
 
-	cmd_t CMD_CLEANUP cmd = {0};
-	cmd_create(&cmd, cc, "-fdiagnostics-color=always", "-c", task->src, "-o", task->out, NULL);
-	add_flags(&cmd, task);
-	add_common(&cmd);
+	progress_done(task->progress);
 
-	if (cmd_exec(&cmd) < 0) {
+	if (task->cmd.rv < 0) {
 		stop = true;
 	}
 
@@ -170,21 +177,71 @@ static bool compile_task(void* data) {
 		set_owner(task->out);
 	}
 
-	pthread_mutex_lock(&task->bss->logging_lock);
-	cmd_log(&cmd, task->out, task->src, "compile", "compiled", true);
-	pthread_mutex_unlock(&task->bss->logging_lock);
+	cmd_log(&task->cmd, task->out, task->src, "compile", "compiled", true);
 
 	if (!stop && install_cookie(task->out, true) < 0) {
 		stop = true;
 	}
 
-	// Cleanup.
+	free_task(task);
+	return stop;
+}
 
-	free(task->src);
-	free(task->out);
+static bool got_include_deps(void* data) {
+	compile_task_t* const task = data;
 
-	free(task);
-	return stop;
+	write_include_deps(task);
+	cmd_free(&task->cmd);
+
+	// Don't bother compiling if another task already failed.
+
+	if (task->pool->error) {
+		free(task->src);
+		free(task->out);
+
+		free(task);
+		return false;
+	}
+
+	// Run compilation command.
+
+	cmd_create(&task->cmd, toolchain_cc(), "-fdiagnostics-color=always", "-c", task->src, "-o", task->out, NULL);
+	add_flags(&task->cmd, task);
+	add_common(&task->cmd);
+
+	// Compilers can output megabytes of warnings, so stream them straight to the log file.
+	// Also print diagnostics as they come in, so errors can be seen without waiting for the slowest compile in flight.
+
+	cmd_set_log(&task->cmd, task->out);
+	cmd_set_stream(&task->cmd, task->src);
+
+	exec_then(task, compiled);
+	return false;
+}
+
+static bool compile_task(void* data) {
+	compile_task_t* const task = data;
+
+	// Log that we're compiling, along with how far along we are.
+
+	char* const STR_CLEANUP status = progress_start(task->progress);
+
+	LOG_INFO("%s %s" CLEAR ": Compiling...", status, task->src);
+
+	// Get the include dependencies.
+	// For this, parse the Makefile rule output by the preprocessor.
+	// See: https://gcc.gnu.org/onlinedocs/gcc/Preprocessor-Options.html#Preprocessor-Options
+	// Also see: https://wiki.sei.cmu.edu/confluence/display/c/STR06-C.+Do+not+assume+that+strtok%28%29+leaves+the+parse+string+unchanged
+	// -MM: Output the dependencies to stdout, and imply the -E switch (i.e. preprocess only).
+	// -MT "": Exclude the source file from the output.
+
+	cmd_create(&task->cmd, toolchain_cc(), "-MM", "-MT", "", task->src, NULL);
+	add_flags(&task->cmd, task);
+	add_common(&task->cmd);
+	cmd_set_redirect(&task->cmd, CMD_REDIRECT, CMD_FORCE_REDIRECT);
+
+	exec_then(task, got_include_deps);
+	return false;
 }
 
 typedef enum {
@@ -243,6 +300,15 @@ static validation_res_t validate_requirements(flamingo_val_t* flags, char* src,
 		deps[dep_count++] = header;
 	}
 
+	// When optimizing with PGO, the object must be rebuilt when its profile changes (i.e. after retraining).
+
+	char* const STR_CLEANUP profile = toolchain_pgo_profile(out);
+
+	if (profile != NULL) {
+		deps = realloc_c(deps, (dep_count + 1) * sizeof *deps);
+		deps[dep_count++] = profile;
+	}
+
 	// Check modification times between dependencies and target.
 
 	bool do_compile;
@@ -258,9 +324,18 @@ static validation_res_t validate_requirements(flamingo_val_t* flags, char* src,
 
 static int compile_step(size_t data_count, void** data) {
 	pool_t pool;
-	pool_init(&pool, ncpu());
+	pool_init_async(&pool, ncpu());
 	int rv = -1;
 
+	progress_t progress;
+	progress_init(&progress);
+
+	already_done_summary_t summary = {0};
+
+	if (prep_cookie_shards() < 0) {
+		goto done;
+	}
+
 	for (size_t i = 0; i < data_count; i++) {
 		build_step_state_t* const bss = data[i];
 		assert(bss->src_vec->vec.count == bss->out_vec->vec.count);
@@ -272,12 +347,14 @@ static int compile_step(size_t data_count, void** data) {
 			char* const src = strndup_c(src_val->str.str, src_val->str.size);
 			char* const out = strndup_c(out_val->str.str, out_val->str.size);
 
-			validation_res_t vres = validate_requirements(bss->state->flags, src, out);
+			validation_res_t vres = validate_requirements(bss->flags, src, out);
 
 			if (vres == VALIDATION_RES_COMPILE) {
 				compile_task_t* const data = malloc_c(sizeof *data);
 
 				data->bss = bss;
+				data->pool = &pool;
+				data->progress = &progress;
 
 				data->src = src;
 				data->out = out;
@@ -287,11 +364,13 @@ static int compile_step(size_t data_count, void** data) {
 				// We should ensure the tasks are unique.
 
 				pool_add_task(&pool, compile_task, data);
+				progress_add(&progress, 1);
+
 				continue;
 			}
 
 			if (vres == VALIDATION_RES_SKIP) {
-				log_already_done(out, src, "compiled");
+				log_already_done_or_count(&summary, out, src, "compiled");
 
 				if (install_cookie(out, false) < 0) {
 					vres = VALIDATION_RES_ERR;
@@ -307,6 +386,7 @@ static int compile_step(size_t data_count, void** data) {
 		}
 	}
 
+	log_already_done_summary(&summary, "object", "objects");
 	rv = pool_wait(&pool);
 
 done:
@@ -315,7 +395,19 @@ done:
 	return rv;
 }
 
-static int prep_compile(state_t* state, flamingo_arg_list_t* args, flamingo_val_t** rv) {
+static void free_bss(void* data) {
+	build_step_state_t* const bss = data;
+
+	flamingo_val_decref(bss->flags);
+	flamingo_val_decref(bss->src_vec);
+	flamingo_val_decref(bss->out_vec);
+
+	free(bss);
+}
+
+static int prep_compile(flamingo_val_t* inst, flamingo_arg_list_t* args, flamingo_val_t** rv) {
+	state_t* const state = inst->inst.data;
+
 	// Validate sources argument.
 
 	if (args->count != 1) {
@@ -355,26 +447,36 @@ static int prep_compile(state_t* state, flamingo_arg_list_t* args, flamingo_val_
 		(*rv)->vec.elems[i] = cookie_val;
 	}
 
+	// Figure out the effective flags.
+	// This is done here rather than when instantiating, as the LTO mode is set after instantiation with 'lto()'.
+
+	lto_t lto;
+
+	if (toolchain_get_lto(inst, CC ".compile", &lto) < 0) {
+		return -1;
+	}
+
 	// Add build step.
 
 	build_step_state_t* const bss = malloc_c(sizeof *bss);
 
 	bss->state = state;
-	pthread_mutex_init(&bss->logging_lock, NULL);
+
+	bss->flags = toolchain_flags(state->flags, lto);
 
 	bss->src_vec = flamingo_val_incref(srcs);
 	bss->out_vec = flamingo_val_incref(*rv);
 
-	return add_build_step((uint64_t) state, "C source file compilation", compile_step, bss);
+	return add_build_step((uint64_t) state, "C source file compilation", compile_step, free_bss, bss);
 }
 
 static int call(flamingo_val_t* callable, flamingo_arg_list_t* args, flamingo_val_t** rv, bool* consumed) {
 	*consumed = true;
 
-	state_t* const state = callable->owner->owner->inst.data; // TODO Should this be passed to the call function of a class?
+	flamingo_val_t* const inst = callable->owner->owner; // TODO Should this be passed to the call function of a class?
 
 	if (flamingo_cstrcmp(callable->name, "compile", callable->name_size) == 0) {
-		return prep_compile(state, args, rv);
+		return prep_compile(inst, args, rv);
 	}
 
 	*consumed = false;
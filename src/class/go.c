@@ -71,6 +71,13 @@ static int build_step(size_t data_count, void** data) {
 	return rv;
 }
 
+static void free_bss(void* data) {
+	build_step_state_t* const bss = data;
+
+	flamingo_val_decref(bss->flags);
+	free(bss);
+}
+
 static int build(flamingo_arg_list_t* args, flamingo_val_t** rv) {
 	// Validate flags argument.
 
@@ -113,7 +120,7 @@ static int build(flamingo_arg_list_t* args, flamingo_val_t** rv) {
 	build_step_state_t* const bss = malloc_c(sizeof *bss);
 	bss->flags = flamingo_val_incref(flags);
 
-	return add_build_step(strhash(GO), "Go build", build_step, bss);
+	return add_build_step(strhash(GO), "Go build", build_step, free_bss, bss);
 }
 
 static void populate(char* key, size_t key_size, flamingo_val_t* val) {
@@ -13,8 +13,10 @@
 #include <fsutil.h>
 #include <install.h>
 #include <logging.h>
+#include <manifest.h>
 #include <pool.h>
 #include <str.h>
+#include <toolchain.h>
 
 #include <assert.h>
 #include <fts.h>
@@ -34,6 +36,11 @@ typedef struct {
 	state_t* state;
 	bool archive;
 
+	// Flags the build script passed along with those added by build modes (e.g. LTO).
+
+	lto_t lto;
+	flamingo_val_t* flags;
+
 	char const* log_prefix;
 	char const* infinitive;
 	char const* present;
@@ -68,7 +75,7 @@ static int link_step(size_t data_count, void** data) {
 
 	bool do_link;
 
-	if (frugal_link(&do_link, bss->log_prefix, bss->state->flags, src_count, srcs, out) < 0) {
+	if (frugal_link(&do_link, bss->log_prefix, bss->flags, src_count, srcs, out) < 0) {
 		goto link;
 	}
 
@@ -90,15 +97,11 @@ link:;
 	cmd_t cmd;
 
 	if (bss->archive) {
-		char* ar = getenv("AR");
-		ar = ar == NULL ? "ar" : ar;
-		cmd_create(&cmd, ar, "-rcs", out, NULL);
+		cmd_create(&cmd, toolchain_ar(bss->lto), "-rcs", out, NULL);
 	}
 
 	else {
-		char* cc = getenv("CC");
-		cc = cc == NULL ? "cc" : cc;
-		cmd_create(&cmd, cc, "-fdiagnostics-color=always", "-o", out, NULL);
+		cmd_create(&cmd, toolchain_cc(), "-fdiagnostics-color=always", "-o", out, NULL);
 		cmd_addf(&cmd, "-L%s/lib", install_prefix);
 
 #if defined(__APPLE__)
@@ -114,7 +117,7 @@ link:;
 
 	// Add flags.
 
-	flamingo_val_t* const flags = bss->state->flags;
+	flamingo_val_t* const flags = bss->flags;
 
 	for (size_t i = 0; i < flags->vec.count; i++) {
 		flamingo_val_t* const flag = flags->vec.elems[i];
@@ -138,7 +141,16 @@ link:;
 		}
 	}
 
+	// These must come after the flags, as the last '-flto' option is the one which counts.
+
+	if (!bss->archive) {
+		toolchain_add_lto_link_args(&cmd, bss->lto, bss->flags, out);
+	}
+
 	// Actually execute it.
+	// Link errors can be very long (e.g. a missing library means every single reference to it is undefined), so stream them straight to the log file.
+
+	cmd_set_log(&cmd, out);
 
 	if (pretty == NULL) {
 		LOG_INFO(CLEAR "%s...", bss->present);
@@ -170,7 +182,19 @@ done:
 	return rv;
 }
 
-static int prep_link(state_t* state, flamingo_arg_list_t* args, flamingo_val_t** rv, bool archive) {
+static void free_bss(void* data) {
+	build_step_state_t* const bss = data;
+
+	flamingo_val_decref(bss->flags);
+	flamingo_val_decref(bss->src_vec);
+	flamingo_val_decref(bss->out_str);
+
+	free(bss);
+}
+
+static int prep_link(flamingo_val_t* inst, flamingo_arg_list_t* args, flamingo_val_t** rv, bool archive) {
+	state_t* const state = inst->inst.data;
+
 	char const* const log_prefix = archive ? LINKER ".archive" : LINKER ".link";
 	char const* const infinitive = archive ? "archive" : "link";
 	char const* const present = archive ? "Archiving" : "Linking";
@@ -190,6 +214,15 @@ static int prep_link(state_t* state, flamingo_arg_list_t* args, flamingo_val_t**
 
 	flamingo_val_t* const srcs = args->args[0];
 
+	// Get LTO mode, which is set after instantiation with 'lto()'.
+	// Archiving just bundles up the objects, but it still needs to know if they're LTO objects to pick the right archiver.
+
+	lto_t lto;
+
+	if (toolchain_get_lto(inst, log_prefix, &lto) < 0) {
+		return -1;
+	}
+
 	// Return single output cookie (hash of all the inputs).
 
 	uint64_t total_hash = 0;
@@ -210,6 +243,7 @@ static int prep_link(state_t* state, flamingo_arg_list_t* args, flamingo_val_t**
 	char* STR_CLEANUP cookie = NULL;
 	asprintf_c(&cookie, "%s/linker.%s.cookie.%" PRIx64 ".%s", bsys_out_path, infinitive, total_hash, archive ? "a" : "l");
 	*rv = flamingo_val_make_cstr(cookie);
+	manifest_add(cookie);
 
 	// Add build step.
 
@@ -218,6 +252,9 @@ static int prep_link(state_t* state, flamingo_arg_list_t* args, flamingo_val_t**
 	bss->state = state;
 	bss->archive = archive;
 
+	bss->lto = lto;
+	bss->flags = archive ? flamingo_val_incref(state->flags) : toolchain_flags(state->flags, lto);
+
 	bss->log_prefix = log_prefix;
 	bss->infinitive = infinitive;
 	bss->present = present;
@@ -228,20 +265,20 @@ static int prep_link(state_t* state, flamingo_arg_list_t* args, flamingo_val_t**
 
 	// We never want to merge these build steps because the output hash from one set of source files to another is (hopefully) always different.
 
-	return add_build_step((uint64_t) bss, present, link_step, bss);
+	return add_build_step((uint64_t) bss, present, link_step, free_bss, bss);
 }
 
 static int call(flamingo_val_t* callable, flamingo_arg_list_t* args, flamingo_val_t** rv, bool* consumed) {
 	*consumed = true;
 
-	state_t* const state = callable->owner->owner->inst.data; // TODO Should this be passed to the call function of a class?
+	flamingo_val_t* const inst = callable->owner->owner; // TODO Should this be passed to the call function of a class?
 
 	if (flamingo_cstrcmp(callable->name, "link", callable->name_size) == 0) {
-		return prep_link(state, args, rv, false);
+		return prep_link(inst, args, rv, false);
 	}
 
 	else if (flamingo_cstrcmp(callable->name, "archive", callable->name_size) == 0) {
-		return prep_link(state, args, rv, true);
+		return prep_link(inst, args, rv, true);
 	}
 
 	*consumed = false;
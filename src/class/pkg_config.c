@@ -41,7 +41,7 @@ static int eval(char const* fn, char const* flag, char* module, pkg_config_cooki
 
 	if (cmd_rv != 0) {
 		LOG_ERROR(PKG_CONFIG ".%s: pkg-config failed:", fn, orig_out);
-		fprintf(stderr, "%s", orig_out);
+		log_raw(stderr, orig_out, strlen(orig_out));
 		free(module);
 		return -1;
 	}
@@ -152,7 +152,7 @@ static int common(
 	bss->fn = fn;
 	bss->flag = flag;
 
-	return add_build_step(((uint64_t) 'pkg-' << 32) | 'conf', "pkg-config evaluation", eval_step, bss);
+	return add_build_step(((uint64_t) 'pkg-' << 32) | 'conf', "pkg-config evaluation", eval_step, NULL, bss);
 }
 
 static int get_cflags(flamingo_arg_list_t* args, flamingo_val_t** rv) {
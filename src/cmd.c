@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: MIT
-// Copyright (c) 2024-2025 Aymeric Wibo
+// Copyright (c) 2024-2026 Aymeric Wibo
 
 #include <common.h>
 
@@ -7,18 +7,34 @@
 #include <cmd.h>
 #include <fsutil.h>
 #include <logging.h>
+#include <path_table.h>
+#include <spawn_server.h>
 #include <str.h>
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
 #include <spawn.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 
+#if defined(__linux__)
+# include <sys/syscall.h>
+#endif
+
+#if defined(__APPLE__) || defined(__FreeBSD__)
+# define USE_KQUEUE
+# include <sys/event.h>
+#endif
+
 void cmd_create(cmd_t* cmd, ...) {
 	va_list va;
 	va_start(va, cmd);
@@ -44,9 +60,21 @@ void cmd_create(cmd_t* cmd, ...) {
 	cmd_set_redirect(cmd, CMD_REDIRECT, CMD_NO_FORCE_REDIRECT);
 
 	cmd->out_buf = NULL;
+	cmd->out_size = 0;
+	cmd->out_cap = 0;
+
 	cmd->in = -1;
 	cmd->out = -1;
 
+	cmd->log_path = NULL;
+	cmd->log_tmp_path = NULL;
+	cmd->log_fd = -1;
+	cmd->log_size = 0;
+	cmd->out_elided = 0;
+
+	cmd->stream_prefix = NULL;
+	cmd->streamed = 0;
+
 	cmd->pending_stdin = NULL;
 	cmd->stdin_in = -1;
 	cmd->stdin_out = -1;
@@ -95,6 +123,16 @@ void cmd_set_redirect(cmd_t* cmd, cmd_redirect_t redirect, cmd_force_redirect_t
 	cmd->redirect = redirect;
 }
 
+void cmd_set_log(cmd_t* cmd, char const* cookie) {
+	free(cmd->log_path);
+	asprintf_c(&cmd->log_path, "%s.log", cookie);
+}
+
+void cmd_set_stream(cmd_t* cmd, char const* prefix) {
+	free(cmd->stream_prefix);
+	cmd->stream_prefix = strdup_c(prefix);
+}
+
 void cmd_prepare_stdin(cmd_t* cmd, char* data) {
 	cmd->pending_stdin = strdup_c(data);
 }
@@ -113,7 +151,91 @@ static bool is_executable(char const* path) {
 	return access(path, X_OK) == 0;
 }
 
+// Every command we spawn (and there can be tens of thousands of them) would otherwise walk '$PATH' again, which gets really slow when it has entries on e.g. NFS.
+// So remember where we found each binary, keyed on the contents of '$PATH' followed by the command name, so changes to '$PATH' (e.g. by 'setup_environment()') are still taken into account.
+// Only successful resolutions are remembered; a binary might appear later (e.g. installed by a dependency).
+// That binary might also appear in an earlier '$PATH' entry than the one we found it in, so everything is forgotten whenever something is installed (see 'cmd_forget_bins()').
+// Entries can't be removed from the table, so each one remembers the generation it was resolved in, and is resolved again in place once that's stale.
+
+typedef struct {
+	pthread_mutex_t lock;
+	uint64_t generation;
+	char* path;
+} resolved_bin_t;
+
+static path_table_t resolved_bins = PATH_TABLE_INIT;
+static _Atomic uint64_t bins_generation = 0;
+
+void cmd_forget_bins(void) {
+	atomic_fetch_add_explicit(&bins_generation, 1, memory_order_relaxed);
+}
+
+static void remember_bin(char const* key, size_t key_len, uint64_t generation, char const* full_path) {
+	void* found;
+
+	// If another thread added an entry for this key first, update that one instead.
+
+	if (!path_table_get(&resolved_bins, key, key_len, &found)) {
+		resolved_bin_t* const resolved = calloc_c(1, sizeof *resolved);
+		pthread_mutex_init(&resolved->lock, NULL);
+
+		if (!path_table_add(&resolved_bins, key, key_len, resolved)) {
+			pthread_mutex_destroy(&resolved->lock);
+			free(resolved);
+		}
+
+		path_table_get(&resolved_bins, key, key_len, &found);
+	}
+
+	resolved_bin_t* const resolved = found;
+	pthread_mutex_lock(&resolved->lock);
+
+	// Don't overwrite a resolution from a newer generation with ours.
+
+	if (resolved->path == NULL || generation >= resolved->generation) {
+		free(resolved->path);
+		resolved->path = strdup_c(full_path);
+		resolved->generation = generation;
+	}
+
+	pthread_mutex_unlock(&resolved->lock);
+}
+
 static char* find_bin(char const* cmd) {
+	// A bare name is looked up in '$PATH' (unless it's in the current directory), so check the cache before anything else; that way we don't even have to stat anything.
+	// This means that once a bare name has been found in '$PATH', an executable of that name which later appears in the current directory (or in the one an in-process dependency build changes into) isn't picked up until the cache is forgotten.
+
+	bool const bare = strchr(cmd, '/') == NULL;
+	char* const path = getenv("PATH");
+
+	char* STR_CLEANUP key = NULL;
+	size_t key_len = 0;
+	uint64_t generation = 0;
+	void* found;
+
+	if (bare && path != NULL) {
+		generation = atomic_load_explicit(&bins_generation, memory_order_relaxed);
+		asprintf_c(&key, "%s\n%s", path, cmd);
+		key_len = strlen(key);
+
+		if (path_table_get(&resolved_bins, key, key_len, &found)) {
+			resolved_bin_t* const resolved = found;
+			char* hit = NULL;
+
+			pthread_mutex_lock(&resolved->lock);
+
+			if (resolved->generation == generation) {
+				hit = strdup_c(resolved->path);
+			}
+
+			pthread_mutex_unlock(&resolved->lock);
+
+			if (hit != NULL) {
+				return hit;
+			}
+		}
+	}
+
 	if (is_executable(cmd)) {
 		return strdup_c(cmd);
 	}
@@ -121,11 +243,11 @@ static char* find_bin(char const* cmd) {
 	// Look for binary in $PATH.
 	// $PATH should be traversed from beginning to end (earlier entries have higher priority).
 
-	char* const path = getenv("PATH");
+	// Logging is asynchronous, so just fail like when the binary isn't found rather than exiting on the spot and losing the error.
 
 	if (path == NULL) {
 		LOG_ERROR("getenv(\"PATH\"): couldn't find '$PATH' (and binary '%s' was not found)", cmd);
-		_exit(EXIT_FAILURE);
+		return NULL;
 	}
 
 	char* const STR_CLEANUP orig_search = strdup_c(path);
@@ -138,6 +260,10 @@ static char* find_bin(char const* cmd) {
 		asprintf_c(&full_path, "%s/%s", tok, cmd);
 
 		if (is_executable(full_path)) {
+			if (key != NULL) {
+				remember_bin(key, key_len, generation, full_path);
+			}
+
 			return full_path;
 		}
 
@@ -161,10 +287,80 @@ int cmd_exec_inplace(cmd_t* cmd) {
 		return -1;
 	}
 
+	logging_flush();
 	return execv(path, cmd->args);
 }
 
-static pid_t cmd_exec_async(cmd_t* cmd) {
+int cmd_exec_detached(cmd_t* cmd, int stdin_fd) {
+	char* const STR_CLEANUP path = find_bin(cmd->args[0]);
+
+	if (path == NULL) {
+		return -1;
+	}
+
+	// Give the command its own session, so that e.g. ^C in the terminal doesn't reach it, and don't let it write to our stdio.
+
+	posix_spawnattr_t attr;
+	posix_spawnattr_init(&attr);
+
+#if defined(POSIX_SPAWN_SETSID)
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID);
+#else
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+	posix_spawnattr_setpgroup(&attr, 0);
+#endif
+
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+
+	// dup2(2) clears close-on-exec on the new file descriptor, so the one we're asked to pass on survives the exec.
+
+	if (stdin_fd >= 0) {
+		posix_spawn_file_actions_adddup2(&actions, stdin_fd, STDIN_FILENO);
+	}
+
+	else {
+		posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+	}
+
+	posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+	posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+
+	extern char** environ;
+	pid_t pid;
+
+	int const rv = posix_spawn(&pid, path, &actions, &attr, cmd->args, environ);
+
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+
+	if (rv != 0) {
+		LOG_ERROR("posix_spawn: %s", strerror(rv));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int make_pipe(int fd[2]) {
+	// These must be close-on-exec, otherwise other commands spawned in the meantime inherit them, and we wouldn't see EOF until they exit too.
+	// The ends which are dup'ed onto the child's stdio lose the flag.
+
+#if defined(__APPLE__)
+	if (pipe(fd) < 0) {
+		return -1;
+	}
+
+	fcntl(fd[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fd[1], F_SETFD, FD_CLOEXEC);
+
+	return 0;
+#else
+	return pipe2(fd, O_CLOEXEC);
+#endif
+}
+
+static pid_t spawn(cmd_t* cmd, bool served) {
 	// Find binary.
 
 	char* const STR_CLEANUP path = find_bin(cmd->args[0]);
@@ -178,7 +374,7 @@ static pid_t cmd_exec_async(cmd_t* cmd) {
 	if (cmd->redirect) {
 		int fd[2];
 
-		if (pipe(fd) < 0) {
+		if (make_pipe(fd) < 0) {
 			LOG_FATAL("pipe: %s", strerror(errno));
 			return -1;
 		}
@@ -192,7 +388,7 @@ static pid_t cmd_exec_async(cmd_t* cmd) {
 	if (cmd->pending_stdin != NULL) {
 		int fd[2];
 
-		if (pipe(fd) < 0) {
+		if (make_pipe(fd) < 0) {
 			LOG_FATAL("pipe: %s", strerror(errno));
 			return -1;
 		}
@@ -201,12 +397,26 @@ static pid_t cmd_exec_async(cmd_t* cmd) {
 		cmd->stdin_out = fd[0];
 	}
 
+	// If the command writes straight to our stdout and stderr, anything we logged before must come out first.
+
+	if (!cmd->redirect) {
+		logging_flush();
+	}
+
 	// Spawn process.
 	// We can't use 'fork()' here, because we could be called from a multi-threaded context.
 	// https://www.qnx.com/developers/docs/8.0/com.qnx.doc.neutrino.getting_started/topic/s1_procs_Multithreaded_fork.html
 	// I used the excellent accepted answer here to figure out the piping stuff:
 	// https://stackoverflow.com/questions/13893085/posix-spawnp-and-piping-child-output-to-a-string
 
+	extern char** environ;
+	pid_t pid;
+
+	if (served) {
+		pid = spawn_server_spawn(path, cmd->args, cmd->redirect ? cmd->in : -1, cmd->pending_stdin != NULL ? cmd->stdin_out : -1);
+		goto spawned;
+	}
+
 	posix_spawn_file_actions_t actions;
 	posix_spawn_file_actions_init(&actions);
 
@@ -222,13 +432,16 @@ static pid_t cmd_exec_async(cmd_t* cmd) {
 		posix_spawn_file_actions_addclose(&actions, cmd->stdin_in);
 	}
 
-	extern char** environ;
-	pid_t pid;
-
 	if (posix_spawnp(&pid, path, &actions, NULL, cmd->args, environ) < 0) {
 		LOG_ERROR("posix_spawnp: %s", strerror(errno));
 		pid = -1;
+	}
+
+	posix_spawn_file_actions_destroy(&actions);
 
+spawned:
+
+	if (pid < 0) {
 		if (cmd->redirect) {
 			close(cmd->out);
 			cmd->out = -1;
@@ -238,8 +451,6 @@ static pid_t cmd_exec_async(cmd_t* cmd) {
 		cmd->stdin_in = -1;
 	}
 
-	posix_spawn_file_actions_destroy(&actions);
-
 	if (cmd->redirect) {
 		close(cmd->in);
 		cmd->in = -1;
@@ -259,71 +470,619 @@ static pid_t cmd_exec_async(cmd_t* cmd) {
 	return pid;
 }
 
-static int wait_for_process(pid_t pid, int* sig) {
-	assert(sig != NULL);
+// Child process supervisor.
+// Rather than having a thread block on each running command (first reading its output, then waiting for it to exit), a single thread owns all running commands.
+// It polls their output pipes and waits for them to exit all at once, and calls back whoever started the command once it's done.
+// This way, the number of commands we can run at the same time isn't limited by the number of threads.
+//
+// To know when a child exits without blocking, we use a pidfd on Linux and kqueue on macOS and FreeBSD, both of which can be polled along with the output pipes.
+// If neither is available, we fall back to periodically checking with 'waitpid(WNOHANG)'.
+// Commands started through the spawn server aren't our children, so we learn of their exit from the records it sends us instead (see 'src/spawn_server.h').
 
-	int wstatus = 0;
-	while (waitpid(pid, &wstatus, 0) > 0)
-		;
+#define POLL_EXIT_INTERVAL_MS 10
 
-	if (WIFSIGNALED(wstatus)) {
-		*sig = WTERMSIG(wstatus);
-		return -1;
+typedef struct child_t child_t;
+
+struct child_t {
+	child_t* next;
+
+	cmd_t* cmd;
+	pid_t pid;
+	int pidfd;
+	bool poll_exit;
+	bool served;
+
+	bool exited;
+	int wstatus;
+
+	cmd_cb_t cb;
+	void* data;
+};
+
+static pthread_once_t supervisor_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t supervisor_lock = PTHREAD_MUTEX_INITIALIZER;
+static child_t* children = NULL;
+static int wake_fds[2] = {-1, -1};
+
+#if defined(USE_KQUEUE)
+static int kq = -1;
+#endif
+
+// Exit records from the spawn server which arrived before their child was handed over to us.
+
+static size_t early_exit_count = 0;
+static spawn_server_exit_t* early_exits = NULL;
+
+static void read_exit_records(int fd) {
+	spawn_server_exit_t records[64];
+	ssize_t bytes;
+
+	// Records are small enough that they're never split up.
+
+	while ((bytes = read(fd, records, sizeof records)) > 0) {
+		pthread_mutex_lock(&supervisor_lock);
+
+		for (size_t i = 0; i < bytes / sizeof *records; i++) {
+			spawn_server_exit_t* const record = &records[i];
+			child_t* child;
+
+			for (child = children; child != NULL; child = child->next) {
+				if (child->served && child->pid == record->pid) {
+					break;
+				}
+			}
+
+			if (child == NULL) {
+				early_exits = realloc_c(early_exits, (early_exit_count + 1) * sizeof *early_exits);
+				early_exits[early_exit_count++] = *record;
+				continue;
+			}
+
+			child->exited = true;
+			child->wstatus = record->wstatus;
+		}
+
+		pthread_mutex_unlock(&supervisor_lock);
 	}
+}
+
+static void reserve_out(cmd_t* cmd, size_t extra) {
+	// Grow geometrically, so a chatty command doesn't cost a realloc per chunk.
 
-	if (WIFEXITED(wstatus)) {
-		return WEXITSTATUS(wstatus) == EXIT_SUCCESS ? 0 : -1;
+	if (cmd->out_cap - cmd->out_size >= extra + 1) {
+		return;
 	}
 
-	return 0;
+	cmd->out_cap = cmd->out_cap * 2 > cmd->out_size + extra + 1 ? cmd->out_cap * 2 : cmd->out_size + extra + 1;
+	cmd->out_buf = realloc_c(cmd->out_buf, cmd->out_cap);
 }
 
-int cmd_exec(cmd_t* cmd) {
-	pid_t const pid = cmd_exec_async(cmd);
+static void stream_to_log(cmd_t* cmd, char const* buf, size_t size) {
+	while (cmd->log_fd >= 0 && size > 0) {
+		ssize_t const bytes = write(cmd->log_fd, buf, size);
+
+		if (bytes < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (bytes < 0) {
+			LOG_WARN("Failed to write to '%s': %s", cmd->log_tmp_path, strerror(errno));
+
+			close(cmd->log_fd);
+			cmd->log_fd = -1;
+
+			break;
+		}
+
+		buf += bytes;
+		size -= bytes;
+		cmd->log_size += bytes;
+	}
+
+	// Only keep the tail of the output in memory.
+	// We let it grow to twice the tail size before shifting it back down, so that the cost of moving it around is amortized.
+
+	if (cmd->out_size > 2 * CMD_LOG_TAIL) {
+		size_t const drop = cmd->out_size - CMD_LOG_TAIL;
+
+		memmove(cmd->out_buf, cmd->out_buf + drop, CMD_LOG_TAIL);
+		cmd->out_size = CMD_LOG_TAIL;
+		cmd->out_elided += drop;
+
+		// 'stream_lines()' never leaves more than a tail's worth of output unprinted, so this can't underflow.
+
+		if (cmd->stream_prefix != NULL) {
+			cmd->streamed -= drop;
+		}
+	}
+}
+
+static void stream_lines(cmd_t* cmd, bool all) {
+	if (cmd->stream_prefix == NULL) {
+		return;
+	}
+
+	char* const start = cmd->out_buf + cmd->streamed;
+	size_t const len = cmd->out_size - cmd->streamed;
+
+	// Only print complete lines, unless we're told to print everything or a line is so long we can't keep it around.
+
+	size_t upto = len;
+
+	while (upto > 0 && start[upto - 1] != '\n') {
+		upto--;
+	}
+
+	if (all || len - upto > CMD_LOG_TAIL) {
+		upto = len;
+	}
+
+	if (upto == 0) {
+		return;
+	}
+
+	// Hold these back so lines from different commands can't interleave.
+
+	logging_hold();
+
+	for (char* line = start; line < start + upto;) {
+		char* const nl = memchr(line, '\n', start + upto - line);
+		size_t const line_len = (nl == NULL ? start + upto : nl) - line;
+
+		log_rawf(stdout, "%s" CLEAR ": %.*s\n", cmd->stream_prefix, (int) line_len, line);
+		line += line_len + 1;
+	}
+
+	logging_release();
+
+	cmd->streamed += upto;
+}
+
+static void drain(child_t* child) {
+	cmd_t* const cmd = child->cmd;
+
+	for (;;) {
+		reserve_out(cmd, 4096);
+		ssize_t const bytes = read(cmd->out, cmd->out_buf + cmd->out_size, cmd->out_cap - cmd->out_size - 1);
+
+		if (bytes > 0) {
+			cmd->out_size += bytes;
+			stream_lines(cmd, false);
+
+			if (cmd->log_tmp_path != NULL) {
+				stream_to_log(cmd, cmd->out_buf + cmd->out_size - bytes, bytes);
+			}
+
+			continue;
+		}
+
+		if (bytes < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return;
+		}
+
+		if (bytes < 0) {
+			LOG_WARN("%s: Failed to read from %d: %s", __func__, cmd->out, strerror(errno));
+		}
+
+		close(cmd->out);
+		cmd->out = -1;
+
+		return;
+	}
+}
+
+static void reap(child_t* child) {
+	if (waitpid(child->pid, &child->wstatus, WNOHANG) == child->pid) {
+		child->exited = true;
+	}
+}
+
+static void open_log(cmd_t* cmd) {
+	if (cmd->log_path == NULL) {
+		return;
+	}
+
+	// If we can't stream the output, forget about the log file so that 'cmd_log()' deals with it as usual.
+
+	if (!cmd->redirect) {
+		goto forget;
+	}
+
+	asprintf_c(&cmd->log_tmp_path, "%s.XXXXXX", cmd->log_path);
+	cmd->log_fd = mkstemp(cmd->log_tmp_path);
+
+	if (cmd->log_fd < 0) {
+		LOG_WARN("mkstemp(\"%s\"): %s", cmd->log_tmp_path, strerror(errno));
+
+		free(cmd->log_tmp_path);
+		cmd->log_tmp_path = NULL;
+
+		goto forget;
+	}
+
+	// Make sure it doesn't leak into other commands, and isn't only readable by us like 'mkstemp()' would have it.
+
+	fcntl(cmd->log_fd, F_SETFD, FD_CLOEXEC);
+	fchmod(cmd->log_fd, 0644);
+
+	return;
+
+forget:
+
+	free(cmd->log_path);
+	cmd->log_path = NULL;
+}
+
+static void close_log(cmd_t* cmd) {
+	if (cmd->log_tmp_path == NULL) {
+		return;
+	}
+
+	bool const ok = cmd->log_fd >= 0;
+
+	if (ok) {
+		// Set the owner while we still have the log open, so the kernel doesn't have to look it up again once it's renamed.
+
+		if (cmd->log_size > 0) {
+			set_owner_fd(cmd->log_fd, cmd->log_path);
+		}
+
+		close(cmd->log_fd);
+		cmd->log_fd = -1;
+	}
+
+	// If there's no output, we don't want a log file at all, not even a stale one.
+
+	if (!ok || cmd->log_size == 0) {
+		remove(cmd->log_tmp_path);
+		remove(cmd->log_path);
+	}
+
+	else if (rename(cmd->log_tmp_path, cmd->log_path) < 0) {
+		LOG_WARN("rename(\"%s\", \"%s\"): %s", cmd->log_tmp_path, cmd->log_path, strerror(errno));
+		remove(cmd->log_tmp_path);
+	}
+
+	free(cmd->log_tmp_path);
+	cmd->log_tmp_path = NULL;
+}
+
+static void finish(child_t* child) {
+	cmd_t* const cmd = child->cmd;
+
+	reserve_out(cmd, 0);
+	cmd->out_buf[cmd->out_size] = '\0';
+
+	stream_lines(cmd, true);
+	close_log(cmd);
+
+	cmd->sig = 0;
+	cmd->rv = 0;
+
+	if (WIFSIGNALED(child->wstatus)) {
+		cmd->sig = WTERMSIG(child->wstatus);
+		cmd->rv = -1;
+	}
+
+	else if (WIFEXITED(child->wstatus)) {
+		cmd->rv = WEXITSTATUS(child->wstatus) == EXIT_SUCCESS ? 0 : -1;
+	}
+
+	if (child->pidfd >= 0) {
+		close(child->pidfd);
+	}
+
+	child->cb(cmd, child->data);
+	free(child);
+}
+
+static void* supervise(void* arg) {
+	size_t cap = 0;
+	struct pollfd* fds = NULL;
+	child_t** owners = NULL;
+
+	for (;;) {
+		// Build the set of file descriptors to poll.
+		// Only this thread ever removes children from the list or touches their state once they're in it, so we can let go of the lock while polling.
+
+		pthread_mutex_lock(&supervisor_lock);
+
+		size_t count = 0;
+		bool poll_exit = false;
+
+		for (child_t* child = children; child != NULL; child = child->next) {
+			count++;
+		}
+
+		if (cap < count * 2 + 3) {
+			cap = count * 2 + 3;
+			fds = realloc_c(fds, cap * sizeof *fds);
+			owners = realloc_c(owners, cap * sizeof *owners);
+		}
+
+		size_t nfds = 0;
+
+		fds[nfds] = (struct pollfd) {.fd = wake_fds[0], .events = POLLIN};
+		owners[nfds++] = NULL;
+
+#if defined(USE_KQUEUE)
+		fds[nfds] = (struct pollfd) {.fd = kq, .events = POLLIN};
+		owners[nfds++] = NULL;
+#endif
+
+		int const exit_fd = spawn_server_exit_fd();
+
+		if (exit_fd >= 0) {
+			fds[nfds] = (struct pollfd) {.fd = exit_fd, .events = POLLIN};
+			owners[nfds++] = NULL;
+		}
+
+		for (child_t* child = children; child != NULL; child = child->next) {
+			if (child->cmd->out >= 0) {
+				fds[nfds] = (struct pollfd) {.fd = child->cmd->out, .events = POLLIN};
+				owners[nfds++] = child;
+			}
+
+			if (child->exited) {
+				continue;
+			}
+
+			if (child->pidfd >= 0) {
+				fds[nfds] = (struct pollfd) {.fd = child->pidfd, .events = POLLIN};
+				owners[nfds++] = child;
+			}
+
+			poll_exit |= child->poll_exit;
+		}
+
+		pthread_mutex_unlock(&supervisor_lock);
+
+		// Wait for something to happen.
+
+		if (poll(fds, nfds, poll_exit ? POLL_EXIT_INTERVAL_MS : -1) < 0 && errno != EINTR) {
+			LOG_ERROR("poll: %s", strerror(errno));
+		}
+
+		// Handle whatever happened.
+
+		for (size_t i = 0; i < nfds; i++) {
+			if (fds[i].revents == 0) {
+				continue;
+			}
+
+			child_t* const child = owners[i];
+
+			if (child == NULL && fds[i].fd == wake_fds[0]) {
+				char buf[64];
+				while (read(wake_fds[0], buf, sizeof buf) > 0)
+					;
+			}
+
+#if defined(USE_KQUEUE)
+			else if (child == NULL && fds[i].fd == kq) {
+				struct kevent events[64];
+				struct timespec const zero = {0};
+				int const n = kevent(kq, NULL, 0, events, sizeof events / sizeof *events, &zero);
+
+				pthread_mutex_lock(&supervisor_lock);
+
+				for (int j = 0; j < n; j++) {
+					for (child_t* child = children; child != NULL; child = child->next) {
+						if (child->pid == (pid_t) events[j].ident) {
+							reap(child);
+						}
+					}
+				}
+
+				pthread_mutex_unlock(&supervisor_lock);
+			}
+#endif
+
+			else if (child == NULL && fds[i].fd == exit_fd) {
+				read_exit_records(exit_fd);
+			}
+
+			else if (fds[i].fd == child->cmd->out) {
+				drain(child);
+			}
+
+			else if (fds[i].fd == child->pidfd) {
+				reap(child);
+			}
+		}
+
+		// Take out children which are all done.
+		// We must have seen EOF on their output pipe (if any) and they must have exited.
+
+		child_t* done = NULL;
+		pthread_mutex_lock(&supervisor_lock);
+
+		for (child_t** child_ref = &children; *child_ref != NULL;) {
+			child_t* const child = *child_ref;
+
+			if (!child->exited && child->poll_exit) {
+				reap(child);
+			}
+
+			if (!child->exited || child->cmd->out >= 0) {
+				child_ref = &child->next;
+				continue;
+			}
+
+			*child_ref = child->next;
+			child->next = done;
+			done = child;
+		}
+
+		pthread_mutex_unlock(&supervisor_lock);
+
+		// Finally, call back whoever is waiting on them.
+
+		while (done != NULL) {
+			child_t* const next = done->next;
+			finish(done);
+			done = next;
+		}
+	}
+
+	return NULL;
+}
+
+static void start_supervisor(void) {
+	if (make_pipe(wake_fds) < 0) {
+		LOG_FATAL("pipe: %s", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	fcntl(wake_fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(wake_fds[1], F_SETFL, O_NONBLOCK);
+
+#if defined(USE_KQUEUE)
+	kq = kqueue();
+
+	if (kq < 0) {
+		LOG_FATAL("kqueue: %s", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+#endif
+
+	pthread_t thread;
+
+	if (pthread_create(&thread, NULL, supervise, NULL) != 0) {
+		LOG_FATAL("Failed to create child process supervisor thread.");
+		exit(EXIT_FAILURE);
+	}
+
+	pthread_detach(thread);
+}
+
+int cmd_exec_cb(cmd_t* cmd, cmd_cb_t cb, void* data) {
+	pthread_once(&supervisor_once, start_supervisor);
+
+	cmd->out_size = 0;
+	cmd->out_elided = 0;
+	cmd->log_size = 0;
+	cmd->streamed = 0;
+
+	bool const served = spawn_server_active;
+	pid_t const pid = spawn(cmd, served);
 
 	if (pid < 0) {
+		reserve_out(cmd, 0);
+		cmd->out_buf[0] = '\0';
+
+		cmd->sig = 0;
+		cmd->rv = -1;
+
 		return -1;
 	}
 
-	cmd->sig = 0;
+	open_log(cmd);
 
-	free(cmd->out_buf);
-	cmd->out_buf = strdup_c("");
+	child_t* const child = calloc_c(1, sizeof *child);
 
-	if (!cmd->redirect) {
-		goto just_wait;
+	child->cmd = cmd;
+	child->pid = pid;
+	child->pidfd = -1;
+	child->served = served;
+
+	child->cb = cb;
+	child->data = data;
+
+	if (cmd->out >= 0) {
+		fcntl(cmd->out, F_SETFL, O_NONBLOCK);
 	}
 
-	// If redirecting output, continuously read it.
-	// This is to prevent the process blocking if it has filled its pipe buffer.
+	// Figure out how we'll know the child has exited.
+
+	if (served) {
+		goto hand_over;
+	}
+
+#if defined(__linux__) && defined(SYS_pidfd_open)
+	child->pidfd = syscall(SYS_pidfd_open, pid, 0);
+	child->poll_exit = child->pidfd < 0;
+#elif defined(USE_KQUEUE)
+	struct kevent ev;
+	EV_SET(&ev, pid, EVFILT_PROC, EV_ADD | EV_ONESHOT, NOTE_EXIT, 0, NULL);
+
+	// If this fails, the child has probably already exited ('ESRCH').
+	// Either way, just check on it periodically.
 
-	int const pipe = cmd->out;
+	child->poll_exit = kevent(kq, &ev, 1, NULL, 0, NULL) < 0;
+#else
+	child->poll_exit = true;
+#endif
 
-	if (pipe == -1) {
-		goto just_wait;
+	// Hand it over to the supervisor.
+	// If it's from the spawn server, it may already have exited.
+
+hand_over:
+
+	pthread_mutex_lock(&supervisor_lock);
+
+	for (size_t i = 0; served && i < early_exit_count; i++) {
+		if (early_exits[i].pid != pid) {
+			continue;
+		}
+
+		child->exited = true;
+		child->wstatus = early_exits[i].wstatus;
+
+		early_exits[i] = early_exits[--early_exit_count];
+		break;
 	}
 
-	size_t total = 0;
+	child->next = children;
+	children = child;
 
-	char chunk[4096];
-	ssize_t bytes;
+	pthread_mutex_unlock(&supervisor_lock);
+
+	write(wake_fds[1], "", 1);
+	return 0;
+}
 
-	while ((bytes = read(pipe, chunk, sizeof chunk)) > 0) {
-		total += bytes;
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool done;
+} waiter_t;
 
-		cmd->out_buf = realloc_c(cmd->out_buf, total + 1);
-		memcpy(cmd->out_buf + total - bytes, chunk, bytes);
+static void wake_waiter(cmd_t* cmd, void* data) {
+	waiter_t* const waiter = data;
+
+	pthread_mutex_lock(&waiter->lock);
+	waiter->done = true;
+	pthread_cond_signal(&waiter->cond);
+	pthread_mutex_unlock(&waiter->lock);
+}
+
+int cmd_exec(cmd_t* cmd) {
+	waiter_t waiter = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+		.done = false,
+	};
+
+	if (cmd_exec_cb(cmd, wake_waiter, &waiter) < 0) {
+		return -1;
 	}
 
-	if (bytes < 0) {
-		LOG_WARN("%s: Failed to read from %d: %s", __func__, pipe, strerror(errno));
+	pthread_mutex_lock(&waiter.lock);
+
+	while (!waiter.done) {
+		pthread_cond_wait(&waiter.cond, &waiter.lock);
 	}
 
-	cmd->out_buf[total] = '\0';
+	pthread_mutex_unlock(&waiter.lock);
 
-just_wait:
+	pthread_mutex_destroy(&waiter.lock);
+	pthread_cond_destroy(&waiter.cond);
 
-	cmd->rv = wait_for_process(pid, &cmd->sig);
 	return cmd->rv;
 }
 
@@ -338,24 +1097,28 @@ char* cmd_read_out(cmd_t* cmd) {
 	asprintf_c(&sig_str, BOLD RED "Terminated by signal: %s\n", strsignal(cmd->sig));
 	size_t const sig_len = strlen(sig_str);
 
-	size_t total = strlen(cmd->out_buf);
-
-	cmd->out_buf = realloc_c(cmd->out_buf, total + sig_len + 1);
-	memcpy(cmd->out_buf + total, sig_str, sig_len);
-	total += sig_len;
+	reserve_out(cmd, sig_len);
+	memcpy(cmd->out_buf + cmd->out_size, sig_str, sig_len);
+	cmd->out_size += sig_len;
 
-	cmd->out_buf[total] = '\0';
+	cmd->out_buf[cmd->out_size] = '\0';
 	return cmd->out_buf;
 }
 
 void cmd_log(cmd_t* cmd, char const* cookie, char const* prefix, char const* infinitive, char const* past, bool log_success) {
 	char* const out = cmd_read_out(cmd);
 	bool const is_out = out[0] != '\0';
-	bool const log_out = is_out && (log_success || cmd->rv < 0);
+
+	// If the output was already streamed as it came in, only what's left (i.e. the signal message) still needs to be printed.
+
+	size_t const printed = cmd->stream_prefix != NULL ? cmd->streamed : 0;
+	bool const log_out = cmd->out_size > printed && (log_success || cmd->rv < 0);
 	char* const suffix = log_out ? ":" : ".";
 
 #define P prefix ? prefix : "", prefix ? ": " : ""
 
+	logging_hold();
+
 	if (cmd->rv < 0) {
 		LOG_ERROR("%s" CLEAR "%sFailed to %s%s", P, infinitive, suffix);
 	}
@@ -366,14 +1129,21 @@ void cmd_log(cmd_t* cmd, char const* cookie, char const* prefix, char const* inf
 
 #undef P
 
+	if (log_out && printed == 0 && cmd->out_elided > 0) {
+		log_rawf(stdout, "[%zu bytes of output elided, see '%s' for the full log]\n", cmd->out_elided, cmd->log_path);
+	}
+
 	if (log_out) {
-		printf("%s", out);
+		log_raw(stdout, out + printed, cmd->out_size - printed);
 	}
 
+	logging_release();
+
 	// Write out log to file, only if there is one.
 	// If not, attempt to remove the existing one anyway.
+	// If the output was streamed to the log file, this has already been taken care of.
 
-	if (cookie == NULL) {
+	if (cookie == NULL || cmd->log_path != NULL) {
 		return;
 	}
 
@@ -385,16 +1155,45 @@ void cmd_log(cmd_t* cmd, char const* cookie, char const* prefix, char const* inf
 		return;
 	}
 
-	FILE* const f = fopen(path, "w");
+	// Write to a temporary file first, so the log file is never seen half-written.
 
-	if (f == NULL) {
-		LOG_WARN("fopen(\"%s\", \"w\"): %s", path, strerror(errno));
+	char* STR_CLEANUP tmp_path;
+	asprintf_c(&tmp_path, "%s.XXXXXX", path);
+	int const fd = mkstemp(tmp_path);
+
+	if (fd < 0) {
+		LOG_WARN("mkstemp(\"%s\"): %s", tmp_path, strerror(errno));
 		return;
 	}
 
-	fprintf(f, "%s", out);
-	fclose(f);
-	set_owner(path);
+	fchmod(fd, 0644);
+
+	for (size_t written = 0; written < cmd->out_size;) {
+		ssize_t const bytes = write(fd, out + written, cmd->out_size - written);
+
+		if (bytes < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (bytes < 0) {
+			LOG_WARN("Failed to write to '%s': %s", tmp_path, strerror(errno));
+
+			close(fd);
+			remove(tmp_path);
+
+			return;
+		}
+
+		written += bytes;
+	}
+
+	set_owner_fd(fd, path);
+	close(fd);
+
+	if (rename(tmp_path, path) < 0) {
+		LOG_WARN("rename(\"%s\", \"%s\"): %s", tmp_path, path, strerror(errno));
+		remove(tmp_path);
+	}
 }
 
 __attribute__((unused)) void cmd_print(cmd_t* cmd) {
@@ -421,6 +1220,18 @@ void cmd_free(cmd_t* cmd) {
 	free(cmd->out_buf);
 	free(cmd->pending_stdin);
 
+	if (cmd->log_fd >= 0) {
+		close(cmd->log_fd);
+	}
+
+	if (cmd->log_tmp_path != NULL) {
+		remove(cmd->log_tmp_path);
+	}
+
+	free(cmd->log_path);
+	free(cmd->log_tmp_path);
+	free(cmd->stream_prefix);
+
 	if (cmd->in >= 0) {
 		close(cmd->in);
 	}
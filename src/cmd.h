@@ -45,10 +45,26 @@ typedef struct {
 	// Pipe (stdout & stderr).
 
 	char* out_buf;
+	size_t out_size;
+	size_t out_cap;
 
 	int in;
 	int out;
 
+	// Log file the output is streamed to (see 'cmd_set_log()').
+	// While streaming, 'out_buf' only keeps the tail of the output, and 'out_elided' counts how many bytes were dropped from its start.
+
+	char* log_path;
+	char* log_tmp_path;
+	int log_fd;
+	size_t log_size;
+	size_t out_elided;
+
+	// Prefix output lines are printed with as they come in (see 'cmd_set_stream()'), and how much of 'out_buf' has been printed so far.
+
+	char* stream_prefix;
+	size_t streamed;
+
 	// Pipe (stdin).
 
 	char* pending_stdin;
@@ -121,6 +137,39 @@ typedef enum {
  */
 void cmd_set_redirect(cmd_t* cmd, cmd_redirect_t redirect, cmd_force_redirect_t force);
 
+/**
+ * Maximum number of bytes of output kept in memory when streaming it to a log file.
+ */
+#define CMD_LOG_TAIL (64 * 1024)
+
+/**
+ * Stream the command's output to its log file as it comes in.
+ *
+ * The log file is written to a temporary file which is only renamed to '<cookie>.log' once the command is done, so the log file is never seen half-written.
+ * If the command doesn't output anything, the log file is removed instead.
+ * Only the last {@link CMD_LOG_TAIL} bytes of output are kept in 'cmd_t.out_buf', so this is only for commands whose output is only ever logged.
+ * {@link cmd_log} then doesn't write the log file again.
+ *
+ * This does nothing if the command's output isn't redirected.
+ *
+ * @param cmd Command to configure.
+ * @param cookie Cookie the log file belongs to.
+ */
+void cmd_set_log(cmd_t* cmd, char const* cookie);
+
+/**
+ * Print the command's output as it comes in, one line at a time, each prefixed with 'prefix'.
+ *
+ * This lets diagnostics from commands running in parallel be seen as soon as possible without them getting mixed up.
+ * The output is still captured in 'cmd_t.out_buf', and {@link cmd_log} doesn't print it again.
+ *
+ * This does nothing if the command's output isn't redirected.
+ *
+ * @param cmd Command to configure.
+ * @param prefix Prefix to print before each line.
+ */
+void cmd_set_stream(cmd_t* cmd, char const* prefix);
+
 /**
  * Queue data to be written to the command's stdin when it is spawned.
  *
@@ -137,6 +186,14 @@ void cmd_prepare_stdin(cmd_t* cmd, char* data);
  */
 bool cmd_exists(char const* cmd);
 
+/**
+ * Forget where binaries were found in '$PATH'.
+ *
+ * This must be called whenever a file is installed, as it could be a binary appearing in an earlier '$PATH' entry than the one it was previously found in.
+ * This function is thread-safe.
+ */
+void cmd_forget_bins(void);
+
 /**
  * Replace the current process with the command via 'execv'.
  *
@@ -145,6 +202,43 @@ bool cmd_exists(char const* cmd);
  */
 int cmd_exec_inplace(cmd_t* cmd);
 
+/**
+ * Spawn the command in the background and forget about it.
+ *
+ * The command gets its own session and its stdio is redirected to /dev/null, so it keeps running after we exit.
+ * It's never waited on, so it stays a zombie until we exit if it finishes before then.
+ *
+ * @param cmd Command to execute.
+ * @param stdin_fd File descriptor to hand to the command as its stdin, or -1 for /dev/null. This is the only file descriptor it inherits, even if it's close-on-exec.
+ * @return 0 on success, -1 if the command couldn't be spawned.
+ */
+int cmd_exec_detached(cmd_t* cmd, int stdin_fd);
+
+/**
+ * Callback for when a command started with {@link cmd_exec_cb} is done.
+ *
+ * This is called from the child process supervisor thread, so it must be quick and must not wait on other commands (i.e. no {@link cmd_exec}).
+ * Typically, it just hands the rest of the work off to a pool (see {@link pool_resume}).
+ *
+ * @param cmd The command, with 'cmd_t.out_buf', 'cmd_t.rv', and 'cmd_t.sig' set.
+ * @param data The data passed to {@link cmd_exec_cb}.
+ */
+typedef void (*cmd_cb_t)(cmd_t* cmd, void* data);
+
+/**
+ * Spawn the command without waiting on it.
+ *
+ * The command is handed over to the child process supervisor, which collects its output into 'cmd_t.out_buf' (if redirecting) and waits for it to exit.
+ * Once it's done, 'cmd_t.rv' and 'cmd_t.sig' are set and 'cb' is called.
+ * The command must not be touched until then.
+ *
+ * @param cmd Command to execute.
+ * @param cb Callback for when the command is done. Not called if spawning the command failed (though 'cmd_t.rv' and 'cmd_t.out_buf' are still set).
+ * @param data Data to pass to 'cb'.
+ * @return 0 on success, -1 if the command couldn't be spawned.
+ */
+int cmd_exec_cb(cmd_t* cmd, cmd_cb_t cb, void* data);
+
 /**
  * Spawn the command and wait on it.
  *
@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: MIT
-// Copyright (c) 2023-2025 Aymeric Wibo
+// Copyright (c) 2023-2026 Aymeric Wibo
 
 #pragma once
 
@@ -25,14 +25,6 @@
  */
 #define VERSION "v0.2.26"
 
-/**
- * Bob build ID.
- *
- * This is a combination of the current Bob version and date & time of the build.
- * It is saved to the output directory and the dependency cache directory, and if it changes, the dependency cache directory is cleared and the full project rebuilt.
- */
-#define BUILD_ID VERSION "\t" __DATE__ "\t" __TIME__
-
 /**
  * Whether the BOB_BUIlD_DEBUGGING envvar is set.
  */
@@ -115,6 +107,35 @@ extern char* default_tmp_install_prefix;
  */
 extern char const* install_prefix;
 
+/**
+ * Whether to log every piece of work which is already done, along with the output it had when it was done (i.e. cached warnings).
+ *
+ * Set with the -v switch.
+ * Otherwise, up-to-date work is only summarized.
+ */
+extern _Bool verbose;
+
+/**
+ * Whether files installed to the temporary installation prefix may be hardlinked rather than copied.
+ *
+ * Set when the 'BOB_INSTALL_HARDLINKS' envvar is set to "1".
+ */
+extern _Bool install_hardlinks;
+
+/**
+ * Whether Bob dependencies are built in this process rather than by spawning a child Bob for each of them.
+ *
+ * Set when the 'BOB_DEPS_IN_PROCESS' envvar is set to "1".
+ */
+extern _Bool deps_in_process;
+
+/**
+ * Where to write the list of installed files, if anywhere.
+ *
+ * Set by the internal '-R' option when building a dependency for another Bob, so that it can know whether what was installed is still there.
+ */
+extern char const* install_record;
+
 /**
  * Forces dependency tree to be rebuilt when set.
  *
@@ -5,19 +5,34 @@
 
 #include <alloc.h>
 #include <cookie.h>
+#include <fsutil.h>
+#include <logging.h>
+#include <manifest.h>
+#include <path_table.h>
 #include <str.h>
 
-#include <flamingo/flamingo.h>
-
+#include <errno.h>
 #include <inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+
+// The hash is djb2, so its low bits mostly depend on the last few characters of the path (i.e. the extension).
+// Multiply by the golden ratio and take the top bits instead so files are spread evenly across shards.
+
+static unsigned shard_of(uint64_t hash) {
+	return (hash * 0x9E3779B97F4A7C15ull) >> (64 - 8);
+}
 
 char* gen_cookie(char* path, size_t path_size, char const* ext) {
+	uint64_t const hash = strnhash(path, path_size);
+	unsigned const shard = shard_of(hash);
+
 	char* cookie = NULL;
-	asprintf_c(&cookie, "%s/%.*s.cookie.%" PRIx64 ".%s", bsys_out_path, (int) path_size, path, strnhash(path, path_size), ext);
+	asprintf_c(&cookie, "%s/%x/%x/%.*s.cookie.%" PRIx64 ".%s", bsys_out_path, shard >> 4, shard & 0xF, (int) path_size, path, hash, ext);
 
-	size_t const prefix_len = strlen(bsys_out_path) + strlen("/");
+	size_t const prefix_len = strlen(bsys_out_path) + strlen("/x/x/");
 
 	for (size_t i = prefix_len; i < prefix_len + path_size; i++) {
 		if (cookie[i] == '/') {
@@ -25,35 +40,83 @@ char* gen_cookie(char* path, size_t path_size, char const* ext) {
 		}
 	}
 
+	manifest_add(cookie);
 	return cookie;
 }
 
-static pthread_mutex_t built_cookies_mutex = PTHREAD_MUTEX_INITIALIZER;
-static size_t built_cookie_count = 0;
-static char** built_cookies = NULL; // XXX Shouldn't really worry about freeing all of this, there's no real chance of a leak.
+static int make_shards(void) {
+	// Shards are created in order, so if the last one exists, they all do.
 
-void add_built_cookie(char* cookie) {
-	pthread_mutex_lock(&built_cookies_mutex);
+	char* STR_CLEANUP last = NULL;
+	asprintf_c(&last, "%s/f/f", bsys_out_path);
 
-	built_cookies = realloc_c(built_cookies, ++built_cookie_count * sizeof *built_cookies);
-	built_cookies[built_cookie_count - 1] = strdup_c(cookie);
+	struct stat sb;
 
-	pthread_mutex_unlock(&built_cookies_mutex);
-}
+	if (stat(last, &sb) == 0) {
+		return 0;
+	}
 
-bool has_built_cookie(char* cookie, size_t len) {
-	bool rv = false;
-	pthread_mutex_lock(&built_cookies_mutex);
+	for (unsigned i = 0; i < 16; i++) {
+		char* STR_CLEANUP outer = NULL;
+		asprintf_c(&outer, "%s/%x", bsys_out_path, i);
+
+		if (mkdir_wrapped(outer, 0755) < 0 && errno != EEXIST) {
+			LOG_FATAL("mkdir(\"%s\"): %s", outer, strerror(errno));
+			return -1;
+		}
+
+		for (unsigned j = 0; j < 16; j++) {
+			char* STR_CLEANUP inner = NULL;
+			asprintf_c(&inner, "%s/%x", outer, j);
 
-	for (size_t i = 0; i < built_cookie_count; i++) {
-		if (flamingo_cstrcmp(cookie, built_cookies[i], len) == 0) {
-			rv = true;
-			goto done;
+			if (mkdir_wrapped(inner, 0755) < 0 && errno != EEXIST) {
+				LOG_FATAL("mkdir(\"%s\"): %s", inner, strerror(errno));
+				return -1;
+			}
 		}
 	}
 
+	return 0;
+}
+
+static pthread_mutex_t shards_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool shards_prepped = false;
+
+int prep_cookie_shards(void) {
+	int rv = 0;
+	pthread_mutex_lock(&shards_lock);
+
+	if (shards_prepped) {
+		goto done;
+	}
+
+	if (make_shards() < 0) {
+		rv = -1;
+		goto done;
+	}
+
+	shards_prepped = true;
+
 done:
 
-	pthread_mutex_unlock(&built_cookies_mutex);
+	pthread_mutex_unlock(&shards_lock);
 	return rv;
 }
+
+static path_table_t built_cookies = PATH_TABLE_INIT; // XXX Shouldn't really worry about freeing all of this, there's no real chance of a leak.
+
+void add_built_cookie(char* cookie) {
+	path_table_add(&built_cookies, cookie, strlen(cookie), NULL);
+}
+
+bool has_built_cookie(char* cookie, size_t len) {
+	return path_table_get(&built_cookies, cookie, len, NULL);
+}
+
+void reset_cookies(void) {
+	pthread_mutex_lock(&shards_lock);
+	shards_prepped = false;
+	pthread_mutex_unlock(&shards_lock);
+
+	path_table_clear(&built_cookies);
+}
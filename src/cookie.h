@@ -10,6 +10,7 @@
  * - Value placeholder cookies, which are a little more ad-hoc, but an example can be found in 'PkgConfigCookie()'.
  *
  * Cookies are intermediary files placed under '.bob/<target>/bob'.
+ * So that no one directory ends up with hundreds of thousands of entries on large projects, they are sharded into two levels of subdirectories based on the hash of their source path (e.g. '.bob/<target>/bob/3/a/src_main.c.cookie.<hash>.o').
  * They are generated by certain functions in the Bob build script so they can be used before the relevant build step runs.
  * For example, the compile -> link flow looks like this:
  *
@@ -53,6 +54,17 @@
  */
 char* gen_cookie(char* path, size_t path_size, char const* ext);
 
+/**
+ * Create the shard directories cookies are placed in.
+ *
+ * This must be called once the output path exists and before any cookie is written.
+ * Only the first call does anything.
+ * This function is thread-safe.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int prep_cookie_shards(void);
+
 /**
  * Record that a cookie has been built in this session.
  *
@@ -67,6 +79,7 @@ void add_built_cookie(char* cookie);
  *
  * Used to e.g. see if a dependant file has needed to be rebuilt; if when trying to link a program we see that a static library has been rebuilt and thus {@link add_built_cookie} had previously been called with it, then we know we have to re-link.
  * Otherwise, all else being the same, we might not need to re-link.
+ * This is called for every flag of every link, so it's a hashed lookup which doesn't take any locks.
  * This function is thread-safe.
  *
  * @param cookie Cookie path to look up (not necessarily NUL-terminated; 'len' bytes are compared).
@@ -74,3 +87,11 @@ void add_built_cookie(char* cookie);
  * @return True if the cookie was previously added via {@link add_built_cookie}, false otherwise.
  */
 bool has_built_cookie(char* cookie, size_t len);
+
+/**
+ * Forget which cookies have been built and whether the shard directories have been prepared.
+ *
+ * This is used when switching to another project in the same process.
+ * This function is not thread-safe; no build steps may be running at the same time.
+ */
+void reset_cookies(void);
@@ -0,0 +1,664 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2026 Aymeric Wibo
+
+#include <common.h>
+
+#include <alloc.h>
+#include <deps.h>
+#include <fsutil.h>
+#include <logging.h>
+#include <project.h>
+#include <str.h>
+#include <toolchain.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define RECORDS "share/bob/deps"
+
+// Read the commit a git repo is checked out at.
+// Returns false if it can't be found, e.g. if the repo is in the middle of something we don't know how to read.
+
+static bool git_commit(char const* path, char commit[41]) {
+	char* STR_CLEANUP head_path = NULL;
+	asprintf_c(&head_path, "%s/.git/HEAD", path);
+
+	FILE* f = fopen(head_path, "r");
+
+	if (f == NULL) {
+		return false;
+	}
+
+	char head[256] = {0};
+	bool const read = fgets(head, sizeof head, f) != NULL;
+	fclose(f);
+
+	if (!read) {
+		return false;
+	}
+
+	head[strcspn(head, "\n")] = '\0';
+
+	// Detached HEAD, which is just the commit itself.
+
+	if (strncmp(head, "ref: ", strlen("ref: ")) != 0) {
+		return sscanf(head, "%40[0-9a-f]", commit) == 1 && strlen(commit) == 40;
+	}
+
+	char const* const ref = head + strlen("ref: ");
+
+	// The ref is either in its own file or, once git has gotten around to packing it, in 'packed-refs'.
+
+	char* STR_CLEANUP ref_path = NULL;
+	asprintf_c(&ref_path, "%s/.git/%s", path, ref);
+
+	if ((f = fopen(ref_path, "r")) != NULL) {
+		bool const found = fscanf(f, "%40[0-9a-f]", commit) == 1 && strlen(commit) == 40;
+		fclose(f);
+
+		return found;
+	}
+
+	char* STR_CLEANUP packed_path = NULL;
+	asprintf_c(&packed_path, "%s/.git/packed-refs", path);
+
+	if ((f = fopen(packed_path, "r")) == NULL) {
+		return false;
+	}
+
+	bool found = false;
+	char* line = NULL;
+	size_t cap = 0;
+
+	while (!found && getline(&line, &cap, f) > 0) {
+		line[strcspn(line, "\n")] = '\0';
+
+		if (strlen(line) > 41 && line[40] == ' ' && strcmp(line + 41, ref) == 0) {
+			found = sscanf(line, "%40[0-9a-f]", commit) == 1 && strlen(commit) == 40;
+		}
+	}
+
+	free(line);
+	fclose(f);
+
+	return found;
+}
+
+// Summarize the state of a local dependency's source tree from the sizes and modification times of its files.
+// Hidden files and directories (and thus '.bob' and '.git') are skipped.
+// Entries are summed so that the summary doesn't depend on the order they're read in.
+
+static void summarize_tree(char const* root, char const* rel, uint64_t* summary) {
+	char* STR_CLEANUP dir = NULL;
+	asprintf_c(&dir, "%s%s", root, rel);
+
+	DIR* const dp = opendir(dir);
+
+	if (dp == NULL) {
+		return;
+	}
+
+	int const dir_fd = dirfd(dp);
+	struct dirent* entry;
+
+	while ((entry = readdir(dp)) != NULL) {
+		char const* const name = entry->d_name;
+		struct stat sb;
+
+		if (name[0] == '.' || fstatat(dir_fd, name, &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+			continue;
+		}
+
+		char* STR_CLEANUP entry_rel = NULL;
+		asprintf_c(&entry_rel, "%s/%s", rel, name);
+
+		if (S_ISDIR(sb.st_mode)) {
+			summarize_tree(root, entry_rel, summary);
+			continue;
+		}
+
+		char* STR_CLEANUP line = NULL;
+		asprintf_c(&line, "%s %lld %lld", entry_rel, (long long) sb.st_size, (long long) sb.st_mtime);
+
+		*summary += strhash(line);
+	}
+
+	closedir(dp);
+}
+
+uint64_t dep_fingerprint(dep_node_t* dep, size_t dep_count, uint64_t const* dep_fingerprints) {
+	char* STR_CLEANUP source = NULL;
+
+	if (dep->kind == DEP_KIND_GIT) {
+		char commit[41] = {0};
+
+		if (!git_commit(dep->path, commit)) {
+			return 0;
+		}
+
+		asprintf_c(&source, "git %s", commit);
+	}
+
+	else {
+		uint64_t summary = 0;
+		summarize_tree(dep->path, "", &summary);
+
+		asprintf_c(&source, "local %016" PRIx64, summary);
+	}
+
+	// A dependency is only as unchanged as its own dependencies.
+	// Their fingerprints are summed for the same reason as the entries of a local tree are: they're known in whatever order they finished building in.
+
+	uint64_t deps_sum = 0;
+
+	for (size_t i = 0; i < dep_count; i++) {
+		if (dep_fingerprints[i] == 0) {
+			return 0;
+		}
+
+		deps_sum += dep_fingerprints[i];
+	}
+
+	char* const STR_CLEANUP target = project_target();
+
+	char* STR_CLEANUP str = NULL;
+	asprintf_c(&str, "%s\n%s\n%s\n%016" PRIx64 "\n", source, dep->build_path, target, deps_sum);
+
+	for (size_t i = 0; i < dep->config_key_count; i++) {
+		char* const prev = str;
+		asprintf_c(&str, "%s%s=%s\n", prev, dep->config_keys[i], dep->config_vals[i]);
+		free(prev);
+	}
+
+	uint64_t const fingerprint = strhash(str);
+	return fingerprint == 0 ? 1 : fingerprint;
+}
+
+static char const* dep_human(dep_node_t* dep) {
+	if (dep->human != NULL) {
+		return dep->human;
+	}
+
+	char const* const human = strrchr(dep->path, '/');
+	return human == NULL ? dep->path : human + 1;
+}
+
+char* dep_record_prep(dep_node_t* dep) {
+	char* STR_CLEANUP dir = NULL;
+	asprintf_c(&dir, "%s/" RECORDS, install_prefix);
+
+	if (mkdir_recursive(dir, 0755) < 0) {
+		LOG_WARN("mkdir_recursive(\"%s\"): %s", dir, strerror(errno));
+		return NULL;
+	}
+
+	set_owner(dir);
+
+	char* record = NULL;
+	asprintf_c(&record, "%s/%s.%016" PRIx64, dir, dep_human(dep), dep->hash);
+
+	return record;
+}
+
+// Check the line of a record (or list of installed files) describing an installed file against what's actually there.
+
+static bool installed_matches(char* line) {
+	long long size;
+	long long mtime;
+	int path_off;
+
+	line[strcspn(line, "\n")] = '\0';
+
+	if (sscanf(line, "%lld %lld %n", &size, &mtime, &path_off) != 2) {
+		return false;
+	}
+
+	struct stat sb;
+
+	if (lstat(line + path_off, &sb) < 0) {
+		return false;
+	}
+
+	return sb.st_size == size && sb.st_mtime == mtime;
+}
+
+bool dep_record_matches(char const* record, uint64_t fingerprint) {
+	if (fingerprint == 0) {
+		return false;
+	}
+
+	FILE* const f = fopen(record, "r");
+
+	if (f == NULL) {
+		return false;
+	}
+
+	uint64_t recorded;
+	bool matches = fscanf(f, "%" SCNx64 "\n", &recorded) == 1 && recorded == fingerprint;
+
+	char* line = NULL;
+	size_t cap = 0;
+
+	while (matches && getline(&line, &cap, f) > 0) {
+		matches = installed_matches(line);
+	}
+
+	free(line);
+	fclose(f);
+
+	return matches;
+}
+
+int dep_record_commit(char const* record, char const* installed, uint64_t fingerprint) {
+	if (fingerprint == 0) {
+		remove(installed);
+		return 0;
+	}
+
+	// If the build system doesn't keep track of what it installs, there's nothing to check the prefix against next time, so don't record anything.
+
+	FILE* const in = fopen(installed, "r");
+
+	if (in == NULL) {
+		return 0;
+	}
+
+	char* STR_CLEANUP tmp = NULL;
+	asprintf_c(&tmp, "%s.XXXXXX", record);
+
+	int const fd = mkstemp(tmp);
+
+	if (fd < 0) {
+		LOG_WARN("mkstemp(\"%s\"): %s", tmp, strerror(errno));
+		fclose(in);
+		return -1;
+	}
+
+	FILE* const out = fdopen(fd, "w");
+	fprintf(out, "%016" PRIx64 "\n", fingerprint);
+
+	char buf[4096];
+	size_t len;
+
+	while ((len = fread(buf, 1, sizeof buf, in)) > 0) {
+		fwrite(buf, 1, len, out);
+	}
+
+	fclose(in);
+	remove(installed);
+
+	fchmod(fd, 0644);
+	set_owner_fd(fd, record);
+
+	bool const ok = fclose(out) == 0;
+
+	if (!ok || rename(tmp, record) < 0) {
+		LOG_WARN("Failed to write dependency record \"%s\": %s", record, strerror(errno));
+		remove(tmp);
+		return -1;
+	}
+
+	return 0;
+}
+
+// Files installed by this process, when it's building a dependency for another Bob.
+
+static pthread_mutex_t installed_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t installed_count = 0;
+static char** installed = NULL;
+
+void dep_record_installed(char const* path) {
+	if (install_record == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&installed_lock);
+
+	installed = realloc_c(installed, (installed_count + 1) * sizeof *installed);
+	installed[installed_count++] = strdup_c(path);
+
+	pthread_mutex_unlock(&installed_lock);
+}
+
+void dep_record_installed_tree(char const* root, char const* rel, char const* prefix) {
+	if (install_record == NULL) {
+		return;
+	}
+
+	char* STR_CLEANUP dir = NULL;
+	asprintf_c(&dir, "%s%s", root, rel);
+
+	DIR* const dp = opendir(dir);
+
+	if (dp == NULL) {
+		return;
+	}
+
+	int const dir_fd = dirfd(dp);
+	struct dirent* entry;
+
+	while ((entry = readdir(dp)) != NULL) {
+		char const* const name = entry->d_name;
+		struct stat sb;
+
+		if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 || fstatat(dir_fd, name, &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+			continue;
+		}
+
+		char* STR_CLEANUP entry_rel = NULL;
+		asprintf_c(&entry_rel, "%s/%s", rel, name);
+
+		if (S_ISDIR(sb.st_mode)) {
+			dep_record_installed_tree(root, entry_rel, prefix);
+			continue;
+		}
+
+		char* STR_CLEANUP path = NULL;
+		asprintf_c(&path, "%s%s", prefix, entry_rel);
+
+		dep_record_installed(path);
+	}
+
+	closedir(dp);
+}
+
+void dep_record_forget_installed(void) {
+	pthread_mutex_lock(&installed_lock);
+
+	for (size_t i = 0; i < installed_count; i++) {
+		free(installed[i]);
+	}
+
+	free(installed);
+
+	installed_count = 0;
+	installed = NULL;
+
+	pthread_mutex_unlock(&installed_lock);
+}
+
+int dep_record_write_installed(void) {
+	if (install_record == NULL) {
+		return 0;
+	}
+
+	int rv = -1;
+	FILE* const f = fopen(install_record, "w");
+
+	if (f == NULL) {
+		LOG_FATAL("fopen(\"%s\"): %s", install_record, strerror(errno));
+		goto done;
+	}
+
+	for (size_t i = 0; i < installed_count; i++) {
+		struct stat sb;
+
+		if (lstat(installed[i], &sb) < 0) {
+			LOG_FATAL("lstat(\"%s\"): %s", installed[i], strerror(errno));
+			fclose(f);
+			remove(install_record);
+			goto done;
+		}
+
+		fprintf(f, "%lld %lld %s\n", (long long) sb.st_size, (long long) sb.st_mtime, installed[i]);
+	}
+
+	set_owner_fd(fileno(f), install_record);
+	fclose(f);
+
+	rv = 0;
+
+done:
+
+	dep_record_forget_installed();
+	return rv;
+}
+
+static char* prebuilt_root(void) {
+	char const* const env = getenv("BOB_PREBUILT_PATH");
+	char* root = NULL;
+
+	if (env != NULL) {
+		root = strdup_c(env);
+	}
+
+	else if (getenv("HOME") != NULL) {
+		asprintf_c(&root, "%s/.cache/bob/prebuilt", getenv("HOME"));
+	}
+
+	return root;
+}
+
+char* dep_prebuilt_path(dep_node_t* dep, uint64_t fingerprint) {
+	// Local dependencies are specific to the project using them, so there'd be no point in sharing them.
+	// Otherwise, a dependency can only be shared if we know exactly what was built.
+
+	if (dep->kind != DEP_KIND_GIT || fingerprint == 0) {
+		return NULL;
+	}
+
+	char* const STR_CLEANUP root = prebuilt_root();
+
+	if (root == NULL) {
+		return NULL;
+	}
+
+	// The fingerprint already covers the target, but not the compiler the dependency was built with.
+
+	unsigned major;
+	toolchain_kind_t const kind = toolchain_kind(&major);
+
+	char* STR_CLEANUP variant = NULL;
+	asprintf_c(&variant, "%016" PRIx64 "\n%s %d %u\n", fingerprint, toolchain_cc(), kind, major);
+
+	// Other build systems are told where the prefix is when they're configured, and tend to bake it into what they install (pkg-config files, CMake package configs, &c), so they're only shared between projects using the same prefix.
+	// Bob doesn't bake the prefix into anything it installs, so its dependencies are shared between prefixes.
+	// They are still built against whatever headers and libraries are already in the prefix though ('-isystem' and '-L'), which isn't part of the key: a dependency which uses something from the prefix without declaring it as a dependency could differ from one prefix to another.
+
+	char* STR_CLEANUP build_file = NULL;
+	asprintf_c(&build_file, "%s/%s/build.fl", dep->path, dep->build_path);
+
+	if (access(build_file, F_OK) < 0) {
+		char* const prev = variant;
+		asprintf_c(&variant, "%sprefix %s\n", prev, install_prefix);
+		free(prev);
+	}
+
+	char* prebuilt = NULL;
+	asprintf_c(&prebuilt, "%s/%s.%016" PRIx64 ".%016" PRIx64, root, dep_human(dep), dep->hash, strhash(variant));
+
+	return prebuilt;
+}
+
+// List the files of a cache entry as installed into the prefix, in the same format as 'dep_record_write_installed' does.
+
+static int list_restored(FILE* f, char const* root, char const* rel) {
+	char* STR_CLEANUP dir = NULL;
+	asprintf_c(&dir, "%s%s", root, rel);
+
+	DIR* const dp = opendir(dir);
+
+	if (dp == NULL) {
+		LOG_WARN("opendir(\"%s\"): %s", dir, strerror(errno));
+		return -1;
+	}
+
+	int rv = 0;
+	int const dir_fd = dirfd(dp);
+	struct dirent* entry;
+
+	while (rv == 0 && (entry = readdir(dp)) != NULL) {
+		char const* const name = entry->d_name;
+		struct stat sb;
+
+		if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 || fstatat(dir_fd, name, &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+			continue;
+		}
+
+		char* STR_CLEANUP entry_rel = NULL;
+		asprintf_c(&entry_rel, "%s/%s", rel, name);
+
+		char* STR_CLEANUP path = NULL;
+		asprintf_c(&path, "%s%s", install_prefix, entry_rel);
+
+		if (S_ISDIR(sb.st_mode)) {
+			set_owner(path);
+			rv = list_restored(f, root, entry_rel);
+			continue;
+		}
+
+		struct stat installed_sb;
+
+		if (lstat(path, &installed_sb) < 0) {
+			LOG_WARN("lstat(\"%s\"): %s", path, strerror(errno));
+			rv = -1;
+			break;
+		}
+
+		// A file hardlinked from the cache is the cache's own file, which is shared with every other project, so its owner mustn't be changed.
+
+		if (installed_sb.st_dev != sb.st_dev || installed_sb.st_ino != sb.st_ino) {
+			set_owner(path);
+		}
+
+		fprintf(f, "%lld %lld %s\n", (long long) installed_sb.st_size, (long long) installed_sb.st_mtime, path);
+	}
+
+	closedir(dp);
+	return rv;
+}
+
+bool dep_prebuilt_restore(char const* prebuilt, char const* installed) {
+	struct stat sb;
+
+	if (stat(prebuilt, &sb) < 0 || !S_ISDIR(sb.st_mode)) {
+		return false;
+	}
+
+	// Like when installing cookies, files in the temporary prefix are only ever read, so they may be hardlinked to the cache if asked to.
+	// Nothing ever writes to a file in place in either, so one can't end up modifying the other.
+
+	bool const may_link = install_hardlinks && install_prefix == default_tmp_install_prefix;
+
+	size_t changed;
+	char* STR_CLEANUP err = NULL;
+
+	if (merge_tree(prebuilt, install_prefix, may_link, &changed, &err) < 0) {
+		LOG_WARN("Failed to install prebuilt dependency '%s' into '%s': %s", prebuilt, install_prefix, err);
+		return false;
+	}
+
+	FILE* const f = fopen(installed, "w");
+
+	if (f == NULL) {
+		LOG_WARN("fopen(\"%s\"): %s", installed, strerror(errno));
+		return false;
+	}
+
+	int const rv = list_restored(f, prebuilt, "");
+	fclose(f);
+
+	if (rv < 0) {
+		remove(installed);
+		return false;
+	}
+
+	return true;
+}
+
+void dep_prebuilt_store(char const* prebuilt, char const* installed) {
+	FILE* const f = fopen(installed, "r");
+
+	if (f == NULL) {
+		return;
+	}
+
+	char* STR_CLEANUP root = strdup_c(prebuilt);
+	*strrchr(root, '/') = '\0';
+
+	if (mkdir_recursive(root, 0755) < 0) {
+		LOG_WARN("mkdir_recursive(\"%s\"): %s", root, strerror(errno));
+		fclose(f);
+		return;
+	}
+
+	// Populate a temporary entry first and only then move it into place, so that no one ever sees a half-populated entry, even if another project is storing the same dependency at the same time.
+
+	char* STR_CLEANUP tmp = NULL;
+	asprintf_c(&tmp, "%s.tmp.XXXXXX", prebuilt);
+
+	if (mkdtemp(tmp) == NULL) {
+		LOG_WARN("mkdtemp(\"%s\"): %s", tmp, strerror(errno));
+		fclose(f);
+		return;
+	}
+
+	size_t const prefix_len = strlen(install_prefix);
+	bool ok = true;
+
+	char* line = NULL;
+	size_t cap = 0;
+
+	while (ok && getline(&line, &cap, f) > 0) {
+		line[strcspn(line, "\n")] = '\0';
+
+		long long size;
+		long long mtime;
+		int path_off;
+
+		if (sscanf(line, "%lld %lld %n", &size, &mtime, &path_off) != 2) {
+			ok = false;
+			break;
+		}
+
+		// Files installed outside of the prefix can't be put back where they belong, so a dependency which installs any can't be cached.
+
+		char const* const path = line + path_off;
+
+		if (strncmp(path, install_prefix, prefix_len) != 0 || path[prefix_len] != '/') {
+			ok = false;
+			break;
+		}
+
+		char* STR_CLEANUP dst = NULL;
+		asprintf_c(&dst, "%s%s", tmp, path + prefix_len);
+
+		char* STR_CLEANUP parent = strdup_c(dst);
+		*strrchr(parent, '/') = '\0';
+
+		char* STR_CLEANUP err = NULL;
+
+		if (mkdir_recursive(parent, 0755) < 0) {
+			LOG_WARN("mkdir_recursive(\"%s\"): %s", parent, strerror(errno));
+			ok = false;
+		}
+
+		else if (copy(path, dst, false, &err) < 0) {
+			LOG_WARN("Failed to copy '%s' to the prebuilt cache: %s", path, err);
+			ok = false;
+		}
+	}
+
+	free(line);
+	fclose(f);
+
+	// If someone else got there first, their entry is just as good as ours.
+
+	if (ok && rename(tmp, prebuilt) < 0 && errno != EEXIST && errno != ENOTEMPTY) {
+		LOG_WARN("rename(\"%s\", \"%s\"): %s", tmp, prebuilt, strerror(errno));
+	}
+
+	char* STR_CLEANUP err = NULL;
+
+	if (access(tmp, F_OK) == 0 && rm(tmp, &err) < 0) {
+		LOG_WARN("Failed to remove '%s': %s", tmp, err);
+	}
+}
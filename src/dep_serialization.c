@@ -244,6 +244,14 @@ int dep_node_deserialize(dep_node_t* root, char* serialized) {
 		node->child_count = 0;
 		node->children = NULL;
 
+		// The hash isn't serialized, but it's derived from everything that is, the same way 'ensure_deps_cache()' does.
+
+		node->hash = strhash(path) ^ strhash(build_path);
+
+		for (size_t k = 0; k < config_key_count; k++) {
+			node->hash ^= strhash(config_keys[k]) ^ strhash(config_vals[k]);
+		}
+
 		// Add a reference to this node to our stack.
 
 		stack = realloc_c(stack, (stack_size + 1) * sizeof *stack);
@@ -8,6 +8,8 @@
 #include <deps.h>
 #include <fsutil.h>
 #include <logging.h>
+#include <ncpu.h>
+#include <pool.h>
 #include <str.h>
 
 #include <assert.h>
@@ -15,6 +17,8 @@
 #include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/param.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 /**
@@ -101,12 +105,99 @@ static uint64_t config_hash(flamingo_val_t* config) {
 	return hash;
 }
 
+// Git dependency which isn't in the dependency cache yet.
+
+typedef struct {
+	char* url;
+	char* branch;
+	char* path;
+	char* human;
+} clone_t;
+
+static bool clone_task(void* data) {
+	clone_t* const clone = data;
+
+	// Clone into a temporary directory first and then move it into place, as other Bob processes discovering their own dependencies might be cloning the same repo at the same time.
+	// Whichever finishes first wins, and the others just throw their clones away.
+
+	char* STR_CLEANUP tmp = NULL;
+	asprintf_c(&tmp, "%s.tmp.XXXXXX", clone->path);
+
+	if (mkdtemp(tmp) == NULL) {
+		LOG_FATAL("mkdtemp(\"%s\"): %s", tmp, strerror(errno));
+		return true;
+	}
+
+	cmd_t CMD_CLEANUP cmd = {0};
+
+	cmd_create(&cmd, "git", "clone", clone->url, tmp, NULL);
+	cmd_add(&cmd, "--depth");
+	cmd_add(&cmd, "1");
+	cmd_add(&cmd, "--branch");
+	cmd_add(&cmd, clone->branch);
+	cmd_add(&cmd, "--recurse-submodules");
+	cmd_add(&cmd, "--shallow-submodules");
+
+	LOG_INFO("%s" CLEAR ": Git cloning...", clone->human);
+
+	bool const failure = cmd_exec(&cmd) < 0;
+	cmd_log(&cmd, NULL, clone->human, "git clone", "git cloned", false);
+
+	char* STR_CLEANUP err = NULL;
+
+	if (!failure && rename(tmp, clone->path) == 0) {
+		return false;
+	}
+
+	if (!failure && errno != EEXIST && errno != ENOTEMPTY) {
+		LOG_FATAL("rename(\"%s\", \"%s\"): %s", tmp, clone->path, strerror(errno));
+		rm(tmp, &err);
+		return true;
+	}
+
+	if (rm(tmp, &err) < 0) {
+		LOG_WARN("Failed to remove \"%s\": %s", tmp, err);
+	}
+
+	return failure;
+}
+
+static int clone_all(clone_t* clones, size_t count) {
+	if (count == 0) {
+		return 0;
+	}
+
+	pool_t pool;
+	pool_init(&pool, MIN(count, ncpu()));
+
+	for (size_t i = 0; i < count; i++) {
+		pool_add_task(&pool, clone_task, &clones[i]);
+	}
+
+	int const rv = pool_wait(&pool);
+	pool_free(&pool);
+
+	return rv;
+}
+
+static void free_clones(clone_t* clones, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		free(clones[i].url);
+		free(clones[i].branch);
+		free(clones[i].path);
+		free(clones[i].human);
+	}
+
+	free(clones);
+}
+
 /**
  * Ensure all dependencies are in Bob's dependency cache.
  *
  * Concretely, do the following:
  * - Read the dependencies vector (Flamingo).
  * - Ensure dependency is already in Bob's dependency cache (download or symlink it if not).
+ *   Git dependencies which need downloading are all cloned at the same time, once the whole vector has been read.
  * - Write out dependency structs to deps array.
  * - Compute total dependency hash.
  *
@@ -118,6 +209,11 @@ static uint64_t config_hash(flamingo_val_t* config) {
 static int ensure_deps_cache(flamingo_val_t* deps_vec, dep_t* deps, uint64_t* hash) {
 	assert(*hash == 0);
 
+	int rv = -1;
+
+	size_t clone_count = 0;
+	clone_t* clones = NULL;
+
 	// Download (git) or symlink (local) all the dependencies to the dependencies directory.
 
 	for (size_t i = 0; i < deps_vec->vec.count; i++) {
@@ -170,12 +266,12 @@ static int ensure_deps_cache(flamingo_val_t* deps_vec, dep_t* deps, uint64_t* ha
 
 		if (kind == NULL) {
 			LOG_FATAL("Dependency must have a 'kind' attribute." PLZ_REPORT);
-			return -1;
+			goto err;
 		}
 
 		if (kind->kind != FLAMINGO_VAL_KIND_STR) {
 			LOG_FATAL("Dependency 'kind' attribute must be a string." PLZ_REPORT);
-			return -1;
+			goto err;
 		}
 
 		dep_kind_t dep_kind = DEP_KIND_INVALID;
@@ -187,12 +283,12 @@ static int ensure_deps_cache(flamingo_val_t* deps_vec, dep_t* deps, uint64_t* ha
 
 			if (local_path == NULL) {
 				LOG_FATAL("Local dependency must have a 'local_path' attribute." PLZ_REPORT);
-				return -1;
+				goto err;
 			}
 
 			if (local_path->kind != FLAMINGO_VAL_KIND_STR) {
 				LOG_FATAL("Local dependency 'local_path' attribute must be a string." PLZ_REPORT);
-				return -1;
+				goto err;
 			}
 
 			// Generate path for dependency in deps directory.
@@ -202,7 +298,7 @@ static int ensure_deps_cache(flamingo_val_t* deps_vec, dep_t* deps, uint64_t* ha
 
 			if (gen_local_path(path, &abs_path, &human, &dep_path) < 0) {
 				LOG_FATAL("Could not find local dependency at '%s'.", path);
-				return -1;
+				goto err;
 			}
 
 			// Create symlink from dependency to deps directory.
@@ -210,7 +306,7 @@ static int ensure_deps_cache(flamingo_val_t* deps_vec, dep_t* deps, uint64_t* ha
 
 			if (symlink(abs_path, dep_path) < 0 && errno != EEXIST) {
 				LOG_FATAL("link(\"%s\", \"%s\"): %s", abs_path, dep_path, strerror(errno));
-				return -1;
+				goto err;
 			}
 		}
 
@@ -219,22 +315,22 @@ static int ensure_deps_cache(flamingo_val_t* deps_vec, dep_t* deps, uint64_t* ha
 
 			if (git_url == NULL) {
 				LOG_FATAL("Git dependency must have a 'git_url' attribute." PLZ_REPORT);
-				return -1;
+				goto err;
 			}
 
 			if (git_branch == NULL) {
 				LOG_FATAL("Git dependency must have a 'git_branch' attribute." PLZ_REPORT);
-				return -1;
+				goto err;
 			}
 
 			if (git_url->kind != FLAMINGO_VAL_KIND_STR) {
 				LOG_FATAL("Git dependency 'git_url' attribute must be a string." PLZ_REPORT);
-				return -1;
+				goto err;
 			}
 
 			if (git_branch->kind != FLAMINGO_VAL_KIND_STR) {
 				LOG_FATAL("Git dependency 'git_branch' attribute must be a string." PLZ_REPORT);
-				return -1;
+				goto err;
 			}
 
 			// Get dependency path of git repo.
@@ -258,38 +354,33 @@ static int ensure_deps_cache(flamingo_val_t* deps_vec, dep_t* deps, uint64_t* ha
 				goto downloaded;
 			}
 
-			// If nothing exists there yet, clone the repo.
-
-			cmd_t CMD_CLEANUP cmd = {0};
-
-			cmd_create(&cmd, "git", "clone", NULL);
-			cmd_addf(&cmd, "%.*s", (int) git_url->str.size, git_url->str.str);
-			cmd_addf(&cmd, "%s/%s.%" PRIx64 ".git", deps_path, human, hash);
-			cmd_add(&cmd, "--depth");
-			cmd_add(&cmd, "1");
-			cmd_add(&cmd, "--branch");
-			cmd_addf(&cmd, "%.*s", (int) git_branch->str.size, git_branch->str.str);
-			cmd_add(&cmd, "--recurse-submodules");
-			cmd_add(&cmd, "--shallow-submodules");
+			// If nothing exists there yet, clone the repo later along with all the others.
+			// The same repo could appear more than once in the vector (e.g. with different build paths), but should only be cloned once.
 
-			LOG_INFO("%s" CLEAR ": Git cloning...", human);
+			for (size_t j = 0; j < clone_count; j++) {
+				if (strcmp(clones[j].path, dep_path) == 0) {
+					goto downloaded;
+				}
+			}
 
-			bool const failure = cmd_exec(&cmd) < 0;
-			cmd_log(&cmd, NULL, human, "git clone", "git cloned", false);
+			clones = realloc_c(clones, (clone_count + 1) * sizeof *clones);
 
-			if (failure) {
-				return -1;
-			}
+			clones[clone_count++] = (clone_t) {
+				.url = strndup_c(git_url->str.str, git_url->str.size),
+				.branch = strndup_c(git_branch->str.str, git_branch->str.size),
+				.path = strdup_c(dep_path),
+				.human = strdup_c(human),
+			};
 		}
 
 		else {
 			LOG_FATAL("Unknown value for dependency 'kind': '%.*s'." PLZ_REPORT, (int) kind->str.size, kind->str.str);
-			return -1;
+			goto err;
 		}
 
 		assert(dep_kind != DEP_KIND_INVALID);
 
-		// If we're here, we've successfully downloaded the dependency.
+		// If we're here, the dependency is in the dependency cache, or will be once the clones are done.
 
 downloaded:
 
@@ -327,12 +418,12 @@ downloaded:
 
 			if (memchr(key->str.str, ':', key->str.size) != NULL || memchr(key->str.str, '\n', key->str.size) != NULL) {
 				LOG_FATAL("Config key '%.*s' must not contain ':' or newline.", (int) key->str.size, key->str.str);
-				return -1;
+				goto err;
 			}
 
 			if (memchr(val->str.str, ':', val->str.size) != NULL || memchr(val->str.str, '\n', val->str.size) != NULL) {
 				LOG_FATAL("Config value '%.*s' must not contain ':' or newline.", (int) val->str.size, val->str.str);
-				return -1;
+				goto err;
 			}
 
 			deps[i].config_keys[j] = strndup_c(key->str.str, key->str.size);
@@ -340,7 +431,18 @@ downloaded:
 		}
 	}
 
-	return 0;
+	// Actually download the git dependencies.
+
+	if (clone_all(clones, clone_count) < 0) {
+		goto err;
+	}
+
+	rv = 0;
+
+err:
+
+	free_clones(clones, clone_count);
+	return rv;
 }
 
 void deps_node_free(dep_node_t* node) {
@@ -387,7 +489,134 @@ void deps_list_free(dep_t* deps, size_t count) {
 	}
 }
 
-dep_node_t* get_deps_tree(flamingo_val_t* deps_vec, size_t path_len, uint64_t* path_hashes, bool* circular) {
+// Write out one of the files caching the dependency tree.
+// The same project can be discovered by several Bob processes at the same time when it's shared by sibling dependencies, so the file is written to a temporary one which is then moved into place, so that no process can ever read a half-written file.
+
+static int write_cache_file(char const* path, char const* contents) {
+	char* STR_CLEANUP tmp = NULL;
+	asprintf_c(&tmp, "%s.XXXXXX", path);
+
+	int const fd = mkstemp(tmp);
+
+	if (fd < 0) {
+		return -1;
+	}
+
+	size_t const len = strlen(contents);
+	bool const ok = write(fd, contents, len) == (ssize_t) len && fchmod(fd, 0644) == 0;
+
+	set_owner_fd(fd, path);
+	close(fd);
+
+	if (!ok || rename(tmp, path) < 0) {
+		int const saved = errno;
+		remove(tmp);
+		errno = saved;
+
+		return -1;
+	}
+
+	return 0;
+}
+
+// Discovery of the dependency tree of one of our direct dependencies.
+
+typedef struct {
+	dep_t* dep;
+
+	size_t path_len;
+	uint64_t* path_hashes;
+	uint64_t would_be_hash;
+
+	deps_builder_t* builder;
+	dep_node_t* node;
+
+	bool ran;
+	cmd_t cmd;
+	int rv;
+
+	bool circular;
+	bool has_node;
+} discovery_t;
+
+static bool discovery_task(void* data) {
+	discovery_t* const discovery = data;
+	dep_t* const dep = discovery->dep;
+
+	// Run the 'dep-tree' command on the dependency.
+
+	cmd_t* const cmd = &discovery->cmd;
+
+	cmd_create(cmd, init_name, "-C", NULL);
+	cmd_addf(cmd, "%s/%s", dep->path, dep->build_path);
+
+	if (force_dep_tree_rebuild) {
+		cmd_add(cmd, "-f");
+	}
+
+	cmd_add(cmd, "dep-tree");
+
+	for (size_t i = 0; i < discovery->path_len; i++) {
+		cmd_addf(cmd, "%" PRIx64, discovery->path_hashes[i]);
+	}
+
+	cmd_addf(cmd, "%" PRIx64, discovery->would_be_hash);
+
+	discovery->ran = true;
+	discovery->rv = cmd_exec(cmd);
+
+	// Errors are reported once all discoveries are done, so there's nothing more to do here other than stopping the others early.
+
+	if (discovery->rv < 0) {
+		return true;
+	}
+
+	char* const out = cmd_read_out(cmd);
+
+	if (strstr(out, BOB_DEPS_CIRCULAR) != NULL) {
+		discovery->circular = true;
+		return true;
+	}
+
+	dep_node_t* const node = discovery->node;
+
+	if (dep_node_deserialize(node, out) < 0) {
+		return true;
+	}
+
+	node->is_root = false;
+	node->kind = dep->kind;
+	node->hash = dep->hash;
+	node->path = strdup_c(dep->path);
+	node->human = strdup_c(dep->human);
+	node->build_path = strdup_c(dep->build_path);
+	node->config_key_count = dep->config_key_count;
+
+	if (dep->config_key_count == 0) {
+		node->config_keys = NULL;
+		node->config_vals = NULL;
+	} else {
+		node->config_keys = malloc_c(dep->config_key_count * sizeof *node->config_keys);
+		node->config_vals = malloc_c(dep->config_key_count * sizeof *node->config_vals);
+
+		for (size_t i = 0; i < dep->config_key_count; i++) {
+			node->config_keys[i] = strdup_c(dep->config_keys[i]);
+			node->config_vals[i] = strdup_c(dep->config_vals[i]);
+		}
+	}
+
+	discovery->has_node = true;
+
+	// Now this dependency's subtree is known, its leaves can start building, even if the rest of our tree isn't known yet.
+
+	if (discovery->builder != NULL) {
+		deps_build_add(discovery->builder, node);
+	}
+
+	return false;
+}
+
+dep_node_t* get_deps_tree(flamingo_val_t* deps_vec, size_t path_len, uint64_t* path_hashes, bool* circular, deps_builder_t* builder) {
 	assert(circular != NULL);
 	*circular = false;
 
@@ -467,8 +696,8 @@ dep_node_t* get_deps_tree(flamingo_val_t* deps_vec, size_t path_len, uint64_t* p
 
 	uint64_t read_hash;
 	fscanf(hash_f, "%" PRIx64, &read_hash);
+	set_owner_fd(fileno(hash_f), hash_path);
 	fclose(hash_f);
-	set_owner(hash_path);
 
 	if (read_hash != hash) {
 		LOG_INFO("Dependency vector changed, rebuilding dependency tree.");
@@ -489,8 +718,8 @@ dep_node_t* get_deps_tree(flamingo_val_t* deps_vec, size_t path_len, uint64_t* p
 	serialized = calloc_c(1, tree_size + 1);
 	fread(serialized, 1, tree_size, tree_f);
 
+	set_owner_fd(fileno(tree_f), tree_path);
 	fclose(tree_f);
-	set_owner(tree_path);
 
 	if (dep_node_deserialize(tree, serialized) < 0) {
 		deps_list_free(deps, deps_vec->vec.count);
@@ -499,6 +728,11 @@ dep_node_t* get_deps_tree(flamingo_val_t* deps_vec, size_t path_len, uint64_t* p
 		return NULL;
 	}
 
+	for (size_t i = 0; builder != NULL && i < tree->child_count; i++) {
+		deps_build_add(builder, &tree->children[i]);
+	}
+
+	deps_list_free(deps, deps_vec->vec.count);
 	return tree;
 
 	// Build the tree.
@@ -507,6 +741,9 @@ build_tree:;
 
 	uint64_t hashes[deps_vec->vec.count + 1]; // XXX +1 just so we don't get UB for zero-length VLAs.
 
+	size_t discovery_count = 0;
+	discovery_t* const discoveries = calloc_c(deps_vec->vec.count, sizeof *discoveries);
+
 	for (size_t i = 0; i < deps_vec->vec.count; i++) {
 		dep_t* const dep = &deps[i];
 
@@ -528,88 +765,82 @@ build_tree:;
 			continue;
 		}
 
-		// Run the 'dep-tree' command on the dependency and add the resulting dependency trees to ours.
+		discoveries[discovery_count++] = (discovery_t) {
+			.dep = dep,
+			.path_len = path_len,
+			.path_hashes = path_hashes,
+			.would_be_hash = would_be_hash,
+			.builder = builder,
+		};
+	}
+
+	// Get the dependency trees of all our direct dependencies at the same time.
+	// Each of them is written straight into its place in our tree's children, so that they don't move once they've been handed to the builder.
 
-		cmd_t CMD_CLEANUP cmd;
-		cmd_create(&cmd, init_name, "-C", NULL);
-		cmd_addf(&cmd, "%s/%s", dep->path, dep->build_path);
+	tree->children = calloc_c(discovery_count, sizeof *tree->children);
 
-		if (force_dep_tree_rebuild) {
-			cmd_add(&cmd, "-f");
-		}
+	pool_t pool;
+	pool_init(&pool, MIN(discovery_count, ncpu()));
 
-		cmd_add(&cmd, "dep-tree");
+	for (size_t i = 0; i < discovery_count; i++) {
+		discoveries[i].node = &tree->children[i];
+		pool_add_task(&pool, discovery_task, &discoveries[i]);
+	}
 
-		for (size_t j = 0; j < path_len; j++) {
-			cmd_addf(&cmd, "%" PRIx64, path_hashes[j]);
-		}
+	pool_wait(&pool);
+	pool_free(&pool);
 
-		cmd_addf(&cmd, "%" PRIx64, would_be_hash);
+	// Report what went wrong, if anything did, in the order of the dependency vector.
 
-		int const rv = cmd_exec(&cmd);
-		char* const out = cmd_read_out(&cmd);
+	bool failed = false;
 
-		if (rv < 0) {
-			LOG_FATAL("Failed to get dependency tree of '%s'%s", dep->human, out ? ":" : ".");
-			printf("%s", out);
+	for (size_t i = 0; i < discovery_count; i++) {
+		discovery_t* const discovery = &discoveries[i];
+		char const* const human = discovery->dep->human;
 
-			deps_list_free(deps, deps_vec->vec.count);
-			deps_tree_free(tree);
+		if (!discovery->ran) {
+			continue;
+		}
 
-			return NULL;
+		char* const out = cmd_read_out(&discovery->cmd);
+
+		if (discovery->rv < 0) {
+			LOG_FATAL("Failed to get dependency tree of '%s'%s", human, out ? ":" : ".");
+			log_raw(stdout, out, strlen(out));
+			failed = true;
 		}
 
-		if (strstr(out, BOB_DEPS_CIRCULAR) != NULL) {
-			LOG_WARN("Dependency tree is circular after adding '%s'.", dep->human);
+		else if (discovery->circular) {
+			LOG_WARN("Dependency tree is circular after adding '%s'.", human);
 			*circular = true;
+		}
 
-			deps_list_free(deps, deps_vec->vec.count);
-			deps_tree_free(tree);
-
-			return NULL;
+		else if (!discovery->has_node) {
+			LOG_FATAL("Failed to deserialize dependency tree of '%s'.", human);
+			failed = true;
 		}
 
-		dep_node_t node;
+		cmd_free(&discovery->cmd);
+	}
 
-		if (dep_node_deserialize(&node, out) < 0) {
-			LOG_FATAL("Failed to deserialize dependency tree of '%s'.", dep->human);
+	for (size_t i = 0; i < discovery_count; i++) {
+		if (discoveries[i].has_node) {
+			tree->child_count++;
+		}
+	}
 
-			deps_list_free(deps, deps_vec->vec.count);
-			deps_tree_free(tree);
+	free(discoveries);
 
-			return NULL;
-		}
+	// Nodes are only ever missing if something went wrong, but then it's possible for some which come after one which is missing to still be there.
 
-		node.is_root = false;
-		node.kind = dep->kind;
-		node.path = strdup_c(dep->path);
-		node.human = strdup_c(dep->human);
-		node.build_path = strdup_c(dep->build_path);
-		node.config_key_count = dep->config_key_count;
-
-		if (dep->config_key_count == 0) {
-			node.config_keys = NULL;
-			node.config_vals = NULL;
-		} else {
-			node.config_keys = malloc_c(dep->config_key_count * sizeof *node.config_keys);
-			node.config_vals = malloc_c(dep->config_key_count * sizeof *node.config_vals);
-
-			for (size_t j = 0; j < dep->config_key_count; j++) {
-				node.config_keys[j] = strdup_c(dep->config_keys[j]);
-				node.config_vals[j] = strdup_c(dep->config_vals[j]);
+	if (failed || *circular || tree->child_count != discovery_count) {
+		for (size_t i = 0; i < discovery_count; i++) {
+			if (tree->children[i].path != NULL) {
+				deps_node_free(&tree->children[i]);
 			}
 		}
 
-		tree->children = realloc_c(tree->children, (tree->child_count + 1) * sizeof *tree->children);
-		tree->children[tree->child_count++] = node;
-	}
-
-	// Write out tree hash.
-
-	FILE* f = fopen(hash_path, "w");
-
-	if (f == NULL) {
-		LOG_FATAL("Could not open dependency hash file '%s' for writing: %s", hash_path, strerror(errno));
+		tree->child_count = 0;
 
 		deps_list_free(deps, deps_vec->vec.count);
 		deps_tree_free(tree);
@@ -617,16 +848,13 @@ build_tree:;
 		return NULL;
 	}
 
-	fprintf(f, "%" PRIx64, hash);
-	fclose(f);
-	set_owner(hash_path);
+	// Write out tree hash and tree.
 
-	// Write out tree.
+	char hash_str[17];
+	snprintf(hash_str, sizeof hash_str, "%" PRIx64, hash);
 
-	f = fopen(tree_path, "w");
-
-	if (f == NULL) {
-		LOG_FATAL("Could not open dependency tree file '%s' for writing: %s", tree_path, strerror(errno));
+	if (write_cache_file(hash_path, hash_str) < 0) {
+		LOG_FATAL("Could not write dependency hash file '%s': %s", hash_path, strerror(errno));
 
 		deps_list_free(deps, deps_vec->vec.count);
 		deps_tree_free(tree);
@@ -639,9 +867,15 @@ build_tree:;
 	}
 
 	serialized = dep_node_serialize(tree);
-	fprintf(f, "%s", serialized);
-	fclose(f);
-	set_owner(tree_path);
+
+	if (write_cache_file(tree_path, serialized) < 0) {
+		LOG_FATAL("Could not write dependency tree file '%s': %s", tree_path, strerror(errno));
+
+		deps_list_free(deps, deps_vec->vec.count);
+		deps_tree_free(tree);
+
+		return NULL;
+	}
 
 	deps_list_free(deps, deps_vec->vec.count);
 	return tree;
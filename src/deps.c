@@ -1,41 +1,113 @@
 // SPDX-License-Identifier: MIT
-// Copyright (c) 2024-2025 Aymeric Wibo
+// Copyright (c) 2024-2026 Aymeric Wibo
 
 #include <common.h>
 
+#include <alloc.h>
+#include <bsys.h>
+#include <build_step.h>
 #include <cmd.h>
 #include <deps.h>
 #include <fsutil.h>
 #include <logging.h>
 #include <ncpu.h>
+#include <path_table.h>
+#include <pgo.h>
 #include <pool.h>
+#include <project.h>
+#include <str.h>
 
 #include <assert.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
 #include <sys/param.h>
+#include <unistd.h>
 
-static pthread_mutex_t logging_lock = PTHREAD_MUTEX_INITIALIZER;
+// Whether a dependency can be built in this process, i.e. whether it's a Bob project.
+// Other build systems are cheap enough to set up compared to actually building them, so those are still built by a child Bob.
 
-static bool build_task(void* data) {
-	dep_node_t* const dep = data;
+static bool can_build_in_process(dep_node_t* dep) {
+	if (!deps_in_process) {
+		return false;
+	}
 
-	// TODO If dep->kind == DEP_KIND_GIT, we should not be rebuilding this at all so long as a relative $out_path (I think?) directory exists (though what happens if we need to reinstall?).
+	char* STR_CLEANUP build_file = NULL;
+	asprintf_c(&build_file, "%s/%s/build.fl", dep->path, dep->build_path);
 
-	// Log that we're building.
+	return access(build_file, F_OK) == 0;
+}
 
-	char const* human = dep->human;
+/**
+ * Build and install a Bob dependency without spawning a child Bob.
+ *
+ * This does the same thing as 'bob -N -p <prefix> -C <dep> install' would, but saves having to start up a whole new process, which adds up on large dependency trees.
+ * All the state which would otherwise be per-process is swapped out for the duration, so this must not run concurrently with anything else.
+ *
+ * @param dep The dependency.
+ * @param dep_own_prefix Whether the dependency should take ownership of the install prefix.
+ * @param installed Where to write the list of installed files, or NULL.
+ * @return 0 on success, -1 on failure.
+ */
+static int build_in_process(dep_node_t* dep, bool dep_own_prefix, char const* installed) {
+	project_state_t state;
 
-	if (human == NULL) {
-		human = strrchr(dep->path, '/');
+	if (project_suspend(&state, &BSYS_BOB) < 0) {
+		return -1;
+	}
 
-		if (human++ == NULL) {
-			human = dep->path;
+	char const* const prev_install_record = install_record;
+	install_record = installed;
+	dep_record_forget_installed();
+
+	// Set things up the way command-line options would have for a child Bob.
+
+	instr = NULL;
+	targetless_out_path = ".bob";
+	abs_out_path = NULL;
+	bsys_out_path = NULL;
+	build_deps = false;
+	own_prefix = dep_own_prefix;
+	pgo_mode = PGO_NONE;
+
+	dep_config_count = dep->config_key_count;
+	dep_config_keys = dep->config_keys;
+	dep_config_vals = dep->config_vals;
+
+	char* STR_CLEANUP path = NULL;
+	asprintf_c(&path, "%s/%s", dep->path, dep->build_path);
+
+	int rv = -1;
+	bsys_t const* bsys;
+
+	if (project_open(path, false, &bsys) == 0) {
+		instr = "install";
+		rv = bsys_install(bsys);
+
+		// The build steps hold on to values from the build script, so free them before the build system's state.
+
+		free_build_steps();
+
+		if (bsys->destroy != NULL) {
+			bsys->destroy();
 		}
 	}
 
-	pthread_mutex_lock(&logging_lock);
-	LOG_INFO("%s" CLEAR ": Building dependency...", human);
-	pthread_mutex_unlock(&logging_lock);
+	free_build_steps();
+	dep_record_forget_installed();
+	install_record = prev_install_record;
+
+	if (project_resume(&state) < 0) {
+		return -1;
+	}
 
+	return rv;
+}
+
+// Build and install a dependency by spawning a child Bob.
+
+static int build_in_child(dep_node_t* dep, char const* human, bool dep_own_prefix, char const* installed) {
 	// Actually build the dependency.
 	// We shouldn't pass -o here because the dependency should be built in its own output path.
 	// XXX If the dependency wants to use a different output path, we should probably add a function in the Bob build script to set the output path to something else instead of having an -o switch.
@@ -50,132 +122,379 @@ static bool build_task(void* data) {
 		cmd_addf(&cmd, "%s=%s", dep->config_keys[i], dep->config_vals[i]);
 	}
 
-	bool dep_own_prefix;
-	assert(would_set_owner(install_prefix, &dep_own_prefix) == 0);
-
 	if (dep_own_prefix) {
 		cmd_add(&cmd, "-O");
 	}
 
+	if (verbose) {
+		cmd_add(&cmd, "-v");
+	}
+
+	if (installed != NULL) {
+		cmd_add(&cmd, "-R");
+		cmd_add(&cmd, installed);
+	}
+
 	cmd_add(&cmd, "install");
 	int const rv = cmd_exec(&cmd);
 
-	pthread_mutex_lock(&logging_lock);
 	cmd_log(&cmd, NULL, human, "build dependency", "built dependency", false);
-	pthread_mutex_unlock(&logging_lock);
 
-	return rv < 0;
+	return rv;
 }
 
 /**
- * Reset the built_deps flag for all nodes in the tree.
+ * Build and install a dependency, unless it's already installed.
  *
- * @param tree The root of the dependency tree.
- * @return The total number of descendant nodes in the (sub-)tree, root node included.
+ * @param dep The dependency.
+ * @param fingerprint The dependency's fingerprint (see {@link dep_fingerprint}).
+ * @return 0 on success, -1 on failure.
  */
-static size_t reset_built_deps(dep_node_t* tree) {
-	size_t total_node_count = 1;
+static int build_dep(dep_node_t* dep, uint64_t fingerprint) {
+	char const* human = dep->human;
+
+	if (human == NULL) {
+		human = strrchr(dep->path, '/');
+
+		if (human++ == NULL) {
+			human = dep->path;
+		}
+	}
+
+	// Skip the dependency entirely if it was already installed into this prefix from the exact same sources, and nothing it installed has changed since.
+
+	char* const STR_CLEANUP record = dep_record_prep(dep);
+
+	if (record != NULL && dep_record_matches(record, fingerprint)) {
+		LOG_SUCCESS("%s" CLEAR ": Dependency already installed.", human);
+		return 0;
+	}
+
+	// Otherwise, whatever was recorded is stale, and the Bob building the dependency is asked to list what it installs so that we can record that once it's done.
+
+	char* STR_CLEANUP installed = NULL;
+
+	if (record != NULL) {
+		remove(record);
+		asprintf_c(&installed, "%s.installed", record);
+	}
+
+	// Another project might have already built this exact dependency, in which case we can just take what it installed.
+
+	char* const STR_CLEANUP prebuilt = installed == NULL ? NULL : dep_prebuilt_path(dep, fingerprint);
+
+	if (prebuilt != NULL && dep_prebuilt_restore(prebuilt, installed)) {
+		cmd_forget_bins();
+		dep_record_commit(record, installed, fingerprint);
+		LOG_SUCCESS("%s" CLEAR ": Installed dependency from prebuilt cache.", human);
+
+		return 0;
+	}
+
+	// Log that we're building.
+
+	LOG_INFO("%s" CLEAR ": Building dependency...", human);
+
+	bool dep_own_prefix;
+	assert(would_set_owner(install_prefix, &dep_own_prefix) == 0);
+
+	int rv;
+
+	if (can_build_in_process(dep)) {
+		rv = build_in_process(dep, dep_own_prefix, installed);
+
+		if (rv < 0) {
+			LOG_ERROR("%s" CLEAR ": Failed to build dependency in-process.", human);
+		}
+
+		else {
+			LOG_SUCCESS("%s" CLEAR ": Successfully built dependency in-process.", human);
+		}
+	}
+
+	else {
+		rv = build_in_child(dep, human, dep_own_prefix, installed);
+	}
+
+	if (rv < 0) {
+		return -1;
+	}
+
+	// The dependency may have installed binaries which shadow ones we've already found.
+
+	cmd_forget_bins();
+
+	if (prebuilt != NULL) {
+		dep_prebuilt_store(prebuilt, installed);
+	}
+
+	if (record != NULL) {
+		dep_record_commit(record, installed, fingerprint);
+	}
+
+	return 0;
+}
+
+// Vertex of the dependency graph, i.e. a unique dependency.
+// The same dependency can appear in several places in the tree, but should only be built once.
+
+typedef struct dep_vertex_t dep_vertex_t;
+
+struct dep_vertex_t {
+	deps_builder_t* builder;
+
+	// Copy of the dependency's node, without its children.
+	// Subtrees are only lent to 'deps_build_add()', so the vertex can't hold on to them.
+
+	dep_node_t node;
+	bool built;
+	uint64_t fingerprint;
+
+	// Number of dependencies of this dependency which haven't been built yet.
+	// Once this drops to zero, it can start building.
+
+	size_t pending;
+
+	size_t dependency_count;
+	dep_vertex_t** dependencies;
+
+	size_t dependant_count;
+	dep_vertex_t** dependants;
+};
+
+struct deps_builder_t {
+	pool_t pool;
+
+	// Dependencies built in-process swap out this process' working directory and global state (see 'build_in_process()'), which everything else building dependencies reads.
+	// So those hold this for writing, one at a time, while dependencies built by a child Bob hold it for reading and still build in parallel with each other.
+
+	pthread_rwlock_t state_lock;
+
+	// Subtrees can be added while dependencies are being built, so everything below is protected by this lock.
+
+	pthread_mutex_t lock;
+
+	// Discovery also needs the working directory, so in-process builds wait for it to be done.
+
+	bool discovering;
+	pthread_cond_t discovered;
 
-	for (size_t i = 0; i < tree->child_count; i++) {
-		dep_node_t* const child = &tree->children[i];
-		total_node_count += reset_built_deps(child);
+	path_table_t vertices;
+	size_t count;
+	dep_vertex_t** list;
+};
+
+static void add_edge(dep_vertex_t* vertex, dep_vertex_t* dependant) {
+	if (dependant == NULL) {
+		return;
+	}
+
+	dependant->dependencies = realloc_c(dependant->dependencies, (dependant->dependency_count + 1) * sizeof *dependant->dependencies);
+	dependant->dependencies[dependant->dependency_count++] = vertex;
+
+	// Nothing to wait on if the dependency has already been built.
+
+	if (vertex->built) {
+		return;
+	}
+
+	vertex->dependants = realloc_c(vertex->dependants, (vertex->dependant_count + 1) * sizeof *vertex->dependants);
+	vertex->dependants[vertex->dependant_count++] = dependant;
+
+	dependant->pending++;
+}
+
+static char** dup_strs(char** strs, size_t count) {
+	if (count == 0) {
+		return NULL;
 	}
 
-	tree->built_deps = tree->child_count == 0; // I.e. is a leaf in the unbuilt tree.
-	return total_node_count;
+	char** const dup = malloc_c(count * sizeof *dup);
+
+	for (size_t i = 0; i < count; i++) {
+		dup[i] = strdup_c(strs[i]);
+	}
+
+	return dup;
 }
 
 /**
- * Traverse the tree and get the next batch of leaves to build from the dependency tree.
+ * Add a node and its descendants to the dependency graph.
  *
- * Nodes which have the built_deps flag are considered to have been removed from the tree for this operation.
- *
- * @param tree The root of the dependency tree.
- * @param leaves The array of leaves to fill.
- * @param leaf_count Pointer whose value is set to the number of leaves in the array.
- * @param already_built The array of already built dependencies. This used by this function to know which dependencies have already been built and to avoid adding them to the leaves array. This function will also add the leaves of the batch to this array.
- * @param already_built_count Pointer whose value is set to the number of already built dependencies in the array.
- * @return true if the tree is empty (i.e., all nodes have been built), false otherwise. This is used to stop the recursion.
+ * @param builder The builder whose graph to add to.
+ * @param node The node.
+ * @param dependant Vertex of the node's parent, or NULL if its parent is the root node (which this current Bob process is meant to build).
  */
-static bool next_batch(
-	dep_node_t* tree,
-	dep_node_t** leaves,
-	size_t* leaf_count,
-	char** already_built,
-	size_t* already_built_count
-) {
-	if (tree->is_root) {
-		goto is_root;
-	}
-
-	// Is this node a leaf? I.e., are we're interested in it for this batch?
-	// If so, add it to the list of leaves, making sure it wasn't already built.
-
-	if (tree->built_deps) {
-		for (size_t i = 0; i < *already_built_count; i++) {
-			if (strcmp(tree->path, already_built[i]) == 0) {
-				return true;
-			}
+static void add_to_graph(deps_builder_t* builder, dep_node_t* node, dep_vertex_t* dependant) {
+	void* found;
+
+	// Vertices are keyed by the dependency's hash rather than its path, as the same repo built from different build paths or with different configs is a different dependency.
+	// If we've already seen this dependency elsewhere in the tree, so have we its children.
+
+	char key[17];
+	snprintf(key, sizeof key, "%016" PRIx64, node->hash);
+
+	if (path_table_get(&builder->vertices, key, strlen(key), &found)) {
+		add_edge(found, dependant);
+		return;
+	}
+
+	dep_vertex_t* const vertex = calloc_c(1, sizeof *vertex);
+	vertex->builder = builder;
+
+	vertex->node = (dep_node_t) {
+		.kind = node->kind,
+		.hash = node->hash,
+		.path = strdup_c(node->path),
+		.human = node->human == NULL ? NULL : strdup_c(node->human),
+		.build_path = strdup_c(node->build_path),
+		.config_key_count = node->config_key_count,
+		.config_keys = dup_strs(node->config_keys, node->config_key_count),
+		.config_vals = dup_strs(node->config_vals, node->config_key_count),
+	};
+
+	path_table_add(&builder->vertices, key, strlen(key), vertex);
+
+	builder->list = realloc_c(builder->list, (builder->count + 1) * sizeof *builder->list);
+	builder->list[builder->count++] = vertex;
+
+	add_edge(vertex, dependant);
+
+	for (size_t i = 0; i < node->child_count; i++) {
+		add_to_graph(builder, &node->children[i], vertex);
+	}
+}
+
+static bool build_vertex_task(void* data) {
+	dep_vertex_t* const vertex = data;
+	deps_builder_t* const builder = vertex->builder;
+
+	if (can_build_in_process(&vertex->node)) {
+		pthread_mutex_lock(&builder->lock);
+
+		while (builder->discovering) {
+			pthread_cond_wait(&builder->discovered, &builder->lock);
 		}
 
-		leaves[(*leaf_count)++] = tree;
-		already_built[(*already_built_count)++] = tree->path;
+		pthread_mutex_unlock(&builder->lock);
+		pthread_rwlock_wrlock(&builder->state_lock);
+	}
+
+	else {
+		pthread_rwlock_rdlock(&builder->state_lock);
+	}
+
+	// All of this dependency's own dependencies are built by now, so their fingerprints are known.
+
+	uint64_t* const fingerprints = malloc_c((vertex->dependency_count + 1) * sizeof *fingerprints);
+
+	for (size_t i = 0; i < vertex->dependency_count; i++) {
+		fingerprints[i] = vertex->dependencies[i]->fingerprint;
+	}
+
+	vertex->fingerprint = dep_fingerprint(&vertex->node, vertex->dependency_count, fingerprints);
+	free(fingerprints);
+
+	int const rv = build_dep(&vertex->node, vertex->fingerprint);
+	pthread_rwlock_unlock(&builder->state_lock);
 
+	if (rv < 0) {
 		return true;
 	}
 
-	// If not, go down the tree and process the children.
+	// Start building every dependant whose dependencies are now all built.
 
-is_root:;
+	pthread_mutex_lock(&builder->lock);
+	vertex->built = true;
 
-	size_t children_built = 0;
+	for (size_t i = 0; i < vertex->dependant_count; i++) {
+		dep_vertex_t* const dependant = vertex->dependants[i];
 
-	for (size_t i = 0; i < tree->child_count; i++) {
-		children_built += next_batch(&tree->children[i], leaves, leaf_count, already_built, already_built_count);
+		if (--dependant->pending == 0) {
+			pool_add_task(&builder->pool, build_vertex_task, dependant);
+		}
 	}
 
-	if (children_built == tree->child_count) {
-		tree->built_deps = true;
-	}
+	pthread_mutex_unlock(&builder->lock);
 
 	return false;
 }
 
-int deps_build(dep_node_t* tree) {
-	// Walk through dependency tree and build each dependency, starting from the leaves.
-	// To do this most efficiently, we start by popping off all the leaves and building them in parallel.
-	// Once that's done, we pop off the next set of leaves, and so on, until we reach the root node (which this current Bob process is meant to build).
+// Placeholder continuation which releases the slot held by the builder while dependencies are still being discovered.
 
-	size_t const total_node_count = reset_built_deps(tree);
+static bool discovered_task(void* data) {
+	(void) data;
+	return false;
+}
 
-	char* already_built[total_node_count + 1]; // XXX +1 because zero-length VLA is UB.
-	size_t already_built_count = 0;
+deps_builder_t* deps_build_start(void) {
+	deps_builder_t* const builder = calloc_c(1, sizeof *builder);
 
-	for (;;) {
-		dep_node_t* leaves[total_node_count + 1]; // XXX +1 because zero-length VLA is UB.
-		size_t leaf_count = 0;
+	pthread_rwlock_init(&builder->state_lock, NULL);
+	pthread_mutex_init(&builder->lock, NULL);
+	pthread_cond_init(&builder->discovered, NULL);
 
-		next_batch(tree, leaves, &leaf_count, already_built, &already_built_count);
-		assert(leaf_count <= total_node_count);
+	builder->vertices = (path_table_t) PATH_TABLE_INIT;
+	builder->discovering = true;
 
-		if (leaf_count == 0) {
-			break;
-		}
+	// Discovery holds one extra slot so that all the businessmen can be building in the meantime.
 
-		// Actually build the leaves in parallel.
-		// TODO This can be majorly improved by not waiting for all leaves to be built before adding more stuff to the pool.
+	pool_init(&builder->pool, ncpu());
+	builder->pool.slots++;
 
-		pool_t pool;
-		pool_init(&pool, ncpu());
+	// The pool stops once it runs out of tasks, so defer a placeholder task for as long as more subtrees might still be added.
 
-		for (size_t i = 0; i < leaf_count; i++) {
-			pool_add_task(&pool, build_task, leaves[i]);
-		}
+	pool_defer(&builder->pool);
+	pool_start(&builder->pool);
+
+	return builder;
+}
+
+void deps_build_add(deps_builder_t* builder, dep_node_t* node) {
+	pthread_mutex_lock(&builder->lock);
+
+	size_t const first_new = builder->count;
+	add_to_graph(builder, node, NULL);
+
+	// Only the vertices we just added can have become ready; the others were already either queued or waiting on something.
+
+	for (size_t i = first_new; i < builder->count; i++) {
+		dep_vertex_t* const vertex = builder->list[i];
 
-		if (pool_wait(&pool) < 0) {
-			return -1;
+		if (vertex->pending == 0) {
+			pool_add_task(&builder->pool, build_vertex_task, vertex);
 		}
 	}
 
-	return 0;
+	pthread_mutex_unlock(&builder->lock);
+}
+
+int deps_build_wait(deps_builder_t* builder) {
+	pthread_mutex_lock(&builder->lock);
+	builder->discovering = false;
+	pthread_cond_broadcast(&builder->discovered);
+	pthread_mutex_unlock(&builder->lock);
+
+	pool_resume(&builder->pool, discovered_task, NULL);
+
+	int const rv = pool_wait(&builder->pool);
+	pool_free(&builder->pool);
+
+	for (size_t i = 0; i < builder->count; i++) {
+		dep_vertex_t* const vertex = builder->list[i];
+
+		deps_node_free(&vertex->node);
+		free(vertex->dependencies);
+		free(vertex->dependants);
+		free(vertex);
+	}
+
+	free(builder->list);
+	path_table_clear(&builder->vertices);
+	pthread_cond_destroy(&builder->discovered);
+	pthread_mutex_destroy(&builder->lock);
+	pthread_rwlock_destroy(&builder->state_lock);
+	free(builder);
+
+	return rv;
 }
@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: MIT
-// Copyright (c) 2024-2025 Aymeric Wibo
+// Copyright (c) 2024-2026 Aymeric Wibo
 
 /*
  * Behold: The Dependency Tree
@@ -52,6 +52,13 @@ struct dep_node_t {
 
 	dep_kind_t kind;
 
+	/**
+	 * Unique identifier for this dependency, i.e. its path, build path, and config hashed together.
+	 *
+	 * The same repo built from different build paths or with different configs is a different dependency, with a different hash.
+	 */
+	uint64_t hash;
+
 	/**
 	 * Path to actual dependency in Bob's dependency cache.
 	 */
@@ -83,16 +90,42 @@ struct dep_node_t {
 	size_t config_key_count;
 	char** config_keys;
 	char** config_vals;
-
-	/**
-	 * If all the dependencies of this node have already been built, this is set.
-	 *
-	 * This field is only used during the dependency build process.
-	 */
-	bool built_deps;
 };
 
-int deps_build(dep_node_t* tree);
+// Dependency building.
+
+typedef struct deps_builder_t deps_builder_t;
+
+/**
+ * Start building dependencies.
+ *
+ * Dependencies are added to the builder with {@link deps_build_add} as they are discovered, and each starts building as soon as all of its own dependencies are built, without waiting for the rest of the tree to be known.
+ *
+ * @return The builder.
+ */
+deps_builder_t* deps_build_start(void);
+
+/**
+ * Add a dependency and its subtree to the builder.
+ *
+ * Dependencies already added (e.g. shared by several subtrees) are only built once.
+ * The subtree is copied, so it doesn't need to outlive this call.
+ * This function is thread-safe.
+ *
+ * @param builder The builder.
+ * @param node The dependency.
+ */
+void deps_build_add(deps_builder_t* builder, dep_node_t* node);
+
+/**
+ * Wait for all dependencies added to the builder to be built, and free it.
+ *
+ * No more dependencies may be added once this has been called.
+ *
+ * @param builder The builder.
+ * @return 0 on success, -1 if any dependency failed to build.
+ */
+int deps_build_wait(deps_builder_t* builder);
 
 // Dependency tree stuff.
 
@@ -109,12 +142,123 @@ int deps_build(dep_node_t* tree);
  * @param path_len Length of the path of dependencies leading up to the one the current Bob process is running for, i.e. its parents, i.e. the callers.
  * @param path_hashes Path of dependency hashes leading up to the one the current Bob process is running for, i.e. its parents, i.e. the callers.
  * @param circular Set to true if tree was found to be circular, false if not.
+ * @param builder If not NULL, each direct dependency's subtree is added to this builder as soon as it is known.
  * @return The dependency tree.
  */
-dep_node_t* get_deps_tree(flamingo_val_t* deps_vec, size_t path_len, uint64_t* path_hashes, bool* circular);
+dep_node_t* get_deps_tree(flamingo_val_t* deps_vec, size_t path_len, uint64_t* path_hashes, bool* circular, deps_builder_t* builder);
 void deps_node_free(dep_node_t* node);
 void deps_tree_free(dep_node_t* tree);
 
+// Dependency fingerprints and records.
+// When a dependency is installed into a prefix, a record of its fingerprint (i.e. the state of its sources, build path, config, target, and its own dependencies' fingerprints) and of the files it installed is kept under 'share/bob/deps' in that prefix.
+// If neither have changed the next time it's needed, it doesn't need to be built at all.
+
+/**
+ * Compute the fingerprint of a dependency.
+ *
+ * Git dependencies are fingerprinted by the commit they're checked out at, and local dependencies by the sizes and modification times of the files in them.
+ *
+ * @param dep The dependency.
+ * @param dep_count Number of dependencies of the dependency.
+ * @param dep_fingerprints Fingerprints of the dependencies of the dependency.
+ * @return The fingerprint, or 0 if it couldn't be computed (in which case the dependency can never be skipped).
+ */
+uint64_t dep_fingerprint(dep_node_t* dep, size_t dep_count, uint64_t const* dep_fingerprints);
+
+/**
+ * Get the path of a dependency's record in the install prefix, making sure the directory it's in exists.
+ *
+ * @param dep The dependency.
+ * @return Heap-allocated record path, or NULL if the directory couldn't be created.
+ */
+char* dep_record_prep(dep_node_t* dep);
+
+/**
+ * Check whether a dependency's record matches its fingerprint and whether all the files it lists are still installed as they were.
+ *
+ * @param record Path to the record.
+ * @param fingerprint The dependency's current fingerprint.
+ * @return True if the dependency doesn't need to be built again.
+ */
+bool dep_record_matches(char const* record, uint64_t fingerprint);
+
+/**
+ * Write a dependency's record once it has been installed.
+ *
+ * @param record Path to the record.
+ * @param installed Path to the list of installed files written by the Bob which installed the dependency (see {@link dep_record_write_installed}), which is consumed.
+ * @param fingerprint The dependency's fingerprint.
+ * @return 0 on success, -1 on failure.
+ */
+int dep_record_commit(char const* record, char const* installed, uint64_t fingerprint);
+
+/**
+ * Note that a file was installed, if installed files are being recorded (see 'install_record').
+ *
+ * This function is thread-safe.
+ *
+ * @param path Path to the installed file.
+ */
+void dep_record_installed(char const* path);
+
+/**
+ * Note that all the files in a staging directory were installed into a prefix.
+ *
+ * @param root Staging directory.
+ * @param rel Path relative to the staging directory to start from (empty to start from its root).
+ * @param prefix The prefix the files were installed into.
+ */
+void dep_record_installed_tree(char const* root, char const* rel, char const* prefix);
+
+/**
+ * Forget the files noted as installed so far.
+ */
+void dep_record_forget_installed(void);
+
+/**
+ * Write out the list of files noted as installed to 'install_record', and forget them.
+ *
+ * This should be called once everything has been installed.
+ * Build systems which can't tell what they've installed shouldn't call this at all.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int dep_record_write_installed(void);
+
+// Prebuilt dependency cache.
+// Once a git dependency has been installed, the files it installed are also kept in a cache shared by all projects ('BOB_PREBUILT_PATH', or '~/.cache/bob/prebuilt' by default), keyed by its hash, fingerprint, and compiler.
+// Other projects needing the exact same dependency then just copy those files into their prefix instead of building it again.
+
+/**
+ * Get the path of a dependency's entry in the prebuilt cache.
+ *
+ * @param dep The dependency.
+ * @param fingerprint The dependency's fingerprint (see {@link dep_fingerprint}).
+ * @return Heap-allocated entry path, or NULL if the dependency can't be cached.
+ */
+char* dep_prebuilt_path(dep_node_t* dep, uint64_t fingerprint);
+
+/**
+ * Install a dependency from its entry in the prebuilt cache, if there is one.
+ *
+ * Files are reflinked where the filesystem supports it, or hardlinked into the temporary prefix when 'BOB_INSTALL_HARDLINKS' is set.
+ *
+ * @param prebuilt Path to the entry, as returned by {@link dep_prebuilt_path}.
+ * @param installed Where to write the list of installed files, to be passed on to {@link dep_record_commit}.
+ * @return True if the dependency was installed from the cache.
+ */
+bool dep_prebuilt_restore(char const* prebuilt, char const* installed);
+
+/**
+ * Add the files a dependency installed to the prebuilt cache.
+ *
+ * Failures are only warned about, as the cache is just an optimization.
+ *
+ * @param prebuilt Path to the entry, as returned by {@link dep_prebuilt_path}.
+ * @param installed Path to the list of installed files written by the Bob which installed the dependency, which is left untouched.
+ */
+void dep_prebuilt_store(char const* prebuilt, char const* installed);
+
 // Dependency serialization.
 
 char* dep_node_serialize(dep_node_t* node);
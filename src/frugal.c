@@ -9,9 +9,12 @@
 #include <fsutil.h>
 #include <logging.h>
 #include <str.h>
+#include <toolchain.h>
 
 #include <assert.h>
+#include <dirent.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
@@ -24,7 +27,7 @@ static void frugal_flags_add(size_t* size, char** flag_str, flamingo_val_t* flag
 
 	*flag_str = realloc_c(*flag_str, *size + extra + 1);
 	snprintf(*flag_str + *size, extra + 1, "%.*s\n", (int) flag->str.size, flag->str.str);
-	size += extra;
+	*size += extra;
 }
 
 bool frugal_flags(flamingo_val_t* flags, char* out) {
@@ -35,8 +38,11 @@ bool frugal_flags(flamingo_val_t* flags, char* out) {
 
 	assert(flags->kind == FLAMINGO_VAL_KIND_VEC);
 
-	char* STR_CLEANUP flag_str = calloc_c(1, 1);
-	size_t size = 0;
+	// The compiler itself is part of the flags, so that changing '$CC' rebuilds everything it built.
+
+	char* STR_CLEANUP flag_str = NULL;
+	asprintf_c(&flag_str, "cc %s\n", toolchain_cc());
+	size_t size = strlen(flag_str);
 
 	for (size_t i = 0; i < flags->vec.count; i++) {
 		flamingo_val_t* const flag = flags->vec.elems[i];
@@ -101,8 +107,8 @@ write_out:
 	}
 
 	fprintf(f, "%s", flag_str);
+	set_owner_fd(fileno(f), path);
 	fclose(f);
-	set_owner(path);
 
 	return true;
 }
@@ -158,6 +164,249 @@ int frugal_mtime(
 	return 0;
 }
 
+// Library search memoization.
+// Link steps in a project tend to share the same -L and -l flags, so we remember directory listings and '(search path set, -l name) → resolved path' resolutions for the lifetime of the process.
+// Both are forgotten whenever something is installed (see 'frugal_forget_libs'), because that could make a new library appear in one of the search paths.
+
+typedef struct {
+	uint64_t hash;
+	char* path;
+
+	int err; // errno from trying to access the directory, or 0 if it exists.
+	bool listed;
+
+	size_t entry_count;
+	char** entries; // Sorted, for bsearch'ing.
+} lib_dir_t;
+
+typedef struct {
+	uint64_t hash;
+	char* key;
+	char* resolved; // NULL if the library wasn't found in any of the search paths.
+} lib_resolution_t;
+
+static pthread_mutex_t lib_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t lib_dir_count = 0;
+static lib_dir_t* lib_dirs = NULL;
+
+static size_t lib_resolution_count = 0;
+static lib_resolution_t* lib_resolutions = NULL;
+
+static int entry_cmp(void const* a, void const* b) {
+	return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+static lib_dir_t* get_lib_dir(char const* path) {
+	uint64_t const hash = strhash(path);
+
+	for (size_t i = 0; i < lib_dir_count; i++) {
+		lib_dir_t* const dir = &lib_dirs[i];
+
+		if (dir->hash == hash && strcmp(dir->path, path) == 0) {
+			return dir;
+		}
+	}
+
+	lib_dirs = realloc_c(lib_dirs, (lib_dir_count + 1) * sizeof *lib_dirs);
+	lib_dir_t* const dir = &lib_dirs[lib_dir_count++];
+
+	dir->hash = hash;
+	dir->path = strdup_c(path);
+	dir->err = 0;
+	dir->listed = false;
+	dir->entry_count = 0;
+	dir->entries = NULL;
+
+	if (access(path, F_OK) < 0) {
+		dir->err = errno;
+		return dir;
+	}
+
+	// If we can't list the directory (e.g. it's not readable but still searchable), we'll just fall back to probing it.
+
+	DIR* const dp = opendir(path);
+
+	if (dp == NULL) {
+		return dir;
+	}
+
+	for (struct dirent* ent; (ent = readdir(dp)) != NULL;) {
+		dir->entries = realloc_c(dir->entries, (dir->entry_count + 1) * sizeof *dir->entries);
+		dir->entries[dir->entry_count++] = strdup_c(ent->d_name);
+	}
+
+	closedir(dp);
+
+	qsort(dir->entries, dir->entry_count, sizeof *dir->entries, entry_cmp);
+	dir->listed = true;
+
+	return dir;
+}
+
+static bool lib_dir_has(lib_dir_t* dir, char const* name) {
+	if (dir->err != 0) {
+		return false;
+	}
+
+	if (!dir->listed) {
+		char* STR_CLEANUP path = NULL;
+		asprintf_c(&path, "%s/%s", dir->path, name);
+
+		return access(path, F_OK) == 0;
+	}
+
+	return bsearch(&name, dir->entries, dir->entry_count, sizeof *dir->entries, entry_cmp) != NULL;
+}
+
+static char* resolve_lib(char const* key, char* const* search_paths, size_t search_path_count, char const* name) {
+	uint64_t const hash = strhash(key);
+
+	for (size_t i = 0; i < lib_resolution_count; i++) {
+		lib_resolution_t* const res = &lib_resolutions[i];
+
+		if (res->hash == hash && strcmp(res->key, key) == 0) {
+			return res->resolved == NULL ? NULL : strdup_c(res->resolved);
+		}
+	}
+
+	// Not already resolved, so go through the search paths.
+	// This is the correct order for processing them.
+
+	char* resolved = NULL;
+
+	for (size_t i = 0; i < search_path_count; i++) {
+		if (lib_dir_has(get_lib_dir(search_paths[i]), name)) {
+			asprintf_c(&resolved, "%s/%s", search_paths[i], name);
+			break;
+		}
+	}
+
+	lib_resolutions = realloc_c(lib_resolutions, (lib_resolution_count + 1) * sizeof *lib_resolutions);
+	lib_resolution_t* const res = &lib_resolutions[lib_resolution_count++];
+
+	res->hash = hash;
+	res->key = strdup_c(key);
+	res->resolved = resolved;
+
+	return resolved == NULL ? NULL : strdup_c(resolved);
+}
+
+void frugal_forget_libs(void) {
+	pthread_mutex_lock(&lib_cache_lock);
+
+	for (size_t i = 0; i < lib_dir_count; i++) {
+		lib_dir_t* const dir = &lib_dirs[i];
+
+		for (size_t j = 0; j < dir->entry_count; j++) {
+			free(dir->entries[j]);
+		}
+
+		free(dir->entries);
+		free(dir->path);
+	}
+
+	for (size_t i = 0; i < lib_resolution_count; i++) {
+		free(lib_resolutions[i].key);
+		free(lib_resolutions[i].resolved);
+	}
+
+	free(lib_dirs);
+	free(lib_resolutions);
+
+	lib_dir_count = 0;
+	lib_dirs = NULL;
+
+	lib_resolution_count = 0;
+	lib_resolutions = NULL;
+
+	pthread_mutex_unlock(&lib_cache_lock);
+}
+
+static int resolve_libs(
+	char const* log_prefix,
+	flamingo_val_t* flags,
+	size_t search_path_count,
+	char* const* search_paths,
+	size_t* extra_count_ref,
+	char*** extra_ref
+) {
+	pthread_mutex_lock(&lib_cache_lock);
+
+	// Make sure all the -L search paths actually exist.
+	// The install prefix's lib directory doesn't necessarily exist yet.
+
+	for (size_t i = 1; i < search_path_count; i++) {
+		lib_dir_t const* const dir = get_lib_dir(search_paths[i]);
+
+		if (dir->err != 0) {
+			pthread_mutex_unlock(&lib_cache_lock);
+			LOG_FATAL("%s: Failed to access library search path '%s': %s", log_prefix, search_paths[i], strerror(dir->err));
+			return -1;
+		}
+	}
+
+	// The memoization key is the full set of search paths (in order), followed by the library filename.
+
+	char* STR_CLEANUP key_prefix = strdup_c("");
+
+	for (size_t i = 0; i < search_path_count; i++) {
+		char* tmp;
+		asprintf_c(&tmp, "%s%s\n", key_prefix, search_paths[i]);
+		free(key_prefix);
+		key_prefix = tmp;
+	}
+
+	// Resolve -lXXX (→ libXXX.a) and -l:filename (→ exact name) to real paths.
+
+	size_t extra_count = 0;
+	char** extra = NULL;
+
+	for (size_t i = 0; i < flags->vec.count; i++) {
+		flamingo_val_t* const flag = flags->vec.elems[i];
+
+		if (flag->kind != FLAMINGO_VAL_KIND_STR) {
+			continue;
+		}
+
+		size_t const flen = flag->str.size;
+		char const* const fstr = flag->str.str;
+
+		if (strncmp(fstr, "-l", 2) != 0) {
+			continue;
+		}
+
+		bool const exact = flen > 3 && fstr[2] == ':';
+		char const* const name = fstr + (exact ? 3 : 2);
+		size_t const nlen = flen - (exact ? 3 : 2);
+
+		char* STR_CLEANUP filename = NULL;
+
+		if (exact) {
+			asprintf_c(&filename, "%.*s", (int) nlen, name);
+		} else {
+			asprintf_c(&filename, "lib%.*s.a", (int) nlen, name);
+		}
+
+		char* STR_CLEANUP key = NULL;
+		asprintf_c(&key, "%s%s", key_prefix, filename);
+
+		char* const path = resolve_lib(key, search_paths, search_path_count, filename);
+
+		if (path != NULL) {
+			extra = realloc_c(extra, (extra_count + 1) * sizeof *extra);
+			extra[extra_count++] = path;
+		}
+	}
+
+	pthread_mutex_unlock(&lib_cache_lock);
+
+	*extra_count_ref = extra_count;
+	*extra_ref = extra;
+
+	return 0;
+}
+
 int frugal_link(
 	bool* do_link,
 	char const log_prefix[static 1],
@@ -180,6 +429,10 @@ int frugal_link(
 	for (size_t i = 0; i < flags->vec.count; i++) {
 		flamingo_val_t* const flag = flags->vec.elems[i];
 
+		if (flag->kind != FLAMINGO_VAL_KIND_STR) {
+			continue;
+		}
+
 		if (has_built_cookie(flag->str.str, flag->str.size)) {
 			return 0;
 		}
@@ -190,7 +443,7 @@ int frugal_link(
 	// Collect lib search paths.
 
 	size_t search_path_count = 1;
-	char** search_paths = malloc_c(search_path_count + sizeof *search_paths);
+	char** search_paths = malloc_c(search_path_count * sizeof *search_paths);
 
 	// First lib search path is just /lib in the install prefix.
 
@@ -198,8 +451,15 @@ int frugal_link(
 
 	// Next lib search paths are all the -L flags.
 
+	int rv = -1;
+
 	for (size_t i = 0; i < flags->vec.count; i++) {
 		flamingo_val_t* flag = flags->vec.elems[i];
+
+		if (flag->kind != FLAMINGO_VAL_KIND_STR) {
+			continue;
+		}
+
 		size_t flen = flag->str.size;
 		char const* fstr = flag->str.str;
 
@@ -213,7 +473,7 @@ int frugal_link(
 		if (flen == 2) { // If we only have -L, then go to next element in vector.
 			if (i >= flags->vec.count - 1) {
 				LOG_FATAL("%s: No search path provided after -L", log_prefix);
-				return -1;
+				goto free_search_paths;
 			}
 
 			flag = flags->vec.elems[i + 1];
@@ -223,70 +483,25 @@ int frugal_link(
 			search_path = strndup_c(fstr + 2, flen - 2);
 		}
 
-		if (access(search_path, F_OK) != 0) {
-			LOG_FATAL("%s: Failed to access library search path '%s': %s", log_prefix, search_path, strerror(errno));
-			return -1;
-		}
-
 		search_paths[search_path_count++] = search_path;
 	}
 
-	// Resolve -lXXX (→ libXXX.a) and -l:filename (→ exact name) to real paths.
-
 	size_t extra_count = 0;
 	char** extra = NULL;
 
-	for (size_t i = 0; i < flags->vec.count; i++) {
-		flamingo_val_t* const flag = flags->vec.elems[i];
-		size_t const flen = flag->str.size;
-		char const* const fstr = flag->str.str;
-
-		if (strncmp(fstr, "-l", 2) != 0) {
-			continue;
-		}
-
-		bool const exact = flen > 3 && fstr[2] == ':';
-		char const* const name = fstr + (exact ? 3 : 2);
-		size_t const nlen = flen - (exact ? 3 : 2);
-
-		// This is the correct order for processing search paths.
-
-		for (size_t j = 0; j < search_path_count; j++) {
-			char* path = NULL;
-
-			if (exact) {
-				asprintf_c(&path, "%s/%.*s", search_paths[j], (int) nlen, name);
-			} else {
-				asprintf_c(&path, "%s/lib%.*s.a", search_paths[j], (int) nlen, name);
-			}
-
-			if (access(path, F_OK) == 0) {
-				extra = realloc_c(extra, (extra_count + 1) * sizeof *extra);
-				extra[extra_count++] = path;
-				break;
-			}
-
-			free(path);
-		}
-	}
-
-	// Free all our search paths as we don't need em no more.
-
-	for (size_t i = 0; i < search_path_count; i++) {
-		free(search_paths[i]);
+	if (resolve_libs(log_prefix, flags, search_path_count, search_paths, &extra_count, &extra) < 0) {
+		goto free_search_paths;
 	}
 
-	free(search_paths);
-
 	// Run mtime check with combined deps.
 
 	size_t const total = obj_count + extra_count;
-	char** deps = malloc_c(total * sizeof *deps);
+	char** deps = malloc_c((total + 1) * sizeof *deps);
 
 	memcpy(deps, objs, obj_count * sizeof *objs);
 	memcpy(deps + obj_count, extra, extra_count * sizeof *extra);
 
-	int const rv = frugal_mtime(do_link, log_prefix, total, deps, out);
+	rv = frugal_mtime(do_link, log_prefix, total, deps, out);
 
 	free(deps);
 
@@ -296,5 +511,15 @@ int frugal_link(
 
 	free(extra);
 
+free_search_paths:
+
+	// Free all our search paths as we don't need em no more.
+
+	for (size_t i = 0; i < search_path_count; i++) {
+		free(search_paths[i]);
+	}
+
+	free(search_paths);
+
 	return rv;
 }
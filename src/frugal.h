@@ -25,7 +25,7 @@
 /**
  * Check if compiler flags have changed since last build.
  *
- * Compares current flags against the saved flags file at '{out}.flags'.
+ * Compares current flags, along with the compiler they're passed to, against the saved flags file at '{out}.flags'.
  * If different (or file missing), writes new flags and returns true.
  *
  * @param flags Compiler flags to check.
@@ -59,6 +59,7 @@ int frugal_mtime(
  *
  * Like frugal_mtime, but also handles changed flags, resolves -lXXX and -l:filename flags to actual static lib paths (searching -L dirs and the install prefix lib dir) and includes them as deps, and *also* looks at the sources like frugal_mtime would.
  * This only triggers a relink if the changed dependencies are static libraries; no need for shared objects.
+ * Library resolutions and the listings of the search paths are memoized across calls; see {@link frugal_forget_libs}.
  *
  * @param do_link Set to true if output needs to be relinked, false otherwise.
  * @param log_prefix Log prefix for error messages.
@@ -76,3 +77,11 @@ int frugal_link(
 	char** objs,
 	char* out
 );
+
+/**
+ * Forget all memoized library search results.
+ *
+ * This must be called whenever a file is installed, as it could be a library appearing in one of the search paths used by {@link frugal_link}.
+ * This function is thread-safe.
+ */
+void frugal_forget_libs(void);
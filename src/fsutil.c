@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: MIT
-// Copyright (c) 2024 Aymeric Wibo
+// Copyright (c) 2024-2026 Aymeric Wibo
 
 #include <common.h>
 
@@ -7,65 +7,581 @@
 #include <cmd.h>
 #include <fsutil.h>
 #include <logging.h>
+#include <ncpu.h>
+#include <path_table.h>
+#include <pool.h>
 #include <str.h>
 
 #include <assert.h>
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/file.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
-int rm(char const* path, char** err) {
-	// Same comment as for 'copy'.
+#if defined(__linux__)
+# include <linux/fs.h>
+# include <sys/ioctl.h>
+# include <sys/sendfile.h>
+#endif
 
-	cmd_t cmd;
-	cmd_create(&cmd, "rm", "-rf", path, NULL);
+// Directories are emptied in parallel, each by its own task, which adds a new task for each subdirectory it finds.
+// They're only removed once they've all been emptied, children before parents.
 
-	int const rv = cmd_exec(&cmd);
+typedef struct rm_state_t rm_state_t;
 
-	if (rv < 0 && *err != NULL) {
-		*err = strdup_c(cmd_read_out(&cmd));
-		size_t const len = strlen(*err);
+typedef struct {
+	rm_state_t* state;
+	char* path;
+} rm_dir_t;
 
-		if (len >= 1) {
-			(*err)[len - 1] = '\0';
+struct rm_state_t {
+	pool_t pool;
+	pthread_mutex_t lock;
+
+	size_t dir_count;
+	rm_dir_t** dirs;
+
+	char* err;
+};
+
+static bool empty_dir(void* data);
+
+static void rm_fail(rm_state_t* state, char const* fn, char const* path) {
+	pthread_mutex_lock(&state->lock);
+
+	if (state->err == NULL) {
+		asprintf_c(&state->err, "%s(\"%s\"): %s", fn, path, strerror(errno));
+	}
+
+	pthread_mutex_unlock(&state->lock);
+}
+
+static void add_dir(rm_state_t* state, char* path) {
+	rm_dir_t* const dir = malloc_c(sizeof *dir);
+
+	dir->state = state;
+	dir->path = path;
+
+	pthread_mutex_lock(&state->lock);
+
+	state->dirs = realloc_c(state->dirs, (state->dir_count + 1) * sizeof *state->dirs);
+	state->dirs[state->dir_count++] = dir;
+
+	pthread_mutex_unlock(&state->lock);
+
+	pool_add_task(&state->pool, empty_dir, dir);
+}
+
+static bool empty_dir(void* data) {
+	rm_dir_t* const dir = data;
+	rm_state_t* const state = dir->state;
+
+	// Never follow symlinks; if something replaced the directory with one in the meantime, we'll just fail to remove it later.
+
+	int const fd = open(dir->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+
+	if (fd < 0) {
+		if (errno == ENOENT) {
+			return false;
 		}
+
+		rm_fail(state, "open", dir->path);
+		return true;
 	}
 
-	cmd_free(&cmd);
+	DIR* const dp = fdopendir(fd);
+
+	if (dp == NULL) {
+		rm_fail(state, "fdopendir", dir->path);
+		close(fd);
+		return true;
+	}
+
+	bool failed = false;
+	struct dirent* entry;
+
+	while ((entry = readdir(dp)) != NULL) {
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+			continue;
+		}
+
+		bool is_dir = entry->d_type == DT_DIR;
+
+		if (entry->d_type == DT_UNKNOWN) {
+			struct stat sb;
+			is_dir = fstatat(fd, entry->d_name, &sb, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(sb.st_mode);
+		}
+
+		if (is_dir) {
+			char* path = NULL;
+			asprintf_c(&path, "%s/%s", dir->path, entry->d_name);
+			add_dir(state, path);
+
+			continue;
+		}
+
+		if (unlinkat(fd, entry->d_name, 0) < 0 && errno != ENOENT) {
+			char* STR_CLEANUP path = NULL;
+			asprintf_c(&path, "%s/%s", dir->path, entry->d_name);
+
+			rm_fail(state, "unlink", path);
+			failed = true;
+
+			break;
+		}
+	}
+
+	closedir(dp);
+	return failed;
+}
+
+// Remove all the files in a directory, stopping at the first subdirectory.
+
+static int empty_leaf(char const* path, bool* has_subdirs, char** err) {
+	*has_subdirs = false;
+
+	int const fd = open(path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+
+	if (fd < 0) {
+		if (errno == ENOENT) {
+			return 0;
+		}
+
+		asprintf_c(err, "open(\"%s\"): %s", path, strerror(errno));
+		return -1;
+	}
+
+	DIR* const dp = fdopendir(fd);
+
+	if (dp == NULL) {
+		asprintf_c(err, "fdopendir(\"%s\"): %s", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	int rv = 0;
+	struct dirent* entry;
+
+	while ((entry = readdir(dp)) != NULL) {
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+			continue;
+		}
+
+		bool is_dir = entry->d_type == DT_DIR;
+
+		if (entry->d_type == DT_UNKNOWN) {
+			struct stat sb;
+			is_dir = fstatat(fd, entry->d_name, &sb, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(sb.st_mode);
+		}
+
+		if (is_dir) {
+			*has_subdirs = true;
+			break;
+		}
+
+		if (unlinkat(fd, entry->d_name, 0) < 0 && errno != ENOENT) {
+			asprintf_c(err, "unlink(\"%s/%s\"): %s", path, entry->d_name, strerror(errno));
+			rv = -1;
+			break;
+		}
+	}
+
+	closedir(dp);
 	return rv;
 }
 
-int copy(char const* src, char const* dst, char** err) {
-	// It's unfortunate, but to be as cross-platform as possible, we must shell out execution to the 'cp' binary.
-	// Would've loved to use libcopyfile but, alas, POSIX is missing features :(
+int rm(char const* path, char** err) {
+	struct stat sb;
+
+	if (lstat(path, &sb) < 0) {
+		if (errno == ENOENT) {
+			return 0;
+		}
+
+		asprintf_c(err, "lstat(\"%s\"): %s", path, strerror(errno));
+		return -1;
+	}
 
-	// If 'src' is a directory, append a slash to it to override stupid cp(1) behaviour.
+	if (!S_ISDIR(sb.st_mode)) {
+		if (unlink(path) < 0 && errno != ENOENT) {
+			asprintf_c(err, "unlink(\"%s\"): %s", path, strerror(errno));
+			return -1;
+		}
+
+		return 0;
+	}
 
+	// Most directories removed e.g. when syncing a tree are small leaves, for which starting up a whole pool isn't worth it.
+	// So first empty the directory right here, and only bring out the pool if it turns out to have subdirectories.
+
+	bool has_subdirs;
+
+	if (empty_leaf(path, &has_subdirs, err) < 0) {
+		return -1;
+	}
+
+	if (!has_subdirs) {
+		if (rmdir(path) < 0 && errno != ENOENT) {
+			asprintf_c(err, "rmdir(\"%s\"): %s", path, strerror(errno));
+			return -1;
+		}
+
+		return 0;
+	}
+
+	rm_state_t state = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+	};
+
+	pool_init(&state.pool, ncpu());
+	add_dir(&state, strdup_c(path));
+
+	int rv = pool_wait(&state.pool);
+	pool_free(&state.pool);
+
+	// Subdirectories are always found after their parent, so removing directories in reverse order removes children first.
+
+	for (size_t i = state.dir_count; i-- > 0;) {
+		rm_dir_t* const dir = state.dirs[i];
+
+		if (rv == 0 && rmdir(dir->path) < 0 && errno != ENOENT) {
+			rm_fail(&state, "rmdir", dir->path);
+			rv = -1;
+		}
+
+		free(dir->path);
+		free(dir);
+	}
+
+	free(state.dirs);
+
+	if (rv < 0) {
+		*err = state.err;
+		return -1;
+	}
+
+	free(state.err);
+	return 0;
+}
+
+int rm_background(char const* path, char** err) {
 	struct stat sb;
 
-	if (stat(src, &sb) < 0) {
-		LOG_ERROR("stat(\"%s\"): %s", src, strerror(errno));
+	if (lstat(path, &sb) < 0 && errno == ENOENT) {
+		return 0;
+	}
+
+	// Move whatever we're removing out of the way first, so that the path can be reused straight away.
+	// The new name must be on the same filesystem for the rename to be instant, so keep it next to the original.
+	// mkdtemp(3) just reserves a unique name; renaming a directory over an empty one replaces it.
+
+	char* STR_CLEANUP trash = NULL;
+	asprintf_c(&trash, "%s.trash.XXXXXX", path);
+
+	if (mkdtemp(trash) == NULL) {
+		return rm(path, err);
+	}
+
+	if (rename(path, trash) < 0) {
+		rmdir(trash);
+		return rm(path, err);
+	}
+
+	// Then, remove it from a separate process, so it can keep going after we exit.
+	// The trash is locked for as long as that process is around: it gets the locked file descriptor as its stdin, and the lock is only released once it exits, successfully or not.
+	// That's how 'rm_stale_trash()' tells trash which is still being removed from trash which was left behind.
+	// The file descriptor is close-on-exec, so that no other command spawned in the meantime holds on to the lock too.
+	// If that doesn't work out, just remove it now.
+
+	int const fd = open(trash, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+	if (fd < 0 || flock(fd, LOCK_EX) < 0) {
+		if (fd >= 0) {
+			close(fd);
+		}
+
+		return rm(trash, err);
+	}
+
+	cmd_t CMD_CLEANUP cmd = {0};
+	cmd_create(&cmd, init_name, "rm-trash", trash, NULL);
+
+	int const rv = cmd_exec_detached(&cmd, fd);
+	close(fd);
+
+	if (rv < 0) {
+		return rm(trash, err);
+	}
+
+	return 0;
+}
+
+void rm_stale_trash(char const* dir, char const* name) {
+	DIR* const dp = opendir(dir);
+
+	if (dp == NULL) {
+		return;
+	}
+
+	struct dirent* entry;
+
+	while ((entry = readdir(dp)) != NULL) {
+		// Trash is named '<path>.trash.XXXXXX' (see 'rm_background()').
+
+		char const* const suffix = strstr(entry->d_name, ".trash.");
+
+		if (suffix == NULL || strlen(suffix) != strlen(".trash.XXXXXX")) {
+			continue;
+		}
+
+		if (name != NULL && ((size_t) (suffix - entry->d_name) != strlen(name) || strncmp(entry->d_name, name, strlen(name)) != 0)) {
+			continue;
+		}
+
+		char* STR_CLEANUP path = NULL;
+		asprintf_c(&path, "%s/%s", dir, entry->d_name);
+
+		int const fd = open(path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+
+		if (fd < 0) {
+			continue;
+		}
+
+		// If it's still locked, the process removing it is still at it.
+
+		if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+			close(fd);
+			continue;
+		}
+
+		char* STR_CLEANUP err = NULL;
+
+		if (rm(path, &err) < 0) {
+			LOG_WARN("Failed to remove stale trash '%s': %s", path, err);
+		}
+
+		close(fd);
+	}
+
+	closedir(dp);
+}
+
+#if defined(__linux__)
+static int copy_data(int in_fd, int out_fd, char const* src, char** err) {
+	// First, try to reflink the file, which shares the source's extents instead of copying any data on filesystems which support it (Btrfs, XFS, bcachefs, ...).
+
+	if (ioctl(out_fd, FICLONE, in_fd) == 0) {
+		return 0;
+	}
+
+	// Then, try copy_file_range(2), which keeps the copy in the kernel (and may still be offloaded to the filesystem).
+	// It can fail outright on older kernels or across some filesystems, in which case we fall back to the next method.
+	// As it advances both file offsets, whatever method comes next picks up where it stopped.
+
+	ssize_t copied;
+
+	while ((copied = copy_file_range(in_fd, NULL, out_fd, NULL, SSIZE_MAX, 0)) > 0);
+
+	if (copied == 0) {
+		return 0;
+	}
+
+	// sendfile(2) also stays in the kernel, and has been able to write to regular files for longer.
+
+	while ((copied = sendfile(out_fd, in_fd, NULL, SSIZE_MAX)) > 0);
+
+	if (copied == 0) {
+		return 0;
+	}
+
+	// Finally, just read and write.
+
+	char buf[64 * 1024];
+
+	while ((copied = read(in_fd, buf, sizeof buf)) > 0) {
+		ssize_t written = 0;
+
+		while (written < copied) {
+			ssize_t const rv = write(out_fd, buf + written, copied - written);
+
+			if (rv < 0 && errno != EINTR) {
+				asprintf_c(err, "write(): %s", strerror(errno));
+				return -1;
+			}
+
+			written += rv < 0 ? 0 : rv;
+		}
+	}
+
+	if (copied < 0) {
+		asprintf_c(err, "read(\"%s\"): %s", src, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+// Files are first written (or linked) to a temporary path next to the destination and then renamed over it.
+// That way, anything using the destination while we're copying (e.g. a running executable) never sees a half-written file.
+
+static int link_file(char const* src, char const* dst, bool* linked, char** err) {
+	*linked = false;
+
+	char* STR_CLEANUP tmp = NULL;
+	asprintf_c(&tmp, "%s.XXXXXX", dst);
+
+	int const fd = mkstemp(tmp);
+
+	if (fd < 0) {
+		asprintf_c(err, "mkstemp(\"%s\"): %s", tmp, strerror(errno));
+		return -1;
+	}
+
+	close(fd);
+	unlink(tmp);
+
+	// Hardlinks can't cross filesystems (and some filesystems don't support them at all), in which case the caller should copy the file instead.
+
+	if (link(src, tmp) < 0) {
+		if (errno == EXDEV || errno == EPERM || errno == EMLINK || errno == ENOTSUP) {
+			return 0;
+		}
+
+		asprintf_c(err, "link(\"%s\", \"%s\"): %s", src, tmp, strerror(errno));
+		return -1;
+	}
+
+	if (rename(tmp, dst) < 0) {
+		asprintf_c(err, "rename(\"%s\", \"%s\"): %s", tmp, dst, strerror(errno));
+		unlink(tmp);
+		return -1;
+	}
+
+	*linked = true;
+	return 0;
+}
+
+static int copy_file(char const* src, char const* dst, struct stat const* sb, char** err) {
+	int const in_fd = open(src, O_RDONLY | O_CLOEXEC);
+
+	if (in_fd < 0) {
+		asprintf_c(err, "open(\"%s\"): %s", src, strerror(errno));
+		return -1;
+	}
+
+	char* STR_CLEANUP tmp = NULL;
+	asprintf_c(&tmp, "%s.XXXXXX", dst);
+
+	int const out_fd = mkstemp(tmp);
+
+	if (out_fd < 0) {
+		asprintf_c(err, "mkstemp(\"%s\"): %s", tmp, strerror(errno));
+		close(in_fd);
+		return -1;
+	}
+
+	int rv = copy_data(in_fd, out_fd, src, err);
+
+	// mkstemp(3) creates the file as 0600, so give it the permissions of the source.
+
+	if (rv == 0 && fchmod(out_fd, sb->st_mode & 0777) < 0) {
+		asprintf_c(err, "fchmod(\"%s\"): %s", tmp, strerror(errno));
+		rv = -1;
+	}
+
+	close(in_fd);
+	close(out_fd);
+
+	if (rv == 0 && rename(tmp, dst) < 0) {
+		asprintf_c(err, "rename(\"%s\", \"%s\"): %s", tmp, dst, strerror(errno));
+		rv = -1;
+	}
+
+	if (rv < 0) {
+		unlink(tmp);
+	}
+
+	return rv;
+}
+
+static int copy_symlink(char const* src, char const* dst, struct stat const* sb, char** err) {
+	// Like 'cp -P', symlinks are copied as-is rather than followed.
+
+	char* STR_CLEANUP target = malloc_c(sb->st_size + 1);
+	ssize_t const len = readlink(src, target, sb->st_size + 1);
+
+	if (len < 0) {
+		asprintf_c(err, "readlink(\"%s\"): %s", src, strerror(errno));
 		return -1;
 	}
 
-	bool const is_dir = S_ISDIR(sb.st_mode);
-	char* STR_CLEANUP dir_src = NULL;
+	// The symlink could've changed between the lstat(2) and the readlink(2); don't copy a truncated target.
 
-	if (is_dir) {
-		asprintf_c(&dir_src, "%s/", src);
-		src = dir_src;
+	if ((size_t) len > (size_t) sb->st_size) {
+		asprintf_c(err, "readlink(\"%s\"): Symlink changed while copying it", src);
+		return -1;
 	}
 
-	// Also, if 'src' is a directory, we'd like to start off by recursively removing it.
-	// This is so the copy overwrites the destination rather than preserving the original files.
+	target[len] = '\0';
 
-	if (is_dir && rm(dst, err) < 0) {
+	if (unlink(dst) < 0 && errno != ENOENT) {
+		asprintf_c(err, "unlink(\"%s\"): %s", dst, strerror(errno));
 		return -1;
 	}
 
-	// Finally, actually run the copy command.
+	if (symlink(target, dst) < 0) {
+		asprintf_c(err, "symlink(\"%s\", \"%s\"): %s", target, dst, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int copy_entry(char const* src, char const* dst, struct stat const* sb, bool may_link, char** err) {
+	if (S_ISLNK(sb->st_mode)) {
+		return copy_symlink(src, dst, sb, err);
+	}
+
+	if (!S_ISREG(sb->st_mode)) {
+		asprintf_c(err, "'%s' is not a regular file, directory, or symlink", src);
+		return -1;
+	}
+
+	if (may_link) {
+		bool linked;
+
+		if (link_file(src, dst, &linked, err) < 0) {
+			return -1;
+		}
+
+		if (linked) {
+			return 0;
+		}
+	}
+
+	return copy_file(src, dst, sb, err);
+}
+#else
+static int copy_entry(char const* src, char const* dst, struct stat const* sb, bool may_link, char** err) {
+	// Outside of Linux, we shell out execution to the 'cp' binary, which knows how to copy files efficiently on each platform (e.g. clonefile(2) on macOS).
+	// Would've loved to use libcopyfile but, alas, POSIX is missing features :(
+	// Hardlinking is only an optimization, so it's fine to ignore 'may_link'.
+
+	(void) may_link;
+
+	// cp(1) would follow a symlink at the destination, so remove it first.
+
+	if (S_ISLNK(sb->st_mode) && unlink(dst) < 0 && errno != ENOENT) {
+		asprintf_c(err, "unlink(\"%s\"): %s", dst, strerror(errno));
+		return -1;
+	}
 
 	cmd_t cmd;
 	cmd_create(&cmd, "cp", "-RP", src, dst, NULL);
@@ -84,10 +600,340 @@ int copy(char const* src, char const* dst, char** err) {
 	cmd_free(&cmd);
 	return rv;
 }
+#endif
+
+static bool same_contents(char const* src, char const* dst, struct stat const* sb) {
+	if (S_ISLNK(sb->st_mode)) {
+		char src_target[PATH_MAX];
+		char dst_target[PATH_MAX];
+
+		ssize_t const src_len = readlink(src, src_target, sizeof src_target);
+		ssize_t const dst_len = readlink(dst, dst_target, sizeof dst_target);
+
+		return src_len >= 0 && src_len == dst_len && memcmp(src_target, dst_target, src_len) == 0;
+	}
+
+	if (!S_ISREG(sb->st_mode)) {
+		return false;
+	}
+
+	int const src_fd = open(src, O_RDONLY | O_CLOEXEC);
+
+	if (src_fd < 0) {
+		return false;
+	}
+
+	int const dst_fd = open(dst, O_RDONLY | O_CLOEXEC);
+
+	if (dst_fd < 0) {
+		close(src_fd);
+		return false;
+	}
+
+	// Sizes were already compared, so we can stop at the end of the source.
+
+	static _Thread_local char src_buf[64 * 1024];
+	static _Thread_local char dst_buf[sizeof src_buf];
+
+	bool same = true;
+	ssize_t len;
+
+	while (same && (len = read(src_fd, src_buf, sizeof src_buf)) > 0) {
+		ssize_t got = 0;
+
+		while (got < len) {
+			ssize_t const rv = read(dst_fd, dst_buf + got, len - got);
+
+			if (rv <= 0) {
+				break;
+			}
+
+			got += rv;
+		}
+
+		same = got == len && memcmp(src_buf, dst_buf, len) == 0;
+	}
+
+	close(src_fd);
+	close(dst_fd);
+
+	return same && len == 0;
+}
+
+static bool entry_unchanged(char const* src, char const* dst, struct stat const* src_sb, struct stat const* dst_sb) {
+	if ((src_sb->st_mode & S_IFMT) != (dst_sb->st_mode & S_IFMT)) {
+		return false;
+	}
+
+	// A hardlinked file is always up to date.
+
+	if (src_sb->st_dev == dst_sb->st_dev && src_sb->st_ino == dst_sb->st_ino) {
+		return true;
+	}
+
+	if (src_sb->st_size != dst_sb->st_size) {
+		return false;
+	}
+
+	// As copies aren't given the source's mtime, use the same rule as 'frugal_mtime()': if the source isn't newer than the destination, it's unchanged.
+
+	if (src_sb->st_mtime <= dst_sb->st_mtime) {
+		return true;
+	}
+
+	// Otherwise, the source may still have been rewritten with the exact same contents (e.g. an object file which was recompiled because a comment changed).
+	// Leave the destination alone in that case, so that its mtime only changes when its contents do; otherwise, everything which depends on it (e.g. projects linking against an installed library) would be rebuilt for nothing.
+
+	return same_contents(src, dst, src_sb);
+}
+
+static int remove_entry(char const* path, struct stat const* sb, char** err) {
+	if (S_ISDIR(sb->st_mode)) {
+		return rm(path, err);
+	}
+
+	if (unlink(path) < 0 && errno != ENOENT) {
+		asprintf_c(err, "unlink(\"%s\"): %s", path, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int sync_dir(char const* src, char const* dst, struct stat const* sb, bool may_link, bool prune, size_t* changed, char** err) {
+	// Make sure the destination is a directory.
+
+	struct stat dst_sb;
+
+	if (lstat(dst, &dst_sb) == 0 && !S_ISDIR(dst_sb.st_mode) && remove_entry(dst, &dst_sb, err) < 0) {
+		return -1;
+	}
+
+	if (mkdir(dst, sb->st_mode & 0777) == 0) {
+		(*changed)++;
+	}
+
+	else if (errno != EEXIST) {
+		asprintf_c(err, "mkdir(\"%s\"): %s", dst, strerror(errno));
+		return -1;
+	}
+
+	// Copy over everything which changed in the source.
+
+	DIR* dp = opendir(src);
+
+	if (dp == NULL) {
+		asprintf_c(err, "opendir(\"%s\"): %s", src, strerror(errno));
+		return -1;
+	}
+
+	int rv = 0;
+	struct dirent* entry;
+
+	while (rv == 0 && (entry = readdir(dp)) != NULL) {
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+			continue;
+		}
+
+		char* STR_CLEANUP entry_src = NULL;
+		asprintf_c(&entry_src, "%s/%s", src, entry->d_name);
+
+		char* STR_CLEANUP entry_dst = NULL;
+		asprintf_c(&entry_dst, "%s/%s", dst, entry->d_name);
+
+		struct stat src_sb;
+
+		if (lstat(entry_src, &src_sb) < 0) {
+			asprintf_c(err, "lstat(\"%s\"): %s", entry_src, strerror(errno));
+			rv = -1;
+			break;
+		}
+
+		if (S_ISDIR(src_sb.st_mode)) {
+			rv = sync_dir(entry_src, entry_dst, &src_sb, may_link, prune, changed, err);
+			continue;
+		}
+
+		bool const dst_exists = lstat(entry_dst, &dst_sb) == 0;
+
+		if (dst_exists && entry_unchanged(entry_src, entry_dst, &src_sb, &dst_sb)) {
+			continue;
+		}
+
+		// A directory can't just be replaced by a file, so remove it first.
+
+		if (dst_exists && S_ISDIR(dst_sb.st_mode) && rm(entry_dst, err) < 0) {
+			rv = -1;
+			break;
+		}
+
+		rv = copy_entry(entry_src, entry_dst, &src_sb, may_link, err);
+		(*changed)++;
+	}
+
+	closedir(dp);
+
+	if (rv < 0 || !prune) {
+		return rv;
+	}
+
+	// Remove everything which is no longer in the source.
+
+	dp = opendir(dst);
+
+	if (dp == NULL) {
+		asprintf_c(err, "opendir(\"%s\"): %s", dst, strerror(errno));
+		return -1;
+	}
+
+	while (rv == 0 && (entry = readdir(dp)) != NULL) {
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+			continue;
+		}
+
+		char* STR_CLEANUP entry_src = NULL;
+		asprintf_c(&entry_src, "%s/%s", src, entry->d_name);
+
+		struct stat src_sb;
+
+		if (lstat(entry_src, &src_sb) == 0 || errno != ENOENT) {
+			continue;
+		}
+
+		char* STR_CLEANUP entry_dst = NULL;
+		asprintf_c(&entry_dst, "%s/%s", dst, entry->d_name);
+
+		if (lstat(entry_dst, &dst_sb) < 0) {
+			continue;
+		}
+
+		rv = remove_entry(entry_dst, &dst_sb, err);
+		(*changed)++;
+	}
+
+	closedir(dp);
+	return rv;
+}
+
+static int sync_any(char const* src, char const* dst, bool may_link, bool prune, size_t* changed, char** err) {
+	*changed = 0;
+
+	// Like 'cp -RP' with a trailing slash on 'src', a symlink to a directory is followed at the top level only.
+
+	struct stat sb;
+
+	if (stat(src, &sb) < 0) {
+		asprintf_c(err, "stat(\"%s\"): %s", src, strerror(errno));
+		return -1;
+	}
+
+	if (S_ISDIR(sb.st_mode)) {
+		return sync_dir(src, dst, &sb, may_link, prune, changed, err);
+	}
+
+	if (lstat(src, &sb) < 0) {
+		asprintf_c(err, "lstat(\"%s\"): %s", src, strerror(errno));
+		return -1;
+	}
+
+	struct stat dst_sb;
+	bool const dst_exists = lstat(dst, &dst_sb) == 0;
+
+	if (dst_exists && entry_unchanged(src, dst, &sb, &dst_sb)) {
+		return 0;
+	}
+
+	if (dst_exists && S_ISDIR(dst_sb.st_mode) && rm(dst, err) < 0) {
+		return -1;
+	}
+
+	*changed = 1;
+	return copy_entry(src, dst, &sb, may_link, err);
+}
+
+int sync_tree(char const* src, char const* dst, bool may_link, size_t* changed, char** err) {
+	return sync_any(src, dst, may_link, true, changed, err);
+}
+
+int merge_tree(char const* src, char const* dst, bool may_link, size_t* changed, char** err) {
+	return sync_any(src, dst, may_link, false, changed, err);
+}
+
+int copy(char const* src, char const* dst, bool may_link, char** err) {
+	// Start off by removing the destination, so that everything is copied over even if it's identical.
+	// Callers can rely on the destination being newer than the source afterwards.
+
+	struct stat sb;
+
+	if (lstat(dst, &sb) == 0 && remove_entry(dst, &sb, err) < 0) {
+		return -1;
+	}
+
+	size_t changed;
+	return sync_tree(src, dst, may_link, &changed, err);
+}
 
 extern bool running_as_root;
 extern uid_t owner;
 
+// Resolved paths of the directories we've decided on the ownership of files in.
+// Pretty much everything we set the owner of is in one of a handful of directories, so this saves resolving the same path over and over again.
+
+static path_table_t owner_dirs = PATH_TABLE_INIT;
+
+static char* resolve_owned_path(char const* path) {
+	// Only the directory is resolved (and cached), so this is where the entry itself is, not what it points to if it's a symlink.
+	// Callers must take care not to follow it ('set_owner()' uses lchown(2) for symlinks).
+
+	char const* const slash = strrchr(path, '/');
+	char const* const base = slash == NULL ? path : slash + 1;
+
+	if (base[0] == '\0' || strcmp(base, ".") == 0 || strcmp(base, "..") == 0) {
+		return realerpath(path);
+	}
+
+	char const* dir = path;
+	size_t dir_len = slash - path;
+
+	if (slash == NULL) {
+		dir = ".";
+		dir_len = 1;
+	}
+
+	else if (slash == path) {
+		dir_len = 1;
+	}
+
+	void* resolved;
+
+	if (!path_table_get(&owner_dirs, dir, dir_len, &resolved)) {
+		char* const STR_CLEANUP dir_str = strndup_c(dir, dir_len);
+		resolved = realerpath(dir_str);
+
+		if (resolved == NULL) {
+			return NULL;
+		}
+
+		// If another thread got here first, its copy is the one which stays in the table.
+
+		if (!path_table_add(&owner_dirs, dir, dir_len, resolved)) {
+			free(resolved);
+			path_table_get(&owner_dirs, dir, dir_len, &resolved);
+		}
+	}
+
+	char* full_path = NULL;
+	asprintf_c(&full_path, "%s/%s", strcmp(resolved, "/") == 0 ? "" : (char*) resolved, base);
+
+	return full_path;
+}
+
+void reset_owner_cache(void) {
+	// XXX The resolved paths themselves are leaked, but there are only ever a handful of them.
+
+	path_table_clear(&owner_dirs);
+}
+
 int would_set_owner(char const* path, bool* would) {
 	*would = false;
 
@@ -109,7 +955,7 @@ int would_set_owner(char const* path, bool* would) {
 
 	// We only want to mess with the permissions of stuff in the output directory (.bob), the dependencies cache directory, or, if we're set to own the prefix, the prefix.
 
-	full_path = realerpath(path);
+	full_path = resolve_owned_path(path);
 
 	if (full_path == NULL) {
 		LOG_WARN("realpath(\"%s\"): %s", path, strerror(errno));
@@ -137,7 +983,24 @@ int set_owner(char const* path) {
 		return -1;
 	}
 
-	if (do_chown && chown(path, owner, -1) < 0) {
+	if (!do_chown) {
+		return 0;
+	}
+
+	// Only the directory a path is in was checked (see 'resolve_owned_path()'), so never follow a symlink: it could point anywhere.
+
+	struct stat sb;
+
+	if (lstat(path, &sb) == 0 && S_ISLNK(sb.st_mode)) {
+		if (lchown(path, owner, -1) < 0) {
+			LOG_ERROR("lchown(\"%s\"): %s", path, strerror(errno));
+			return -1;
+		}
+
+		return 0;
+	}
+
+	if (chown(path, owner, -1) < 0) {
 		LOG_ERROR("chown(\"%s\"): %s", path, strerror(errno));
 		return -1;
 	}
@@ -145,6 +1008,21 @@ int set_owner(char const* path) {
 	return 0;
 }
 
+int set_owner_fd(int fd, char const* path) {
+	bool do_chown;
+
+	if (would_set_owner(path, &do_chown) < 0) {
+		return -1;
+	}
+
+	if (do_chown && fchown(fd, owner, -1) < 0) {
+		LOG_ERROR("fchown(\"%s\"): %s", path, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
 int mkdir_wrapped(char const* path, mode_t mode) {
 	int const rv = mkdir(path, mode);
 
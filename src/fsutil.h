@@ -1,15 +1,111 @@
 // SPDX-License-Identifier: MIT
-// Copyright (c) 2024 Aymeric Wibo
+// Copyright (c) 2024-2026 Aymeric Wibo
 
 #pragma once
 
 #include <stdbool.h>
 #include <sys/types.h>
 
+/**
+ * Remove a file or directory (recursively), like 'rm -rf'.
+ *
+ * Subdirectories are emptied in parallel.
+ * It's not an error for the path not to exist.
+ *
+ * @param path Path to remove.
+ * @param err Set to a heap-allocated error message on failure.
+ * @return 0 on success, -1 on failure.
+ */
 int rm(char const* path, char** err);
-int copy(char const* src, char const* dst, char** err);
+
+/**
+ * Like {@link rm}, but only move the path out of the way and remove it from a separate process in the background.
+ *
+ * The path can be reused as soon as this returns.
+ * If the path can't be moved, it's removed right away instead.
+ *
+ * @param path Path to remove.
+ * @param err Set to a heap-allocated error message on failure.
+ * @return 0 on success, -1 on failure.
+ */
+int rm_background(char const* path, char** err);
+
+/**
+ * Remove trash left behind in a directory by {@link rm_background}, e.g. because the process removing it was killed.
+ *
+ * Trash which is still being removed is left alone.
+ * Failures are only warned about.
+ *
+ * @param dir Directory the paths passed to {@link rm_background} were in.
+ * @param name Name of the path passed to {@link rm_background} whose trash to remove, or NULL to remove trash of any path (only for directories entirely managed by Bob).
+ */
+void rm_stale_trash(char const* dir, char const* name);
+
+/**
+ * Copy a file, symlink, or directory (recursively), overwriting the destination.
+ *
+ * On Linux, files are copied natively, reflinking them where the filesystem supports it.
+ * Elsewhere, this shells out to cp(1).
+ *
+ * @param src Path to copy from.
+ * @param dst Path to copy to.
+ * @param may_link Whether regular files may be hardlinked instead of copied, where possible.
+ * @param err Set to a heap-allocated error message on failure.
+ * @return 0 on success, -1 on failure.
+ */
+int copy(char const* src, char const* dst, bool may_link, char** err);
+
+/**
+ * Like {@link copy}, but only copy what changed.
+ *
+ * Files which are in the destination directory but no longer in the source are removed, and files which haven't changed are left untouched.
+ * A file is considered to have changed if its type or size differs, or if it is newer than its copy and its contents differ.
+ *
+ * @param src Path to copy from.
+ * @param dst Path to copy to.
+ * @param may_link Whether regular files may be hardlinked instead of copied, where possible.
+ * @param changed Set to the number of files which were copied or removed.
+ * @param err Set to a heap-allocated error message on failure.
+ * @return 0 on success, -1 on failure.
+ */
+int sync_tree(char const* src, char const* dst, bool may_link, size_t* changed, char** err);
+
+/**
+ * Like {@link sync_tree}, but never remove anything from the destination.
+ *
+ * This is used to merge a staged installation (or a prebuilt dependency) into a prefix shared with other projects.
+ *
+ * @param src Directory to merge from.
+ * @param dst Directory to merge into.
+ * @param may_link Whether regular files may be hardlinked instead of copied, where possible.
+ * @param changed Set to the number of files which were copied.
+ * @param err Set to a heap-allocated error message on failure.
+ * @return 0 on success, -1 on failure.
+ */
+int merge_tree(char const* src, char const* dst, bool may_link, size_t* changed, char** err);
+
 int would_set_owner(char const* path, bool* would);
 int set_owner(char const* path);
+
+/**
+ * Like {@link set_owner}, but on a file which is already open.
+ *
+ * This saves the kernel from having to look the file up again.
+ *
+ * @param fd File descriptor of the file.
+ * @param path Path to the file, which is used to decide whether to set its owner.
+ * @return 0 on success, -1 on failure.
+ */
+int set_owner_fd(int fd, char const* path);
+
+/**
+ * Forget the ownership decisions cached by {@link set_owner} and {@link set_owner_fd}.
+ *
+ * Those are cached per directory, relative paths included, so this must be called whenever the working directory or the output path changes.
+ * This function is not thread-safe.
+ */
+void reset_owner_cache(void);
+
 int mkdir_wrapped(char const* path, mode_t mode);
 int mkdir_recursive(char const* path, mode_t mode);
 
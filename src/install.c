@@ -1,29 +1,54 @@
 // SPDX-License-Identifier: MIT
-// Copyright (c) 2024 Aymeric Wibo
+// Copyright (c) 2024-2026 Aymeric Wibo
 
 #include <common.h>
 
 #include <alloc.h>
 #include <apple.h>
+#include <cmd.h>
 #include <cookie.h>
+#include <deps.h>
 #include <frugal.h>
 #include <fsutil.h>
 #include <install.h>
 #include <logging.h>
+#include <ncpu.h>
+#include <path_table.h>
+#include <pool.h>
 #include <str.h>
 
 #include <assert.h>
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
 #include <libgen.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 static flamingo_val_t* install_map = NULL;
 
+// Index of install map keys (i.e. cookies and source files), so looking up what a cookie is installed as doesn't have to go through the whole map.
+// Values are the index of the key in the map plus one.
+
+static path_table_t install_keys = PATH_TABLE_INIT;
+
+// Directories we already made sure exist in the install prefix.
+// Many install map entries usually share the same few parent directories, so this saves us from trying to create all of them again for each entry.
+
+static path_table_t made_dirs = PATH_TABLE_INIT;
+
 int setup_install_map(flamingo_t* flamingo) {
 	// Find the install map.
 
 	flamingo_scope_t* const scope = flamingo->env->scope_stack[0];
 
 	install_map = NULL;
+	path_table_clear(&install_keys);
+	path_table_clear(&made_dirs);
 	flamingo_var_t* map = NULL;
 
 	for (size_t i = 0; i < scope->vars_size; i++) {
@@ -76,10 +101,141 @@ found:
 		}
 	}
 
+	// Index install map keys.
+	// If a key is in the map more than once, the first one wins, like it did when we were searching through the map.
+
+	for (size_t i = 0; i < map->val->map.count; i++) {
+		flamingo_val_t* const key_val = map->val->map.keys[i];
+		path_table_add(&install_keys, key_val->str.str, key_val->str.size, (void*) (uintptr_t) (i + 1));
+	}
+
 	install_map = map->val;
 	return 0;
 }
 
+static int make_parent_dirs(char const* val) {
+	// XXX 'dirname' uses internal storage on some platforms, but it seems that with glibc it uses its argument as backing instead.
+
+	char* STR_CLEANUP parent_backing = strdup_c(val);
+	char* parent = dirname(parent_backing);
+
+	char* STR_CLEANUP full_parent = NULL;
+	asprintf_c(&full_parent, "%s/%s", install_prefix, parent);
+
+	if (path_table_get(&made_dirs, full_parent, strlen(full_parent), NULL)) {
+		return 0;
+	}
+
+	char* bit;
+	char* STR_CLEANUP accum = strdup_c(install_prefix);
+
+	while ((bit = strsep(&parent, "/"))) {
+		if (bit[0] == '\0') {
+			continue;
+		}
+
+		char* STR_CLEANUP path = NULL;
+		asprintf_c(&path, "%s/%s", accum, bit);
+
+		if (!path_table_get(&made_dirs, path, strlen(path), NULL)) {
+			if (mkdir_wrapped(path, 0755) < 0 && errno != EEXIST) {
+				LOG_FATAL("mkdir(\"%s\"): %s", path, strerror(errno));
+				return -1;
+			}
+
+			path_table_add(&made_dirs, path, strlen(path), NULL);
+		}
+
+		free(accum);
+		accum = strdup_c(path);
+	}
+
+	path_table_add(&made_dirs, full_parent, strlen(full_parent), NULL);
+	return 0;
+}
+
+#define COMPARED "installed"
+
+// When a source is newer than its installed copy but turns out to have the same contents, the installed copy is left alone (see 'sync_tree()').
+// It then stays older than its source, so we remember that they were compared, lest every later install read through both of them again.
+// This is kept next to cookies so that it's garbage collected along with them, and in the output path for other sources (see 'install_gc_compared()').
+
+static char* compared_path(char const* path, char const* install_path, bool is_cookie) {
+	uint64_t const hash = strhash(install_path);
+	char* compared = NULL;
+
+	if (is_cookie) {
+		asprintf_c(&compared, "%s.installed.%016" PRIx64, path, hash);
+		return compared;
+	}
+
+	char* STR_CLEANUP dir = NULL;
+	asprintf_c(&dir, "%s/" COMPARED, bsys_out_path);
+
+	if (mkdir_wrapped(dir, 0755) < 0 && errno != EEXIST) {
+		LOG_WARN("mkdir(\"%s\"): %s", dir, strerror(errno));
+		return NULL;
+	}
+
+	asprintf_c(&compared, "%s/%016" PRIx64, dir, strhash(path) ^ hash);
+	return compared;
+}
+
+static void format_compared(char buf[static 128], struct stat const* src_sb, struct stat const* dst_sb) {
+	snprintf(buf, 128, "%lld %lld %llu %lld %lld\n",
+		(long long) src_sb->st_size, (long long) src_sb->st_mtime, (unsigned long long) src_sb->st_ino,
+		(long long) dst_sb->st_size, (long long) dst_sb->st_mtime);
+}
+
+// Check whether the source and its installed copy are still exactly as they were when they were found to have the same contents.
+
+static bool still_compared(char const* compared, struct stat const* src_sb, char const* install_path) {
+	struct stat dst_sb;
+
+	if (compared == NULL || lstat(install_path, &dst_sb) < 0) {
+		return false;
+	}
+
+	FILE* const f = fopen(compared, "r");
+
+	if (f == NULL) {
+		return false;
+	}
+
+	char recorded[128] = {0};
+	bool const read = fgets(recorded, sizeof recorded, f) != NULL;
+	fclose(f);
+
+	char expected[128];
+	format_compared(expected, src_sb, &dst_sb);
+
+	return read && strcmp(recorded, expected) == 0;
+}
+
+static void record_compared(char const* compared, struct stat const* src_sb, char const* path, char const* install_path) {
+	struct stat dst_sb;
+
+	if (compared == NULL || lstat(install_path, &dst_sb) < 0) {
+		return;
+	}
+
+	FILE* const f = fopen(compared, "w");
+
+	if (f == NULL) {
+		LOG_WARN("fopen(\"%s\"): %s", compared, strerror(errno));
+		return;
+	}
+
+	char buf[128];
+	format_compared(buf, src_sb, &dst_sb);
+
+	// The paths are only there for 'install_gc_compared()'.
+
+	fprintf(f, "%s%s\n%s\n", buf, path, install_path);
+	set_owner_fd(fileno(f), compared);
+	fclose(f);
+}
+
 static int install_single(flamingo_val_t* key_val, char* val, bool installing_cookie) {
 	assert(install_prefix != NULL);
 
@@ -106,36 +262,56 @@ static int install_single(flamingo_val_t* key_val, char* val, bool installing_co
 	assert((is_cookie ^ installing_cookie) == 0);
 
 	// Make sure destination directory exists.
-	// XXX 'dirname' uses internal storage on some platforms, but it seems that with glibc it uses its argument as backing instead.
 
-	char* STR_CLEANUP parent_backing = strdup_c(val);
-	char* parent = dirname(parent_backing);
+	if (make_parent_dirs(val) < 0) {
+		return -1;
+	}
 
-	char* bit;
-	char* STR_CLEANUP accum = strdup_c(install_prefix);
+	char* STR_CLEANUP install_path = NULL;
+	asprintf_c(&install_path, "%s/%s", install_prefix, val);
 
-	while ((bit = strsep(&parent, "/"))) {
-		if (bit[0] == '\0') {
-			continue;
-		}
+	// Files in the temporary prefix are only ever read, so they may be hardlinked to their cookies if asked to.
 
-		char* STR_CLEANUP path = NULL;
-		asprintf_c(&path, "%s/%s", accum, bit);
+	bool const may_link = install_hardlinks && install_prefix == default_tmp_install_prefix;
+	char* STR_CLEANUP err = NULL;
 
-		if (mkdir_wrapped(path, 0755) < 0 && errno != EEXIST) {
-			LOG_FATAL("mkdir(\"%s\"): %s", path, strerror(errno));
+	// Directories are synced file by file, as the modification time of a directory only changes when entries are added or removed from it, not when the files in it change.
+
+	struct stat sb;
+
+	if (stat(path, &sb) < 0) {
+		LOG_FATAL("stat(\"%s\"): %s", path, strerror(errno));
+		return -1;
+	}
+
+	if (S_ISDIR(sb.st_mode)) {
+		size_t changed;
+
+		if (sync_tree(key, install_path, may_link, &changed, &err) < 0) {
+			LOG_FATAL("Failed to sync '%s' to '%s': %s", key, install_path, err);
 			return -1;
 		}
 
-		free(accum);
-		accum = strdup_c(path);
+		// The directory itself is only touched when entries are added to or removed from it, so its files are recorded one by one.
+
+		dep_record_installed_tree(path, "", install_path);
+
+		if (changed == 0) {
+			LOG_SUCCESS("%s" CLEAR ": Already %sinstalled.", val, is_cookie ? "pre" : "");
+			return 0;
+		}
+
+		set_owner(install_path);
+		frugal_forget_libs();
+		cmd_forget_bins();
+
+		LOG_SUCCESS("%s" CLEAR ": Successfully %sinstalled (%zu file%s changed).", val, is_cookie ? "pre" : "", changed, changed == 1 ? "" : "s");
+		return 0;
 	}
 
-	// Check modification times.
-	// TODO When 'key' is a directory, we should recursively check all files in it.
+	dep_record_installed(install_path);
 
-	char* STR_CLEANUP install_path = NULL;
-	asprintf_c(&install_path, "%s/%s", install_prefix, val);
+	// Check modification times.
 
 	bool do_install = false;
 
@@ -149,6 +325,22 @@ static int install_single(flamingo_val_t* key_val, char* val, bool installing_co
 		return 0;
 	}
 
+	char* const STR_CLEANUP compared = compared_path(path, install_path, is_cookie);
+
+	if (still_compared(compared, &sb, install_path)) {
+		LOG_SUCCESS("%s" CLEAR ": Already %sinstalled.", val, is_cookie ? "pre" : "");
+		return 0;
+	}
+
+	// On macOS, installed dylibs have their install ID rewritten, so their contents never match their cookie's; just copy them over.
+
+	bool dylib = false;
+
+#if defined(__APPLE__)
+	size_t const key_len = strlen(key);
+	dylib = key_len >= 2 && strcmp(key + key_len - 2, ".l") == 0;
+#endif
+
 	// Actually copy over files.
 
 	if (is_cookie) {
@@ -159,22 +351,31 @@ static int install_single(flamingo_val_t* key_val, char* val, bool installing_co
 		LOG_INFO("%s" CLEAR ": Installing from '%s'...", val, key);
 	}
 
-	char* STR_CLEANUP err = NULL;
+	// Even if the source is newer, it may have been rewritten with the same contents.
+	// In that case, the installed file is left as is so that whatever depends on it isn't needlessly rebuilt.
 
-	if (copy(key, install_path, &err) < 0) {
+	size_t changed = 1;
+	int const rv = dylib ? copy(key, install_path, may_link, &err) : sync_tree(key, install_path, may_link, &changed, &err);
+
+	if (rv < 0) {
 		LOG_FATAL("Failed to copy '%s' to '%s': %s", key, install_path, err);
 		return -1;
 	}
 
+	if (changed == 0) {
+		record_compared(compared, &sb, path, install_path);
+		LOG_SUCCESS("%s" CLEAR ": Unchanged, so already %sinstalled.", val, is_cookie ? "pre" : "");
+		return 0;
+	}
+
 	set_owner(install_path);
+	frugal_forget_libs();
+	cmd_forget_bins();
 
 #if defined(__APPLE__)
 	free(err);
 	err = NULL;
 
-	size_t const key_len = strlen(key);
-	bool const dylib = key_len >= 2 && strcmp(key + key_len - 2, ".l") == 0;
-
 	if (dylib && apple_set_install_id(install_path, val, &err) < 0) {
 		LOG_WARN("Failed to set Apple install ID for dylib '%s': %s", install_path, err);
 	}
@@ -185,21 +386,151 @@ static int install_single(flamingo_val_t* key_val, char* val, bool installing_co
 	return 0;
 }
 
+typedef struct install_task_t install_task_t;
+
+struct install_task_t {
+	flamingo_val_t* key_val;
+	char* val;
+	held_log_t log;
+
+	bool overlaps;
+	install_task_t* next; // Next overlapping entry to install once this one is done.
+};
+
+static bool install_task(void* data) {
+	for (install_task_t* task = data; task != NULL; task = task->next) {
+		logging_hold();
+		int const rv = install_single(task->key_val, task->val, false);
+		logging_release_held(&task->log);
+
+		if (rv < 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Find the entries whose destinations are the same as or nested in another's, e.g. a directory installed as 'share/x' and a file installed as 'share/x/f'.
+// Those can't be installed concurrently: syncing the directory removes whatever isn't in it, and two entries with the same destination should resolve as the last one winning.
+
+static void find_overlapping(install_task_t* tasks, size_t count) {
+	path_table_t dests = PATH_TABLE_INIT;
+	path_table_t parents = PATH_TABLE_INIT; // Every directory something is installed under.
+
+	for (size_t i = 0; i < count; i++) {
+		char* const val = tasks[i].val;
+		size_t const len = strlen(val);
+
+		if (!path_table_add(&dests, val, len, &tasks[i])) {
+			void* first;
+			path_table_get(&dests, val, len, &first);
+
+			((install_task_t*) first)->overlaps = true;
+			tasks[i].overlaps = true;
+		}
+
+		for (size_t j = 1; j < len; j++) {
+			if (val[j] == '/') {
+				path_table_add(&parents, val, j, NULL);
+			}
+		}
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		char* const val = tasks[i].val;
+		size_t const len = strlen(val);
+
+		if (path_table_get(&parents, val, len, NULL)) {
+			tasks[i].overlaps = true;
+		}
+
+		for (size_t j = 1; j < len; j++) {
+			if (val[j] == '/' && path_table_get(&dests, val, j, NULL)) {
+				tasks[i].overlaps = true;
+			}
+		}
+	}
+
+	path_table_clear(&dests);
+	path_table_clear(&parents);
+}
+
 int install_all(void) {
 	if (install_map == NULL) {
-		return 0;
+		return dep_record_write_installed();
 	}
 
-	for (size_t i = 0; i < install_map->map.count; i++) {
+	size_t const count = install_map->map.count;
+	install_task_t* const tasks = calloc_c(count, sizeof *tasks);
+
+	for (size_t i = 0; i < count; i++) {
+		install_task_t* const task = &tasks[i];
 		flamingo_val_t* const val_val = install_map->map.vals[i];
-		char* const val = strndup_c(val_val->str.str, val_val->str.size);
 
-		if (install_single(install_map->map.keys[i], val, false) < 0) {
-			return -1;
+		task->key_val = install_map->map.keys[i];
+		task->val = strndup_c(val_val->str.str, val_val->str.size);
+
+		// Trailing slashes don't change where something is installed, but they would stop it from being recognized as overlapping.
+
+		size_t len = strlen(task->val);
+
+		while (len > 1 && task->val[len - 1] == '/') {
+			task->val[--len] = '\0';
 		}
 	}
 
-	return 0;
+	// Install all entries in parallel, except for overlapping ones, which are all installed one after the other by the same task, in the order of the install map.
+
+	find_overlapping(tasks, count);
+
+	pool_t pool;
+	pool_init(&pool, ncpu());
+
+	install_task_t* first_overlapping = NULL;
+	install_task_t* last_overlapping = NULL;
+
+	for (size_t i = 0; i < count; i++) {
+		install_task_t* const task = &tasks[i];
+
+		if (!task->overlaps) {
+			pool_add_task(&pool, install_task, task);
+			continue;
+		}
+
+		if (last_overlapping == NULL) {
+			first_overlapping = task;
+		}
+
+		else {
+			last_overlapping->next = task;
+		}
+
+		last_overlapping = task;
+	}
+
+	if (first_overlapping != NULL) {
+		pool_add_task(&pool, install_task, first_overlapping);
+	}
+
+	int const rv = pool_wait(&pool);
+	pool_free(&pool);
+
+	// Log everything in the order of the install map, regardless of the order entries were actually installed in.
+	// If an entry failed, entries after it might not have been installed at all, in which case they have nothing to log.
+
+	for (size_t i = 0; i < count; i++) {
+		log_held(&tasks[i].log);
+		free(tasks[i].val);
+	}
+
+	free(tasks);
+
+	if (rv < 0) {
+		return -1;
+	}
+
+	return dep_record_write_installed();
 }
 
 char* cookie_to_output(char* cookie, flamingo_val_t** key_val_ref) {
@@ -207,28 +538,26 @@ char* cookie_to_output(char* cookie, flamingo_val_t** key_val_ref) {
 		return NULL;
 	}
 
-	for (size_t i = 0; i < install_map->map.count; i++) {
-		// Find cookie in install map.
+	// Find cookie in install map.
 
-		flamingo_val_t* const key_val = install_map->map.keys[i];
+	void* index;
 
-		if (flamingo_cstrcmp(key_val->str.str, cookie, key_val->str.size) != 0) {
-			continue;
-		}
+	if (!path_table_get(&install_keys, cookie, strlen(cookie), &index)) {
+		return NULL;
+	}
 
-		// Found; install it.
+	size_t const i = (uintptr_t) index - 1;
 
-		if (key_val_ref != NULL) {
-			*key_val_ref = key_val;
-		}
+	// Found; install it.
 
-		flamingo_val_t* const val_val = install_map->map.vals[i];
-		char* const val = strndup_c(val_val->str.str, val_val->str.size);
-
-		return val;
+	if (key_val_ref != NULL) {
+		*key_val_ref = install_map->map.keys[i];
 	}
 
-	return NULL;
+	flamingo_val_t* const val_val = install_map->map.vals[i];
+	char* const val = strndup_c(val_val->str.str, val_val->str.size);
+
+	return val;
 }
 
 int install_cookie(char* cookie, bool built) {
@@ -249,3 +578,81 @@ int install_cookie(char* cookie, bool built) {
 
 	return 0;
 }
+
+// Check whether the source and installed copy a comparison record is about are both still around.
+// Records written before they included their paths can't be checked, so they're considered gone; they're only a cache anyway.
+
+static bool compared_live(int dir_fd, char const* name) {
+	int const fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		return false;
+	}
+
+	FILE* const f = fdopen(fd, "r");
+
+	if (f == NULL) {
+		close(fd);
+		return false;
+	}
+
+	char* line = NULL;
+	size_t cap = 0;
+	ssize_t len;
+
+	bool live = getline(&line, &cap, f) > 0;
+
+	for (size_t i = 0; live && i < 2; i++) {
+		struct stat sb;
+
+		if ((len = getline(&line, &cap, f)) <= 1) {
+			live = false;
+			break;
+		}
+
+		line[len - 1] = '\0';
+		live = lstat(line, &sb) == 0;
+	}
+
+	free(line);
+	fclose(f);
+
+	return live;
+}
+
+void install_gc_compared(size_t* removed, off_t* freed) {
+	char* STR_CLEANUP dir = NULL;
+	asprintf_c(&dir, "%s/" COMPARED, bsys_out_path);
+
+	DIR* const dp = opendir(dir);
+
+	if (dp == NULL) {
+		return;
+	}
+
+	int const dir_fd = dirfd(dp);
+	struct dirent* entry;
+
+	while ((entry = readdir(dp)) != NULL) {
+		char const* const name = entry->d_name;
+		struct stat sb;
+
+		if (name[0] == '.' || fstatat(dir_fd, name, &sb, AT_SYMLINK_NOFOLLOW) < 0 || !S_ISREG(sb.st_mode)) {
+			continue;
+		}
+
+		if (compared_live(dir_fd, name)) {
+			continue;
+		}
+
+		if (unlinkat(dir_fd, name, 0) < 0) {
+			LOG_WARN("unlink(\"%s/%s\"): %s", dir, name, strerror(errno));
+			continue;
+		}
+
+		(*removed)++;
+		*freed += sb.st_size;
+	}
+
+	closedir(dp);
+}
@@ -5,7 +5,19 @@
 
 #include <flamingo/flamingo.h>
 
+#include <sys/types.h>
+
 int setup_install_map(flamingo_t* flamingo);
 int install_all(void);
 char* cookie_to_output(char* cookie, flamingo_val_t** key_val_ref);
 int install_cookie(char* cookie, bool built);
+
+/**
+ * Remove the records of sources found to have the same contents as their installed copies whose source or installed copy is gone.
+ *
+ * Records for cookies are kept next to them, and are garbage collected along with them instead.
+ *
+ * @param removed Incremented by the number of records removed.
+ * @param freed Incremented by the number of bytes freed.
+ */
+void install_gc_compared(size_t* removed, off_t* freed);
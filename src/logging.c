@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: MIT
-// Copyright (c) 2023 Aymeric Wibo
+// Copyright (c) 2023-2026 Aymeric Wibo
 
 #define __STDC_WANT_LIB_EXT2__ \
 	1 // ISO/IEC TR 24731-2:2010 standard library extensions
@@ -9,12 +9,18 @@
 #endif
 
 #include <err.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <alloc.h>
+#include <common.h>
 #include <logging.h>
 #include <str.h>
 
@@ -56,12 +62,336 @@ static bool supports_colour(void) {
 	return !!strstr(term, "color");
 }
 
+// Logging backend.
+// Formatting a message happens on the calling thread, but actually writing it out is left to a single writer thread, so that a worker never waits on the terminal (or on other workers' messages).
+// Each thread gets its own single-producer single-consumer ring of records, so pushing a record never takes a lock.
+// Records are numbered from a global sequence as they're pushed, and the writer outputs them strictly in that order.
+//
+// Rings are never freed; when a thread exits, its ring is released for the next new thread to claim.
+
+#define RING_SIZE 1024
+#define WRITER_IDLE_MS 10
+
+typedef struct {
+	uint64_t seq;
+	FILE* stream;
+	size_t len;
+	char data[];
+} record_t;
+
+typedef struct ring_t ring_t;
+
+struct ring_t {
+	ring_t* next;
+	atomic_bool owned;
+
+	_Atomic size_t head;
+	_Atomic size_t tail;
+	record_t* slots[RING_SIZE];
+};
+
+static pthread_once_t writer_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ring_key;
+static _Thread_local ring_t* ring = NULL;
+
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Atomic(ring_t*) rings = NULL;
+
+static _Atomic uint64_t next_seq = 0;
+
+static pthread_mutex_t wake_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake_cond = PTHREAD_COND_INITIALIZER;
+static atomic_bool writer_sleeping = false;
+
+static pthread_mutex_t flush_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flush_cond = PTHREAD_COND_INITIALIZER;
+static uint64_t written = 0;
+
+// Records logged while a thread is holding its output (see 'logging_hold()') are accumulated here instead of being pushed.
+
+static _Thread_local size_t hold_depth = 0;
+static _Thread_local FILE* held_stream = NULL;
+static _Thread_local char* held = NULL;
+static _Thread_local size_t held_len = 0;
+
+static bool pending(void) {
+	for (ring_t* r = atomic_load(&rings); r != NULL; r = r->next) {
+		if (atomic_load(&r->head) != atomic_load(&r->tail)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void* writer(void* arg) {
+	uint64_t next = 0;
+	FILE* last_stream = NULL;
+
+	for (;;) {
+		bool wrote = false;
+
+		// Write out as many records as we can, in order.
+		// If the next record isn't in any ring yet, the thread which numbered it is just about to push it.
+
+		for (;;) {
+			ring_t* r;
+			record_t* rec = NULL;
+
+			for (r = atomic_load(&rings); r != NULL; r = r->next) {
+				size_t const head = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+				if (head == atomic_load_explicit(&r->tail, memory_order_acquire)) {
+					continue;
+				}
+
+				rec = r->slots[head % RING_SIZE];
+
+				if (rec->seq == next) {
+					break;
+				}
+			}
+
+			if (r == NULL) {
+				break;
+			}
+
+			// Flush when switching streams, so that stdout and stderr stay in order when they're written to the same place.
+
+			if (last_stream != NULL && rec->stream != last_stream) {
+				fflush(last_stream);
+			}
+
+			last_stream = rec->stream;
+
+			fwrite(rec->data, 1, rec->len, rec->stream);
+			free(rec);
+
+			atomic_store_explicit(&r->head, atomic_load_explicit(&r->head, memory_order_relaxed) + 1, memory_order_release);
+			next++;
+			wrote = true;
+		}
+
+		if (wrote) {
+			fflush(stdout);
+			fflush(stderr);
+
+			pthread_mutex_lock(&flush_lock);
+			written = next;
+			pthread_cond_broadcast(&flush_cond);
+			pthread_mutex_unlock(&flush_lock);
+
+			continue;
+		}
+
+		// Nothing to do; sleep until a record is pushed.
+		// We check again after announcing we're going to sleep, as a record might've been pushed before the producer could see that.
+		// The timeout is just in case.
+
+		pthread_mutex_lock(&wake_lock);
+		atomic_store(&writer_sleeping, true);
+
+		if (!pending()) {
+			struct timespec deadline;
+			clock_gettime(CLOCK_REALTIME, &deadline);
+
+			deadline.tv_nsec += WRITER_IDLE_MS * 1000000;
+			deadline.tv_sec += deadline.tv_nsec / 1000000000;
+			deadline.tv_nsec %= 1000000000;
+
+			pthread_cond_timedwait(&wake_cond, &wake_lock, &deadline);
+		}
+
+		atomic_store(&writer_sleeping, false);
+		pthread_mutex_unlock(&wake_lock);
+	}
+
+	return NULL;
+}
+
+static void release_ring(void* data) {
+	ring_t* const r = data;
+	atomic_store(&r->owned, false);
+}
+
+static void start_writer(void) {
+	pthread_key_create(&ring_key, release_ring);
+
+	pthread_t thread;
+
+	if (pthread_create(&thread, NULL, writer, NULL) != 0) {
+		errx(EXIT_FAILURE, "Failed to create logging thread.");
+	}
+
+	pthread_detach(thread);
+}
+
+static ring_t* get_ring(void) {
+	if (ring != NULL) {
+		return ring;
+	}
+
+	pthread_once(&writer_once, start_writer);
+
+	// Try to claim a ring released by a thread which has exited.
+
+	for (ring_t* r = atomic_load(&rings); r != NULL; r = r->next) {
+		bool expected = false;
+
+		if (atomic_compare_exchange_strong(&r->owned, &expected, true)) {
+			ring = r;
+			goto claimed;
+		}
+	}
+
+	// Otherwise, create a new one.
+
+	ring = calloc_c(1, sizeof *ring);
+	atomic_store(&ring->owned, true);
+
+	pthread_mutex_lock(&rings_lock);
+	ring->next = atomic_load(&rings);
+	atomic_store(&rings, ring);
+	pthread_mutex_unlock(&rings_lock);
+
+claimed:
+
+	pthread_setspecific(ring_key, ring);
+	return ring;
+}
+
+static void push(FILE* stream, char const* data, size_t len) {
+	ring_t* const r = get_ring();
+	size_t const tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+	// Only wait if our ring is full, which only happens if we log faster than the terminal can keep up for a long time.
+
+	while (tail - atomic_load_explicit(&r->head, memory_order_acquire) >= RING_SIZE) {
+		pthread_mutex_lock(&wake_lock);
+		pthread_cond_signal(&wake_cond);
+		pthread_mutex_unlock(&wake_lock);
+
+		sched_yield();
+	}
+
+	record_t* const rec = malloc_c(sizeof *rec + len);
+
+	rec->seq = atomic_fetch_add(&next_seq, 1);
+	rec->stream = stream;
+	rec->len = len;
+
+	memcpy(rec->data, data, len);
+
+	r->slots[tail % RING_SIZE] = rec;
+	atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+
+	if (atomic_load(&writer_sleeping)) {
+		pthread_mutex_lock(&wake_lock);
+		pthread_cond_signal(&wake_cond);
+		pthread_mutex_unlock(&wake_lock);
+	}
+}
+
+static void emit(FILE* stream, char const* data, size_t len) {
+	if (hold_depth == 0) {
+		push(stream, data, len);
+		return;
+	}
+
+	// Held records all go out in one go on the stream of the first one.
+
+	if (held_stream == NULL) {
+		held_stream = stream;
+	}
+
+	held = realloc_c(held, held_len + len);
+	memcpy(held + held_len, data, len);
+	held_len += len;
+}
+
 void logging_init(void) {
 	// does our terminal support colours?
 	// this seems surprisingly stupidly difficult:
 	// https://unix.stackexchange.com/questions/573410/how-to-interact-with-a-terminfo-database-in-c-without-ncurses
 
 	colour_support = supports_colour();
+
+	// Make sure nothing logged is lost when exiting.
+
+	atexit(logging_flush);
+}
+
+void logging_flush(void) {
+	uint64_t const target = atomic_load(&next_seq);
+
+	pthread_mutex_lock(&flush_lock);
+
+	while (written < target) {
+		pthread_cond_wait(&flush_cond, &flush_lock);
+	}
+
+	pthread_mutex_unlock(&flush_lock);
+}
+
+void logging_hold(void) {
+	hold_depth++;
+}
+
+void logging_release(void) {
+	if (--hold_depth > 0 || held == NULL) {
+		return;
+	}
+
+	push(held_stream, held, held_len);
+
+	free(held);
+	held = NULL;
+	held_len = 0;
+	held_stream = NULL;
+}
+
+void logging_release_held(held_log_t* log) {
+	*log = (held_log_t) {0};
+
+	if (--hold_depth > 0 || held == NULL) {
+		return;
+	}
+
+	log->stream = held_stream;
+	log->data = held;
+	log->len = held_len;
+
+	held = NULL;
+	held_len = 0;
+	held_stream = NULL;
+}
+
+void log_held(held_log_t* log) {
+	if (log->data != NULL) {
+		log_raw(log->stream, log->data, log->len);
+	}
+
+	free(log->data);
+	*log = (held_log_t) {0};
+}
+
+void log_raw(FILE* stream, char const* data, size_t len) {
+	if (len > 0) {
+		emit(stream, data, len);
+	}
+}
+
+void log_rawf(FILE* stream, char const* fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+
+	char* msg = NULL;
+	vasprintf_c(&msg, fmt, args);
+
+	va_end(args);
+
+	log_raw(stream, msg, strlen(msg));
+	free(msg);
 }
 
 void vlog(FILE* stream, char const* colour, char const* const fmt, ...) {
@@ -73,14 +403,19 @@ void vlog(FILE* stream, char const* colour, char const* const fmt, ...) {
 
 	va_end(args);
 
+	char* line = NULL;
+
 	if (colour_support) {
-		fprintf(stream, "%s%s%s\n", colour, msg, CLEAR);
+		asprintf_c(&line, "%s%s%s\n", colour, msg, CLEAR);
 	}
 
 	else {
-		fprintf(stream, "%s\n", msg);
+		asprintf_c(&line, "%s\n", msg);
 	}
 
+	emit(stream, line, strlen(line));
+
+	free(line);
 	free(msg);
 }
 
@@ -109,9 +444,49 @@ void log_already_done(char const* cookie, char const* prefix, char const* past)
 
 	char* const suffix = out ? ":" : ".";
 
+	logging_hold();
 	LOG_SUCCESS("%s" CLEAR "%sAlready %s%s", prefix ? prefix : "", prefix ? ": " : "", past, suffix);
 
 	if (out) {
-		printf("%s", out);
+		log_raw(stdout, out, strlen(out));
 	}
+
+	logging_release();
+}
+
+void log_already_done_or_count(already_done_summary_t* summary, char const* cookie, char const* prefix, char const* past) {
+	if (verbose) {
+		log_already_done(cookie, prefix, past);
+		return;
+	}
+
+	summary->count++;
+
+	// Only check if there is a log file, don't actually read it.
+
+	if (cookie == NULL) {
+		return;
+	}
+
+	char* STR_CLEANUP path;
+	asprintf_c(&path, "%s.log", cookie);
+
+	if (access(path, F_OK) == 0) {
+		summary->cached_logs++;
+	}
+}
+
+void log_already_done_summary(already_done_summary_t* summary, char const* singular, char const* plural) {
+	if (summary->count == 0) {
+		return;
+	}
+
+	char const* const noun = summary->count == 1 ? singular : plural;
+
+	if (summary->cached_logs == 0) {
+		LOG_SUCCESS("%zu %s up to date.", summary->count, noun);
+		return;
+	}
+
+	LOG_SUCCESS("%zu %s up to date (%zu with cached warnings, pass -v to see them).", summary->count, noun, summary->cached_logs);
 }
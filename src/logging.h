@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: MIT
-// Copyright (c) 2023 Aymeric Wibo
+// Copyright (c) 2023-2026 Aymeric Wibo
 
 #pragma once
 
@@ -15,6 +15,61 @@ extern bool colour_support;
 
 void logging_init(void);
 
+/**
+ * Wait for everything logged so far to actually be written out.
+ *
+ * Logging is asynchronous, so this must be called before anything else writes to stdout or stderr directly (e.g. a command which isn't redirected), or before the process is replaced.
+ * It is called automatically on exit.
+ */
+void logging_flush(void);
+
+/**
+ * Hold back everything this thread logs until {@link logging_release}, and then write it all out at once.
+ *
+ * This keeps e.g. a status line and the command output that goes with it together, without having to lock out other threads.
+ * Calls can be nested.
+ */
+void logging_hold(void);
+void logging_release(void);
+
+/**
+ * Output held back by {@link logging_hold}, taken with {@link logging_release_held}.
+ */
+typedef struct {
+	FILE* stream;
+	char* data;
+	size_t len;
+} held_log_t;
+
+/**
+ * Like {@link logging_release}, but take what was held back instead of writing it out.
+ *
+ * This lets work done in parallel be logged in a deterministic order, by writing out each piece's output with {@link log_held} once it's all done.
+ * If this is a nested call, the output stays held by the outer call and 'log' is left empty.
+ *
+ * @param log Set to the output which was held back.
+ */
+void logging_release_held(held_log_t* log);
+
+/**
+ * Write out output taken with {@link logging_release_held}, and free it.
+ *
+ * @param log Output to write out.
+ */
+void log_held(held_log_t* log);
+
+/**
+ * Log raw text, without colours or a trailing newline.
+ *
+ * Use this instead of writing to stdout or stderr directly, so that it comes out in order with the rest of the logs.
+ *
+ * @param stream Stream to write to.
+ * @param data Text to write.
+ * @param len Length of 'data'.
+ */
+void log_raw(FILE* stream, char const* data, size_t len);
+__attribute__((__format__(__printf__, 2, 3))) void log_rawf(FILE* stream, char const* fmt, ...);
+
 __attribute__((__format__(__printf__, 3, 0))) void
 vlog(FILE* stream, char const* colour, char const* const fmt, ...);
 
@@ -22,6 +77,17 @@ vlog(FILE* stream, char const* colour, char const* const fmt, ...);
 
 void log_already_done(char const* cookie, char const* prefix, char const* past);
 
+// Unless in verbose mode, work which was already done is summarized rather than logged one by one.
+// This avoids printing a line and reading a log file for every single up-to-date object on big projects.
+
+typedef struct {
+	size_t count;
+	size_t cached_logs;
+} already_done_summary_t;
+
+void log_already_done_or_count(already_done_summary_t* summary, char const* cookie, char const* prefix, char const* past);
+void log_already_done_summary(already_done_summary_t* summary, char const* singular, char const* plural);
+
 // kinda replicate the umber API
 
 #define CLEAR "\033[0m"
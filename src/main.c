@@ -10,6 +10,9 @@
 #include <gitignore.h>
 #include <logging.h>
 #include <ncpu.h>
+#include <pgo.h>
+#include <project.h>
+#include <spawn_server.h>
 #include <str.h>
 
 #include <errno.h>
@@ -17,7 +20,6 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
-#include <sys/utsname.h>
 #include <unistd.h>
 
 #if defined(__linux__)
@@ -44,8 +46,14 @@ char const* install_prefix = NULL;
 char* default_final_install_prefix = NULL;
 char* default_tmp_install_prefix = NULL;
 
+bool verbose = false;
+bool install_hardlinks = false;
+bool deps_in_process = false;
+char const* install_record = NULL;
 bool force_dep_tree_rebuild = false;
 
+pgo_t pgo_mode = PGO_NONE;
+
 size_t dep_config_count = 0;
 char** dep_config_keys = NULL;
 char** dep_config_vals = NULL;
@@ -54,6 +62,8 @@ bool running_as_root = false;
 uid_t owner = 0;
 
 void usage(void) {
+	logging_flush();
+
 #if defined(__FreeBSD__)
 	char const* const progname = getprogname();
 #elif defined(__linux__)
@@ -70,11 +80,14 @@ void usage(void) {
 	fprintf(
 		stderr,
 		// clang-format off
-		"usage: %1$s [-j jobs] [-p install_prefix] [-D KEY=VAL] [-N] [-O] [-C project_directory] [-o out_directory] build\n"
-		"       %1$s [-j jobs] [-p install_prefix] [-D KEY=VAL] [-N] [-O] [-C project_directory] [-o out_directory] run [args ...]\n"
-		"       %1$s [-j jobs] [-p install_prefix] [-D KEY=VAL] [-N] [-O] [-C project_directory] [-o out_directory] sh [args ...]\n"
-		"       %1$s [-j jobs] [-p install_prefix] [-D KEY=VAL] [-N] [-O] [-C project_directory] [-o out_directory] install\n"
-		"       %1$s [-j jobs] [-p install_prefix] [-D KEY=VAL] [-N] [-O] [-C project_directory] [-o out_directory] clean\n",
+		"usage: %1$s [-j jobs] [-p install_prefix] [-D KEY=VAL] [-N] [-O] [-v] [-C project_directory] [-o out_directory] build\n"
+		"       %1$s [-j jobs] [-p install_prefix] [-D KEY=VAL] [-N] [-O] [-v] [-C project_directory] [-o out_directory] run [args ...]\n"
+		"       %1$s [-j jobs] [-p install_prefix] [-D KEY=VAL] [-N] [-O] [-v] [-C project_directory] [-o out_directory] sh [args ...]\n"
+		"       %1$s [-j jobs] [-p install_prefix] [-D KEY=VAL] [-N] [-O] [-v] [-C project_directory] [-o out_directory] pgo [args ...]\n"
+		"       %1$s [-j jobs] [-p install_prefix] [-D KEY=VAL] [-N] [-O] [-v] [-C project_directory] [-o out_directory] install\n"
+		"       %1$s [-j jobs] [-p install_prefix] [-D KEY=VAL] [-N] [-O] [-v] [-C project_directory] [-o out_directory] clean\n"
+		"       %1$s [-j jobs] [-p install_prefix] [-D KEY=VAL] [-N] [-O] [-v] [-C project_directory] [-o out_directory] gc\n"
+		"       %1$s spawn-bench [spawns [heap_mib]]\n",
 		// clang-format on
 		progname
 	);
@@ -82,90 +95,6 @@ void usage(void) {
 	exit(EXIT_FAILURE);
 }
 
-static int get_and_ensure_deps_path(void) {
-	deps_path = getenv("BOB_DEPS_PATH");
-
-	if (deps_path == NULL) {
-		char const* const home = getenv("HOME");
-
-		// XXX Don't worry about freeing these.
-
-		if (home != NULL) {
-			asprintf_c(&deps_path, "%s/%s", home, ".cache/bob/deps");
-		}
-
-		else {
-			asprintf_c(&deps_path, "%s/%s", abs_out_path, "deps");
-			LOG_WARN("$HOME is not set, using '%s' as the dependencies path as a last resort.", deps_path);
-		}
-	}
-
-	// Ensure it exists.
-
-	if (mkdir_recursive(deps_path, 0755) < 0) {
-		LOG_FATAL("mkdir_recursive(\"%s\"): %s", deps_path, strerror(errno));
-		return -1;
-	}
-
-	return 0;
-}
-
-static int clear_out_path_if_bob_update(void) {
-	char* STR_CLEANUP err = NULL;
-
-	char* STR_CLEANUP version_path = NULL;
-	asprintf_c(&version_path, "%s/version", abs_out_path);
-
-	FILE* const f = fopen(version_path, "r");
-
-	// If version file doesn't exist, clear cache.
-	// Don't log here, because it might just be the first time creating this directory.
-
-	if (f == NULL) {
-		goto clear;
-	}
-
-	// If stored version changed, clear cache.
-
-	char stored[64] = {0};
-	fread(stored, 1, sizeof stored - 1, f);
-	fclose(f);
-
-	if (strcmp(stored, BUILD_ID) != 0) {
-		LOG_INFO("Bob was updated, clearing output path.");
-		goto clear;
-	}
-
-	// Otherwise, just return now.
-
-	return 0;
-
-clear:
-
-	if (rm(abs_out_path, &err) < 0) {
-		LOG_FATAL("Failed to clear output path (\"%s\"): %s", abs_out_path, err);
-		return -1;
-	}
-
-	if (mkdir_recursive(abs_out_path, 0755) < 0) {
-		LOG_FATAL("mkdir_recursive(\"%s\"): %s", abs_out_path, strerror(errno));
-		return -1;
-	}
-
-	FILE* const new_version_f = fopen(version_path, "w");
-
-	if (new_version_f == NULL) {
-		LOG_FATAL("fopen(\"%s\"): %s", version_path, strerror(errno));
-		return -1;
-	}
-
-	fputs(BUILD_ID, new_version_f);
-	fclose(new_version_f);
-	set_owner(version_path);
-
-	return 0;
-}
-
 int main(int argc, char* argv[]) {
 	init_name = argv[0];
 	targetless_out_path = ".bob"; // Default output path.
@@ -176,7 +105,7 @@ int main(int argc, char* argv[]) {
 
 	int c;
 
-	while ((c = getopt(argc, argv, "C:D:fj:NOo:p:")) != -1) {
+	while ((c = getopt(argc, argv, "C:D:fj:NOo:p:R:v")) != -1) {
 		switch (c) {
 		case 'C':
 			project_path = optarg;
@@ -229,9 +158,15 @@ int main(int argc, char* argv[]) {
 		case 'p':
 			install_prefix = optarg;
 			break;
+		case 'R':
+			install_record = optarg;
+			break;
 		case 'f':
 			force_dep_tree_rebuild = true;
 			break;
+		case 'v':
+			verbose = true;
+			break;
 		default:
 			usage();
 		}
@@ -246,6 +181,70 @@ int main(int argc, char* argv[]) {
 		usage();
 	}
 
+	// This is intentionally undocumented, as it's only used by 'rm_background()' to remove stuff once we're gone.
+	// Handle it first, as it doesn't need a project, or the spawn server.
+
+	if (strcmp(argv[0], "rm-trash") == 0 && argc == 2) {
+		char* STR_CLEANUP err = NULL;
+		return rm(argv[1], &err) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	// Start the spawn server if asked to.
+	// This must be done now, while we're still small and haven't started any threads.
+
+	char const* const spawn_server_env = getenv("BOB_SPAWN_SERVER");
+
+	if (spawn_server_env != NULL && strcmp(spawn_server_env, "1") == 0 && spawn_server_init() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	// This measures whether the spawn server is worth it on a given system (see 'BOB_SPAWN_SERVER' in the README).
+	// It doesn't need a project, so handle it before looking for one.
+
+	if (strcmp(argv[0], "spawn-bench") == 0) {
+		return spawn_server_bench(argc - 1, argv + 1) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	// Figure out the PGO mode.
+	// This must be known before the build system is set up, as it changes the cookie space and the flags of 'Cc' and 'Linker' instances.
+	// Unset 'BOB_PGO' so that it doesn't leak into dependencies; we only want to profile the project itself.
+
+	bool const pgo_training = strcmp(argv[0], "pgo") == 0;
+	char const* const pgo_env = getenv("BOB_PGO");
+
+	if (pgo_training) {
+		pgo_mode = PGO_USE;
+	}
+
+	else if (pgo_env == NULL) {
+		pgo_mode = PGO_NONE;
+	}
+
+	else if (strcmp(pgo_env, "generate") == 0) {
+		pgo_mode = PGO_GENERATE;
+	}
+
+	else if (strcmp(pgo_env, "use") == 0) {
+		pgo_mode = PGO_USE;
+	}
+
+	else {
+		LOG_FATAL("Unknown PGO mode '%s' (expected 'generate' or 'use').", pgo_env);
+		return EXIT_FAILURE;
+	}
+
+	unsetenv("BOB_PGO");
+
+	// Are we allowed to hardlink files into the temporary installation prefix?
+
+	char const* const install_hardlinks_env = getenv("BOB_INSTALL_HARDLINKS");
+	install_hardlinks = install_hardlinks_env != NULL && strcmp(install_hardlinks_env, "1") == 0;
+
+	// Should Bob dependencies be built in this process?
+
+	char const* const deps_in_process_env = getenv("BOB_DEPS_IN_PROCESS");
+	deps_in_process = deps_in_process_env != NULL && strcmp(deps_in_process_env, "1") == 0;
+
 	// Are we in build debugging mode?
 
 	debugging = getenv("BOB_BUILD_DEBUGGING") != NULL;
@@ -311,127 +310,9 @@ int main(int argc, char* argv[]) {
 		return EXIT_FAILURE;
 	}
 
-	if (chdir(project_path) < 0) {
-		LOG_FATAL("chdir(\"%s\"): %s", project_path, strerror(errno));
-		return EXIT_FAILURE;
-	}
-
-	// Get the owner of the project directory.
-	// If running as root, we'll use this owner for the binary output directory.
-
-	if (getuid() == 0) {
-		struct stat sb;
-
-		if (stat(".", &sb) < 0) {
-			LOG_FATAL("stat(\"%s\"): %s", project_path, strerror(errno));
-			return EXIT_FAILURE;
-		}
-
-		running_as_root = true;
-		owner = sb.st_uid;
-	}
-
-	// Ensure the output path exists.
-
-	if (mkdir_wrapped(targetless_out_path, 0755) < 0 && errno != EEXIST) {
-		LOG_FATAL("mkdir(\"%s\"): %s", targetless_out_path, strerror(errno));
-		return EXIT_FAILURE;
-	}
-
-	// Get target and append to out path.
-
-	char* target = getenv("BOB_TARGET");
-
-	if (target == NULL) {
-		struct utsname u;
-
-		if (uname(&u) < 0) {
-			LOG_WARN("uname(): %s");
-			target = "unknown";
-		}
-
-		else {
-			asprintf_c(&target, "%s-%s", u.machine, u.sysname);
-		}
-	}
-
-	char* STR_CLEANUP out_path = NULL;
-	asprintf_c(&out_path, "%s/%s", targetless_out_path, target);
-
-	// Ensure the target path exists too.
-
-	if (mkdir_wrapped(out_path, 0755) < 0 && errno != EEXIST) {
-		LOG_FATAL("mkdir(\"%s\"): %s", out_path, strerror(errno));
-		return EXIT_FAILURE;
-	}
-
-	// Get absolute output path.
-
-	abs_out_path = realerpath(out_path);
-
-	if (abs_out_path == NULL) {
-		LOG_FATAL("realpath(\"%s\"): %s", out_path, strerror(errno));
-		return EXIT_FAILURE;
-	}
-
-	// Clear output directory if the Bob build ID changed.
-	// Has to be done before we ensure the temporary installation prefix exists, or we might remove it and it won't be recreated.
+	bsys_t const* bsys;
 
-	if (clear_out_path_if_bob_update() < 0) {
-		return EXIT_FAILURE;
-	}
-
-	// Get default final and temporary install prefixes.
-
-	default_final_install_prefix = "/usr/local";
-	asprintf_c(&default_tmp_install_prefix, "%s/prefix", abs_out_path);
-
-	// Ensure all installation prefixes (explicitly set, final, and temporary) exist.
-
-	char const* const prefixes[] = {
-		install_prefix,
-		default_final_install_prefix,
-		default_tmp_install_prefix
-	};
-
-	for (size_t i = 0; i < sizeof prefixes / sizeof *prefixes; i++) {
-		char const* const prefix = prefixes[i];
-
-		if (prefix == NULL) {
-			continue;
-		}
-
-		if (mkdir_recursive(prefix, 0755) < 0 && errno != EEXIST) {
-			LOG_FATAL("mkdir(\"%s\"): %s", prefix, strerror(errno));
-			return EXIT_FAILURE;
-		}
-	}
-
-	// Get the dependencies path and ensure it exists.
-
-	if (get_and_ensure_deps_path() < 0) {
-		return EXIT_FAILURE;
-	}
-
-	// Identify the build system.
-
-	bsys_t const* const bsys = bsys_identify();
-
-	if (bsys == NULL) {
-		LOG_FATAL("Could not identify build system.");
-		return EXIT_FAILURE;
-	}
-
-	if (bsys->key != NULL) {
-		// XXX We don't use the absolute path here, because this would mean that some hashes for cookies generated for paths containing 'bsys_out_path' would break when we move the current directory (and makes testing for different platforms annoying).
-		asprintf_c(&bsys_out_path, "%s/%s", out_path, bsys->key);
-	}
-
-	if (dep_config_count > 0 && !bsys->supports_config) {
-		LOG_WARN("%s build system does not support config options; -D flags will be ignored.", bsys->name);
-	}
-
-	if (bsys->setup && bsys->setup() < 0) {
+	if (project_open(project_path, pgo_training, &bsys) < 0) {
 		return EXIT_FAILURE;
 	}
 
@@ -469,6 +350,12 @@ int main(int argc, char* argv[]) {
 		}
 	}
 
+	else if (strcmp(instr, "pgo") == 0) {
+		if (pgo_train(bsys, argc, argv) == 0 && bsys_build(bsys) == 0) {
+			rv = EXIT_SUCCESS;
+		}
+	}
+
 	else if (strcmp(instr, "install") == 0) {
 		if (argc != 0) {
 			LOG_FATAL("Extraneous arguments to '%s'.", instr);
@@ -491,6 +378,17 @@ int main(int argc, char* argv[]) {
 		}
 	}
 
+	else if (strcmp(instr, "gc") == 0) {
+		if (argc != 0) {
+			LOG_FATAL("Extraneous arguments to '%s'.", instr);
+			usage();
+		}
+
+		if (bsys_gc(bsys) == 0) {
+			rv = EXIT_SUCCESS;
+		}
+	}
+
 	// This is intentionally undocumented, as it's really only used for communication between Bob parent processes and their Bob children processes.
 
 	else if (strcmp(instr, "dep-tree") == 0) {
@@ -0,0 +1,466 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2026 Aymeric Wibo
+
+#include <common.h>
+
+#include <alloc.h>
+#include <fsutil.h>
+#include <install.h>
+#include <logging.h>
+#include <manifest.h>
+#include <path_table.h>
+#include <str.h>
+
+#include <assert.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MANIFESTS "manifests"
+#define DEFAULT_KEEP 5
+
+static pthread_mutex_t cookies_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t cookie_count = 0;
+static char** cookies = NULL; // Relative to 'bsys_out_path'.
+
+void manifest_add(char const* cookie) {
+	size_t const prefix_len = strlen(bsys_out_path) + strlen("/");
+	assert(strncmp(cookie, bsys_out_path, prefix_len - 1) == 0 && cookie[prefix_len - 1] == '/');
+
+	pthread_mutex_lock(&cookies_lock);
+
+	cookies = realloc_c(cookies, (cookie_count + 1) * sizeof *cookies);
+	cookies[cookie_count++] = strdup_c(cookie + prefix_len);
+
+	pthread_mutex_unlock(&cookies_lock);
+}
+
+static size_t get_keep(void) {
+	char const* const env = getenv("BOB_GC_KEEP");
+
+	if (env == NULL) {
+		return DEFAULT_KEEP;
+	}
+
+	char* end;
+	long const keep = strtol(env, &end, 10);
+
+	if (*env == '\0' || *end != '\0' || keep < 1) {
+		LOG_WARN("Invalid value for BOB_GC_KEEP ('%s'), keeping the last %d manifests.", env, DEFAULT_KEEP);
+		return DEFAULT_KEEP;
+	}
+
+	return keep;
+}
+
+// Builds in quick succession can fall within the same second, so manifests are ordered by their full-resolution mtimes.
+
+#if defined(__APPLE__)
+# define ST_MTIM st_mtimespec
+#else
+# define ST_MTIM st_mtim
+#endif
+
+typedef struct {
+	char* path;
+	struct timespec mtime;
+} manifest_t;
+
+static int cmp_manifests(void const* a, void const* b) {
+	manifest_t const* const x = a;
+	manifest_t const* const y = b;
+
+	// Most recent first.
+
+	if (x->mtime.tv_sec != y->mtime.tv_sec) {
+		return (x->mtime.tv_sec < y->mtime.tv_sec) - (x->mtime.tv_sec > y->mtime.tv_sec);
+	}
+
+	return (x->mtime.tv_nsec < y->mtime.tv_nsec) - (x->mtime.tv_nsec > y->mtime.tv_nsec);
+}
+
+// Get the manifests to keep, most recent first, removing the others.
+
+static manifest_t* kept_manifests(char const* dir, size_t* count) {
+	*count = 0;
+	manifest_t* manifests = NULL;
+
+	DIR* const dp = opendir(dir);
+
+	if (dp == NULL) {
+		return NULL;
+	}
+
+	struct dirent* entry;
+
+	while ((entry = readdir(dp)) != NULL) {
+		if (entry->d_name[0] == '.') {
+			continue;
+		}
+
+		char* path = NULL;
+		asprintf_c(&path, "%s/%s", dir, entry->d_name);
+
+		struct stat sb;
+
+		if (stat(path, &sb) < 0 || !S_ISREG(sb.st_mode)) {
+			free(path);
+			continue;
+		}
+
+		manifests = realloc_c(manifests, (*count + 1) * sizeof *manifests);
+		manifests[(*count)++] = (manifest_t) {.path = path, .mtime = sb.ST_MTIM};
+	}
+
+	closedir(dp);
+
+	qsort(manifests, *count, sizeof *manifests, cmp_manifests);
+	size_t const keep = get_keep();
+
+	for (size_t i = keep; i < *count; i++) {
+		if (remove(manifests[i].path) < 0) {
+			LOG_WARN("remove(\"%s\"): %s", manifests[i].path, strerror(errno));
+		}
+
+		free(manifests[i].path);
+	}
+
+	if (*count > keep) {
+		*count = keep;
+	}
+
+	return manifests;
+}
+
+static void free_manifests(manifest_t* manifests, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		free(manifests[i].path);
+	}
+
+	free(manifests);
+}
+
+int manifest_write(void) {
+	char* STR_CLEANUP dir = NULL;
+	asprintf_c(&dir, "%s/" MANIFESTS, bsys_out_path);
+
+	if (mkdir_wrapped(dir, 0755) < 0 && errno != EEXIST) {
+		LOG_FATAL("mkdir(\"%s\"): %s", dir, strerror(errno));
+		return -1;
+	}
+
+	// Manifests are named after the hash of their contents, so rebuilding the same thing just bumps the existing manifest's mtime.
+
+	size_t len = 0;
+
+	for (size_t i = 0; i < cookie_count; i++) {
+		len += strlen(cookies[i]) + 1;
+	}
+
+	char* STR_CLEANUP contents = malloc_c(len + 1);
+	contents[0] = '\0';
+
+	for (size_t i = 0, off = 0; i < cookie_count; i++) {
+		off += sprintf(contents + off, "%s\n", cookies[i]);
+	}
+
+	char* STR_CLEANUP path = NULL;
+	asprintf_c(&path, "%s/%016" PRIx64, dir, strnhash(contents, len));
+
+	if (access(path, F_OK) == 0) {
+		if (utimensat(AT_FDCWD, path, NULL, 0) < 0) {
+			LOG_WARN("utimensat(\"%s\"): %s", path, strerror(errno));
+		}
+	}
+
+	else {
+		FILE* const f = fopen(path, "w");
+
+		if (f == NULL) {
+			LOG_FATAL("fopen(\"%s\"): %s", path, strerror(errno));
+			return -1;
+		}
+
+		fwrite(contents, 1, len, f);
+		set_owner_fd(fileno(f), path);
+		fclose(f);
+	}
+
+	size_t count;
+	manifest_t* const manifests = kept_manifests(dir, &count);
+	free_manifests(manifests, count);
+
+	return 0;
+}
+
+static int add_manifest(path_table_t* referenced, char const* path) {
+	FILE* const f = fopen(path, "r");
+
+	if (f == NULL) {
+		LOG_FATAL("fopen(\"%s\"): %s", path, strerror(errno));
+		return -1;
+	}
+
+	char* line = NULL;
+	size_t cap = 0;
+	ssize_t len;
+
+	while ((len = getline(&line, &cap, f)) > 0) {
+		if (line[len - 1] == '\n') {
+			len--;
+		}
+
+		path_table_add(referenced, line, len, NULL);
+	}
+
+	free(line);
+	fclose(f);
+
+	return 0;
+}
+
+// Get the length of the cookie a file in the output path belongs to, i.e. strip the extensions of its siblings (".flags", ".deps", ".log", &c).
+// Returns 0 if the file isn't a cookie or the sibling of one.
+
+static size_t cookie_len(char const* name) {
+	char const* hash = NULL;
+
+	for (char const* p = name; (p = strstr(p, ".cookie.")) != NULL; p++) {
+		hash = p + strlen(".cookie.");
+	}
+
+	if (hash == NULL) {
+		return 0;
+	}
+
+	char const* p = hash;
+
+	while (isxdigit((unsigned char) *p)) {
+		p++;
+	}
+
+	if (p == hash || p[0] != '.' || p[1] == '\0' || p[1] == '.') {
+		return 0;
+	}
+
+	p++;
+	p += strcspn(p, ".");
+
+	return p - name;
+}
+
+typedef struct {
+	path_table_t* referenced;
+	size_t removed;
+	off_t freed;
+} gc_state_t;
+
+static bool is_shard(char const* name) {
+	return isxdigit((unsigned char) name[0]) && name[1] == '\0';
+}
+
+// Walk the output path and its shards, removing unreferenced cookies.
+// 'rel' is the path of the directory relative to 'bsys_out_path', and 'depth' is the number of shard levels left to go into.
+
+static void gc_dir(gc_state_t* state, char const* rel, unsigned depth) {
+	char* STR_CLEANUP dir = NULL;
+	asprintf_c(&dir, "%s%s", bsys_out_path, rel);
+
+	DIR* const dp = opendir(dir);
+
+	if (dp == NULL) {
+		LOG_WARN("opendir(\"%s\"): %s", dir, strerror(errno));
+		return;
+	}
+
+	int const dir_fd = dirfd(dp);
+	struct dirent* entry;
+
+	while ((entry = readdir(dp)) != NULL) {
+		char const* const name = entry->d_name;
+		struct stat sb;
+
+		if (name[0] == '.' || fstatat(dir_fd, name, &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+			continue;
+		}
+
+		if (S_ISDIR(sb.st_mode)) {
+			if (depth > 0 && is_shard(name)) {
+				char* STR_CLEANUP sub = NULL;
+				asprintf_c(&sub, "%s/%s", rel, name);
+				gc_dir(state, sub, depth - 1);
+			}
+
+			continue;
+		}
+
+		size_t const len = cookie_len(name);
+
+		if (len == 0) {
+			continue;
+		}
+
+		// Manifests store cookies relative to the output path, so strip the leading slash.
+
+		char* STR_CLEANUP key = NULL;
+		asprintf_c(&key, "%s/%.*s", rel, (int) len, name);
+
+		if (path_table_get(state->referenced, key + 1, strlen(key + 1), NULL)) {
+			continue;
+		}
+
+		if (unlinkat(dir_fd, name, 0) < 0) {
+			LOG_WARN("unlink(\"%s/%s\"): %s", dir, name, strerror(errno));
+			continue;
+		}
+
+		state->removed++;
+		state->freed += sb.st_size;
+	}
+
+	closedir(dp);
+}
+
+int manifest_lock(bool exclusive) {
+	// The lock file is next to the output path rather than in it, like the one taken when opening the project, so that it doesn't go away if the output path is cleared.
+
+	char* STR_CLEANUP path = NULL;
+	asprintf_c(&path, "%s.gc.lock", abs_out_path);
+
+	int const fd = open(path, O_RDONLY | O_CREAT | O_CLOEXEC, 0644);
+
+	if (fd < 0) {
+		LOG_WARN("open(\"%s\"): %s", path, strerror(errno));
+		return -1;
+	}
+
+	set_owner_fd(fd, path);
+	int const op = exclusive ? LOCK_EX : LOCK_SH;
+
+	if (flock(fd, op | LOCK_NB) == 0) {
+		return fd;
+	}
+
+	if (errno == EWOULDBLOCK) {
+		LOG_INFO("Waiting for %s of this project to finish...", exclusive ? "builds" : "garbage collection");
+
+		if (flock(fd, op) == 0) {
+			return fd;
+		}
+	}
+
+	LOG_WARN("flock(\"%s\"): %s", path, strerror(errno));
+	close(fd);
+
+	return -1;
+}
+
+int manifest_gc(void) {
+	int rv = -1;
+	path_table_t referenced = PATH_TABLE_INIT;
+	int const lock_fd = manifest_lock(true);
+
+	// Cookies referenced by the current build script are never collected, even if it hasn't been built yet.
+
+	for (size_t i = 0; i < cookie_count; i++) {
+		path_table_add(&referenced, cookies[i], strlen(cookies[i]), NULL);
+	}
+
+	char* STR_CLEANUP dir = NULL;
+	asprintf_c(&dir, "%s/" MANIFESTS, bsys_out_path);
+
+	size_t count;
+	manifest_t* const manifests = kept_manifests(dir, &count);
+
+	for (size_t i = 0; i < count; i++) {
+		if (add_manifest(&referenced, manifests[i].path) < 0) {
+			goto err;
+		}
+	}
+
+	gc_state_t state = {
+		.referenced = &referenced,
+	};
+
+	// Cookies are either directly in the output path (linker cookies) or in one of its two levels of shards.
+
+	gc_dir(&state, "", 2);
+	install_gc_compared(&state.removed, &state.freed);
+
+	if (state.removed == 0) {
+		LOG_SUCCESS("Nothing to collect (%zu build manifest%s kept).", count, count == 1 ? "" : "s");
+	}
+
+	else {
+		LOG_SUCCESS("Removed %zu orphaned file%s, freeing %.1f MiB (%zu build manifest%s kept).", state.removed, state.removed == 1 ? "" : "s", state.freed / 1024. / 1024., count, count == 1 ? "" : "s");
+	}
+
+	rv = 0;
+
+err:
+
+	free_manifests(manifests, count);
+	path_table_clear(&referenced);
+
+	if (lock_fd >= 0) {
+		close(lock_fd);
+	}
+
+	return rv;
+}
+
+typedef struct {
+	size_t cookie_count;
+	char** cookies;
+} suspended_t;
+
+static void free_cookies(void) {
+	for (size_t i = 0; i < cookie_count; i++) {
+		free(cookies[i]);
+	}
+
+	free(cookies);
+
+	cookie_count = 0;
+	cookies = NULL;
+}
+
+void* manifest_suspend(void) {
+	suspended_t* const state = malloc_c(sizeof *state);
+
+	pthread_mutex_lock(&cookies_lock);
+
+	state->cookie_count = cookie_count;
+	state->cookies = cookies;
+
+	cookie_count = 0;
+	cookies = NULL;
+
+	pthread_mutex_unlock(&cookies_lock);
+
+	return state;
+}
+
+void manifest_resume(void* state) {
+	suspended_t* const suspended = state;
+
+	pthread_mutex_lock(&cookies_lock);
+
+	free_cookies();
+
+	cookie_count = suspended->cookie_count;
+	cookies = suspended->cookies;
+
+	pthread_mutex_unlock(&cookies_lock);
+
+	free(suspended);
+}
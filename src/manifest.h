@@ -0,0 +1,66 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2026 Aymeric Wibo
+
+/*
+ * Build manifests and garbage collection of cookies.
+ *
+ * Every successful build records the cookies its build script referenced in a manifest, under '.bob/<target>/bob/manifests'.
+ * Identical builds share the same manifest, so the manifests which are kept around correspond to the last few distinct sets of sources which were built ('BOB_GC_KEEP', 5 by default).
+ *
+ * When sources are removed or renamed, their cookies (and their logs, flags, and dependency files) would otherwise stay around forever.
+ * 'bob gc' removes all of those which aren't referenced by any of the kept manifests or by the current build script.
+ */
+
+#pragma once
+
+/**
+ * Record that a cookie is referenced by the current build.
+ *
+ * This function is thread-safe.
+ *
+ * @param cookie Cookie path, which must be in 'bsys_out_path'.
+ */
+void manifest_add(char const* cookie);
+
+/**
+ * Write out the manifest of the current build, and prune old manifests.
+ *
+ * This should be called once a build has succeeded.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int manifest_write(void);
+
+/**
+ * Lock the output path against garbage collection for the duration of a build, or against builds for the duration of garbage collection.
+ *
+ * Builds take a shared lock, so that they can still run alongside each other, and {@link manifest_gc} takes an exclusive one, so that it doesn't remove cookies a build has just created or is about to reuse.
+ * Failing to lock is only warned about.
+ *
+ * @param exclusive Whether to take an exclusive lock rather than a shared one.
+ * @return File descriptor holding the lock, to close once done, or -1 if the lock couldn't be taken.
+ */
+int manifest_lock(bool exclusive);
+
+/**
+ * Remove cookies which aren't referenced by any kept manifest or by the current build.
+ *
+ * This waits for builds of the same project to finish first (see {@link manifest_lock}).
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int manifest_gc(void);
+
+/**
+ * Set aside the cookies recorded for the current build, so that another project can be built in the same process.
+ *
+ * @return Opaque state to pass to {@link manifest_resume}.
+ */
+void* manifest_suspend(void);
+
+/**
+ * Restore the cookies set aside by {@link manifest_suspend}, discarding those recorded in the meantime.
+ *
+ * @param state State returned by {@link manifest_suspend}.
+ */
+void manifest_resume(void* state);
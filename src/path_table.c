@@ -0,0 +1,166 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2026 Aymeric Wibo
+
+#include <common.h>
+
+#include <alloc.h>
+#include <path_table.h>
+#include <str.h>
+
+#include <stdint.h>
+#include <string.h>
+
+typedef struct {
+	uint64_t hash;
+	void* val;
+	size_t len;
+	char path[];
+} path_entry_t;
+
+// Bucket arrays are never freed while the table is alive, as a lookup might still be running on an old one after the table has grown.
+// They're kept in a list through 'prev' so they can be freed when clearing the table.
+
+struct path_buckets_t {
+	path_buckets_t* prev;
+	size_t mask;
+	_Atomic(path_entry_t*) slots[];
+};
+
+#define MIN_CAP 64
+
+static uint64_t hash_path(char const* path, size_t len) {
+	// djb2 doesn't mix its low bits very well, and those are the ones we use to index buckets.
+
+	uint64_t hash = strnhash(path, len);
+
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+
+	return hash;
+}
+
+static path_entry_t* find(path_buckets_t* buckets, uint64_t hash, char const* path, size_t len) {
+	if (buckets == NULL) {
+		return NULL;
+	}
+
+	for (size_t i = hash & buckets->mask;; i = (i + 1) & buckets->mask) {
+		path_entry_t* const entry = atomic_load_explicit(&buckets->slots[i], memory_order_acquire);
+
+		if (entry == NULL) {
+			return NULL;
+		}
+
+		if (entry->hash == hash && entry->len == len && memcmp(entry->path, path, len) == 0) {
+			return entry;
+		}
+	}
+}
+
+static void insert(path_buckets_t* buckets, path_entry_t* entry) {
+	size_t i = entry->hash & buckets->mask;
+
+	while (atomic_load_explicit(&buckets->slots[i], memory_order_relaxed) != NULL) {
+		i = (i + 1) & buckets->mask;
+	}
+
+	// Release so that lookups which see the entry also see its contents.
+
+	atomic_store_explicit(&buckets->slots[i], entry, memory_order_release);
+}
+
+static path_buckets_t* grow(path_buckets_t* old) {
+	size_t const cap = old == NULL ? MIN_CAP : (old->mask + 1) * 2;
+
+	path_buckets_t* const buckets = calloc_c(1, sizeof *buckets + cap * sizeof *buckets->slots);
+	buckets->prev = old;
+	buckets->mask = cap - 1;
+
+	if (old == NULL) {
+		return buckets;
+	}
+
+	for (size_t i = 0; i <= old->mask; i++) {
+		path_entry_t* const entry = atomic_load_explicit(&old->slots[i], memory_order_relaxed);
+
+		if (entry != NULL) {
+			insert(buckets, entry);
+		}
+	}
+
+	return buckets;
+}
+
+bool path_table_add(path_table_t* table, char const* path, size_t len, void* val) {
+	uint64_t const hash = hash_path(path, len);
+	bool rv = false;
+
+	pthread_mutex_lock(&table->lock);
+	path_buckets_t* buckets = atomic_load_explicit(&table->buckets, memory_order_relaxed);
+
+	if (find(buckets, hash, path, len) != NULL) {
+		goto done;
+	}
+
+	// Keep the load factor under 3/4 so probe sequences stay short (and so there's always an empty slot to stop lookups).
+
+	if (buckets == NULL || (table->count + 1) * 4 > (buckets->mask + 1) * 3) {
+		buckets = grow(buckets);
+		atomic_store_explicit(&table->buckets, buckets, memory_order_release);
+	}
+
+	path_entry_t* const entry = malloc_c(sizeof *entry + len + 1);
+
+	entry->hash = hash;
+	entry->val = val;
+	entry->len = len;
+
+	memcpy(entry->path, path, len);
+	entry->path[len] = '\0';
+
+	insert(buckets, entry);
+	table->count++;
+	rv = true;
+
+done:
+
+	pthread_mutex_unlock(&table->lock);
+	return rv;
+}
+
+bool path_table_get(path_table_t* table, char const* path, size_t len, void** val) {
+	path_buckets_t* const buckets = atomic_load_explicit(&table->buckets, memory_order_acquire);
+	path_entry_t* const entry = find(buckets, hash_path(path, len), path, len);
+
+	if (entry == NULL) {
+		return false;
+	}
+
+	if (val != NULL) {
+		*val = entry->val;
+	}
+
+	return true;
+}
+
+void path_table_clear(path_table_t* table) {
+	path_buckets_t* buckets = atomic_load_explicit(&table->buckets, memory_order_relaxed);
+
+	// Entries are shared between all bucket arrays, so only free them from the latest one.
+
+	if (buckets != NULL) {
+		for (size_t i = 0; i <= buckets->mask; i++) {
+			free(atomic_load_explicit(&buckets->slots[i], memory_order_relaxed));
+		}
+	}
+
+	while (buckets != NULL) {
+		path_buckets_t* const prev = buckets->prev;
+		free(buckets);
+		buckets = prev;
+	}
+
+	atomic_store_explicit(&table->buckets, NULL, memory_order_relaxed);
+	table->count = 0;
+}
@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2026 Aymeric Wibo
+
+/*
+ * Interned path table.
+ *
+ * This is a hash table of paths (e.g. cookies) to arbitrary values, used where Bob would otherwise linearly scan a list of paths for every file it builds.
+ * Entries can only be added, never removed or changed, which is what allows lookups to be lock-free: adding an entry takes a lock, but looking one up never does.
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+typedef struct path_buckets_t path_buckets_t;
+
+typedef struct {
+	pthread_mutex_t lock;
+	_Atomic(path_buckets_t*) buckets;
+	size_t count;
+} path_table_t;
+
+#define PATH_TABLE_INIT {.lock = PTHREAD_MUTEX_INITIALIZER}
+
+/**
+ * Add a path to the table.
+ *
+ * This function is thread-safe.
+ *
+ * @param table The table.
+ * @param path Path to add (not necessarily NUL-terminated; 'len' bytes are used).
+ * @param len Length of 'path'.
+ * @param val Value to associate with the path.
+ * @return True if the path was added, false if it was already in the table (in which case its value is left untouched).
+ */
+bool path_table_add(path_table_t* table, char const* path, size_t len, void* val);
+
+/**
+ * Look up a path in the table.
+ *
+ * This function is thread-safe and lock-free.
+ * A lookup racing with an add of the same path may or may not see it.
+ *
+ * @param table The table.
+ * @param path Path to look up (not necessarily NUL-terminated; 'len' bytes are compared).
+ * @param len Length of 'path'.
+ * @param val Set to the value associated with the path if found. May be NULL.
+ * @return True if the path is in the table, false otherwise.
+ */
+bool path_table_get(path_table_t* table, char const* path, size_t len, void** val);
+
+/**
+ * Free all entries in the table, leaving it empty.
+ *
+ * This function is not thread-safe; nothing else may be using the table at the same time.
+ *
+ * @param table The table.
+ */
+void path_table_clear(path_table_t* table);
@@ -0,0 +1,119 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2026 Aymeric Wibo
+
+#include <common.h>
+
+#include <alloc.h>
+#include <bsys.h>
+#include <cmd.h>
+#include <fsutil.h>
+#include <logging.h>
+#include <ncpu.h>
+#include <pgo.h>
+#include <str.h>
+#include <toolchain.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+char* pgo_raw_path = NULL;
+char* pgo_profile_path = NULL;
+
+int pgo_init(bool training) {
+	// XXX Don't worry about freeing these.
+
+	asprintf_c(&pgo_raw_path, "%s/pgo/raw", abs_out_path);
+	asprintf_c(&pgo_profile_path, "%s/pgo/profile", abs_out_path);
+
+	if (pgo_mode != PGO_USE || training) {
+		return 0;
+	}
+
+	if (access(pgo_profile_path, F_OK) < 0) {
+		LOG_FATAL("No PGO profiles found in '%s'. Run 'bob pgo' first to train the project.", pgo_profile_path);
+		return -1;
+	}
+
+	return 0;
+}
+
+int pgo_train(bsys_t const* bsys, int argc, char* argv[]) {
+	char* STR_CLEANUP err = NULL;
+
+	// Only the Bob build system knows how to instrument its outputs.
+
+	if (bsys != &BSYS_BOB) {
+		LOG_FATAL("%s build system does not support PGO.", bsys->name);
+		return -1;
+	}
+
+	// Start from a clean slate, so that profiles from outdated instrumented binaries don't end up in the merged profiles.
+
+	if (rm(pgo_raw_path, &err) < 0) {
+		LOG_FATAL("Failed to clear raw PGO profiles (\"%s\"): %s", pgo_raw_path, err);
+		return -1;
+	}
+
+	if (mkdir_recursive(pgo_raw_path, 0755) < 0) {
+		LOG_FATAL("mkdir_recursive(\"%s\"): %s", pgo_raw_path, strerror(errno));
+		return -1;
+	}
+
+	// Build and run the instrumented project in a child process.
+	// It needs to be a separate process because the build script has to be evaluated again in the instrumented cookie space.
+	// The 'run' instruction ends up replacing the child with the training command, so we only need to wait for it.
+
+	cmd_t CMD_CLEANUP cmd = {0};
+	cmd_create(&cmd, init_name, "-o", targetless_out_path, NULL);
+
+	if (max_jobs > 0) {
+		cmd_add(&cmd, "-j");
+		cmd_addf(&cmd, "%zu", max_jobs);
+	}
+
+	for (size_t i = 0; i < dep_config_count; i++) {
+		cmd_add(&cmd, "-D");
+		cmd_addf(&cmd, "%s=%s", dep_config_keys[i], dep_config_vals[i]);
+	}
+
+	if (!build_deps) {
+		cmd_add(&cmd, "-N");
+	}
+
+	if (force_dep_tree_rebuild) {
+		cmd_add(&cmd, "-f");
+	}
+
+	if (verbose) {
+		cmd_add(&cmd, "-v");
+	}
+
+	cmd_add(&cmd, "run");
+	cmd_add_argv(&cmd, argc, argv);
+
+	// The child must see the training output as it happens.
+
+	cmd_set_redirect(&cmd, CMD_NO_REDIRECT, CMD_NO_FORCE_REDIRECT);
+
+	LOG_INFO("Training instrumented build...");
+	setenv("BOB_PGO", "generate", true);
+
+	int const rv = cmd_exec(&cmd);
+	unsetenv("BOB_PGO");
+
+	if (rv < 0) {
+		LOG_FATAL("Failed to train instrumented build.");
+		return -1;
+	}
+
+	// Merge the raw profiles.
+
+	if (toolchain_pgo_merge() < 0) {
+		return -1;
+	}
+
+	LOG_SUCCESS("Trained and merged PGO profiles.");
+	return 0;
+}
@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2026 Aymeric Wibo
+
+/*
+ * Profile-guided optimization.
+ *
+ * 'bob pgo' builds an instrumented version of the project in a separate cookie space and prefix, runs it (through 'bob run', or the 'pgo_train' vector if set) to collect profiles, merges them, and then builds the project optimized with those profiles.
+ * 'BOB_PGO=use' can then be used with any other instruction to reuse the last merged profiles without retraining.
+ */
+
+#pragma once
+
+#include <bsys.h>
+
+typedef enum {
+	PGO_NONE = 0,
+	PGO_GENERATE,
+	PGO_USE,
+} pgo_t;
+
+/**
+ * Current PGO mode.
+ *
+ * This is set from the 'BOB_PGO' envvar ("generate" or "use"), or to {@link PGO_USE} with the 'pgo' instruction.
+ */
+extern pgo_t pgo_mode;
+
+/**
+ * Where instrumented binaries write their raw profiles.
+ *
+ * Set to '.bob/$TARGET/pgo/raw/' (depending on the value of {@link abs_out_path}).
+ */
+extern char* pgo_raw_path;
+
+/**
+ * Where merged profiles are kept.
+ *
+ * Set to '.bob/$TARGET/pgo/profile/' (depending on the value of {@link abs_out_path}).
+ */
+extern char* pgo_profile_path;
+
+/**
+ * Set up PGO paths and check everything is in order for the current PGO mode.
+ *
+ * Must be called once {@link abs_out_path} is known.
+ *
+ * @param training Whether we're going to train (i.e. the 'pgo' instruction), in which case it's fine for there not to be any profiles yet.
+ * @return 0 on success, -1 on failure.
+ */
+int pgo_init(bool training);
+
+/**
+ * Train the project and merge the resulting profiles.
+ *
+ * This spawns a child Bob process in {@link PGO_GENERATE} mode to build and run the instrumented project.
+ *
+ * @param bsys Build system of the project.
+ * @param argc Number of arguments to pass to the training command.
+ * @param argv Arguments to pass to the training command.
+ * @return 0 on success, -1 on failure.
+ */
+int pgo_train(bsys_t const* bsys, int argc, char* argv[]);
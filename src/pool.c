@@ -1,75 +1,142 @@
 // SPDX-License-Identifier: MIT
-// Copyright (c) 2024 Aymeric Wibo
+// Copyright (c) 2024-2026 Aymeric Wibo
 
 #include <alloc.h>
 #include <pool.h>
 
 #include <stdlib.h>
+#include <unistd.h>
 
-static void* businessman(void* data) {
-	pool_t* const pool = data;
+static task_t* next_task(pool_t* pool) {
+	task_t* found = NULL;
 
-	while (!pool->error) {
-		// We must lock on task iteration to prevent race conditions.
+	while (pool->first_unstarted < pool->task_count && pool->tasks[pool->first_unstarted].started) {
+		pool->first_unstarted++;
+	}
 
-		pthread_mutex_lock(&pool->lock);
-		task_t* task = NULL;
+	for (size_t i = pool->first_unstarted; i < pool->task_count; i++) {
+		task_t* const task = &pool->tasks[i];
+
+		if (task->started) {
+			continue;
+		}
 
-		for (size_t i = 0; i < pool->task_count; i++) {
-			task = &pool->tasks[i];
+		// Continuations come first, as they're finishing work which already holds a slot.
 
-			if (!task->started) {
-				goto found;
+		if (task->continuation) {
+			pool->pending_continuations--;
+			return task;
+		}
+
+		if (found == NULL) {
+			found = task;
+
+			// No need to look any further if there are no continuations to find.
+
+			if (pool->pending_continuations == 0) {
+				break;
 			}
 		}
+	}
 
-		// No more tasks left to run!
+	if (pool->error || pool->in_flight >= pool->slots) {
+		return NULL;
+	}
 
-		pthread_mutex_unlock(&pool->lock);
-		break;
+	return found;
+}
+
+static void* businessman(void* data) {
+	pool_t* const pool = data;
+
+	// We must lock on task iteration to prevent race conditions.
+
+	pthread_mutex_lock(&pool->lock);
 
-found:
+	for (;;) {
+		task_t* const task = next_task(pool);
+
+		if (task == NULL) {
+			// No more tasks left to run!
+			// Unless some are still in progress, in which case they might resume or free up a slot.
+
+			if (pool->in_flight == 0) {
+				break;
+			}
+
+			pthread_cond_wait(&pool->cond, &pool->lock);
+			continue;
+		}
 
 		// Run found task.
 		// Get the stuff inside of the task pointer because it may move due to a realloc once we release the lock.
 
 		task->started = true;
 
+		if (!task->continuation) {
+			pool->in_flight++;
+		}
+
 		task_fn_t const fn = task->fn;
 		void* const data = task->data;
 
 		pthread_mutex_unlock(&pool->lock);
+		bool const stop = fn(data);
+		pthread_mutex_lock(&pool->lock);
 
-		if (!fn(data)) {
-			continue;
-		}
+		// If the task was deferred, 'pool_defer()' took another hold on its slot.
 
-		// We were asked to stop; cancel all businessmen.
+		pool->in_flight--;
+
+		// If we were asked to stop, make all businessmen stop.
 		// We can't cancel them directly because they might still hold the logging lock, and locking a mutex is not a cancellation point.
 		// Instead, rely on each businessman to stop when 'pool->error' is set.
 
-		pool->error = true;
+		if (stop) {
+			pool->error = true;
+		}
+
+		pthread_cond_broadcast(&pool->cond);
 	}
 
+	pthread_mutex_unlock(&pool->lock);
 	return NULL;
 }
 
 void pool_init(pool_t* pool, size_t businessman_count) {
 	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond, NULL);
 	pthread_mutex_lock(&pool->lock);
 
 	pool->error = false;
 	pool->started = false;
 
+	pool->slots = businessman_count;
+	pool->in_flight = 0;
+
 	pool->businessman_count = businessman_count;
 	pool->businessmen = malloc_c(businessman_count * sizeof(pthread_t));
 
 	pool->task_count = 0;
 	pool->tasks = NULL;
 
+	pool->first_unstarted = 0;
+	pool->pending_continuations = 0;
+
 	pthread_mutex_unlock(&pool->lock);
 }
 
+void pool_init_async(pool_t* pool, size_t slots) {
+	ssize_t online = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (online < 1 || (size_t) online > slots) {
+		online = slots;
+	}
+
+	pool_init(pool, online);
+	pool->slots = slots;
+}
+
 void pool_free(pool_t* pool) {
 	pool->error = true; // Make sure we end as quickly as possible.
 	pool_wait(pool);
@@ -79,21 +146,43 @@ void pool_free(pool_t* pool) {
 	if (pool->tasks != NULL) {
 		free(pool->tasks);
 	}
+
+	pthread_cond_destroy(&pool->cond);
 }
 
-void pool_add_task(pool_t* pool, task_fn_t cb, void* data) {
+static void push_task(pool_t* pool, task_fn_t cb, void* data, bool continuation) {
 	pthread_mutex_lock(&pool->lock);
 
 	pool->tasks = realloc_c(pool->tasks, (pool->task_count + 1) * sizeof *pool->tasks);
 	task_t* const task = &pool->tasks[pool->task_count++];
 
 	task->started = false;
+	task->continuation = continuation;
 	task->fn = cb;
 	task->data = data;
 
+	if (continuation) {
+		pool->pending_continuations++;
+	}
+
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_add_task(pool_t* pool, task_fn_t cb, void* data) {
+	push_task(pool, cb, data, false);
+}
+
+void pool_defer(pool_t* pool) {
+	pthread_mutex_lock(&pool->lock);
+	pool->in_flight++;
 	pthread_mutex_unlock(&pool->lock);
 }
 
+void pool_resume(pool_t* pool, task_fn_t cb, void* data) {
+	push_task(pool, cb, data, true);
+}
+
 int pool_start(pool_t* pool) {
 	if (pool->started == true) {
 		return 0;
@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: MIT
-// Copyright (c) 2024 Aymeric Wibo
+// Copyright (c) 2024-2026 Aymeric Wibo
 
 #pragma once
 
@@ -10,21 +10,33 @@ typedef bool (*task_fn_t)(void* data);
 
 typedef struct {
 	bool started;
+	bool continuation;
 	task_fn_t fn;
 	void* data;
 } task_t;
 
 typedef struct {
 	pthread_mutex_t lock;
+	pthread_cond_t cond;
 
 	bool error;
 	bool started;
 
 	// (Lazy) task queue.
+	// Tasks are only ever appended and started in order (apart from continuations), so we keep track of where the first one which hasn't been started is rather than looking through the whole queue every time.
 
 	size_t task_count;
 	task_t* tasks;
 
+	size_t first_unstarted;
+	size_t pending_continuations;
+
+	// Job slots.
+	// A task holds a slot from when it starts until it's done, including while it's deferred (see 'pool_defer()').
+
+	size_t slots;
+	size_t in_flight;
+
 	// Worker pool.
 
 	size_t businessman_count;
@@ -34,6 +46,40 @@ typedef struct {
 void pool_init(pool_t* pool, size_t businessman_count);
 void pool_free(pool_t* pool);
 
+/**
+ * Initialize a pool for tasks which spend most of their time waiting on commands.
+ *
+ * Such tasks don't block a businessman while their commands run: they start them with {@link cmd_exec_cb}, call {@link pool_defer}, and return.
+ * The command's callback then continues the task with {@link pool_resume}.
+ * This means we can have more jobs running than there are businessmen, so the number of businessmen is capped to the number of CPU's actually online.
+ *
+ * @param pool Pool to initialize.
+ * @param slots Maximum number of tasks in progress at the same time (i.e. the number of jobs).
+ */
+void pool_init_async(pool_t* pool, size_t slots);
+
 void pool_add_task(pool_t* pool, task_fn_t cb, void* data);
 int pool_start(pool_t* pool);
 int pool_wait(pool_t* pool);
+
+/**
+ * Mark the current task as waiting on something outside of the pool.
+ *
+ * This must be called from within a task, before it returns, and must be matched by exactly one {@link pool_resume}.
+ * The task keeps its job slot until it's resumed and done, and {@link pool_wait} doesn't return until then, even if the pool is stopping.
+ *
+ * @param pool The pool.
+ */
+void pool_defer(pool_t* pool);
+
+/**
+ * Resume a deferred task.
+ *
+ * This can be called from any thread.
+ * Continuations run before new tasks are started, and are run even if the pool is stopping, so that they can clean up after themselves (they should check 'pool_t.error' to know not to do any more work).
+ *
+ * @param pool The pool.
+ * @param cb Continuation function, which may itself defer again.
+ * @param data Data to pass to the continuation.
+ */
+void pool_resume(pool_t* pool, task_fn_t cb, void* data);
@@ -0,0 +1,64 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2026 Aymeric Wibo
+
+#include <common.h>
+
+#include <alloc.h>
+#include <progress.h>
+
+void progress_init(progress_t* progress) {
+	pthread_mutex_init(&progress->lock, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &progress->start);
+
+	progress->total = 0;
+	progress->started = 0;
+	progress->done = 0;
+}
+
+void progress_add(progress_t* progress, size_t count) {
+	pthread_mutex_lock(&progress->lock);
+	progress->total += count;
+	pthread_mutex_unlock(&progress->lock);
+}
+
+char* progress_start(progress_t* progress) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	pthread_mutex_lock(&progress->lock);
+
+	size_t const n = ++progress->started;
+	size_t const total = progress->total;
+	size_t const done = progress->done;
+
+	pthread_mutex_unlock(&progress->lock);
+
+	char* status = NULL;
+
+	// We can't estimate anything until at least one task is done.
+	// After that, assume the remaining tasks will complete at the same rate as those which are already done.
+
+	if (done == 0) {
+		asprintf_c(&status, "[%zu/%zu]", n, total);
+		return status;
+	}
+
+	double const elapsed = (now.tv_sec - progress->start.tv_sec) + (now.tv_nsec - progress->start.tv_nsec) / 1e9;
+	unsigned long const eta = elapsed * (total - done) / done + .5;
+
+	if (eta >= 60) {
+		asprintf_c(&status, "[%zu/%zu, eta %lum%02lus]", n, total, eta / 60, eta % 60);
+	}
+
+	else {
+		asprintf_c(&status, "[%zu/%zu, eta %lus]", n, total, eta);
+	}
+
+	return status;
+}
+
+void progress_done(progress_t* progress) {
+	pthread_mutex_lock(&progress->lock);
+	progress->done++;
+	pthread_mutex_unlock(&progress->lock);
+}
@@ -0,0 +1,57 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2026 Aymeric Wibo
+
+/*
+ * Ninja-style progress reporting.
+ *
+ * Each task which is started is prefixed with '[n/total]' and an estimate of the time left, based on how long the tasks which are already done took.
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef struct {
+	pthread_mutex_t lock;
+	struct timespec start;
+
+	size_t total;
+	size_t started;
+	size_t done;
+} progress_t;
+
+/**
+ * Initialize progress tracking.
+ *
+ * @param progress Progress to initialize.
+ */
+void progress_init(progress_t* progress);
+
+/**
+ * Add tasks to the total.
+ *
+ * @param progress The progress.
+ * @param count Number of tasks to add.
+ */
+void progress_add(progress_t* progress, size_t count);
+
+/**
+ * Mark a task as started and get its status string.
+ *
+ * This function is thread-safe.
+ *
+ * @param progress The progress.
+ * @return Status string, e.g. "[3/12, eta 5s]" (to be freed by the caller).
+ */
+char* progress_start(progress_t* progress);
+
+/**
+ * Mark a task as done.
+ *
+ * This function is thread-safe.
+ *
+ * @param progress The progress.
+ */
+void progress_done(progress_t* progress);
@@ -0,0 +1,501 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2026 Aymeric Wibo
+
+#include <common.h>
+
+#include <alloc.h>
+#include <build_step.h>
+#include <cmd.h>
+#include <cookie.h>
+#include <frugal.h>
+#include <fsutil.h>
+#include <logging.h>
+#include <manifest.h>
+#include <pgo.h>
+#include <project.h>
+#include <str.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+extern bool running_as_root;
+extern uid_t owner;
+
+static int get_and_ensure_deps_path(void) {
+	deps_path = getenv("BOB_DEPS_PATH");
+
+	if (deps_path == NULL) {
+		char const* const home = getenv("HOME");
+
+		// XXX Don't worry about freeing these.
+
+		if (home != NULL) {
+			asprintf_c(&deps_path, "%s/%s", home, ".cache/bob/deps");
+		}
+
+		else {
+			asprintf_c(&deps_path, "%s/%s", abs_out_path, "deps");
+			LOG_WARN("$HOME is not set, using '%s' as the dependencies path as a last resort.", deps_path);
+		}
+	}
+
+	// Ensure it exists.
+
+	if (mkdir_recursive(deps_path, 0755) < 0) {
+		LOG_FATAL("mkdir_recursive(\"%s\"): %s", deps_path, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+// Version of the format of each kind of artifact in the output path.
+// Bump the relevant one when a change to Bob means artifacts of that kind which an older Bob produced can't be reused, so that upgrading Bob doesn't invalidate everything.
+// The flags files of the cookies only hold the compiler and the flags from the build script, so "invocation" must be bumped whenever Bob changes the arguments it adds to compiler and linker command lines itself (e.g. '-fdiagnostics-color', '-c', or '-isystem').
+
+#define SCHEMAS_HEADER "schemas"
+
+typedef struct {
+	char const* kind;
+	unsigned version;
+
+	// Whether this kind covers the output paths of the build systems (i.e. Bob's cookies and other build systems' build directories), as opposed to just 'paths'.
+
+	bool bsys_outputs;
+	char const* paths[3];
+} schema_t;
+
+static schema_t const SCHEMAS[] = {
+	{"outputs", 1, true, {NULL}},
+	{"invocation", 1, true, {NULL}},
+	{"prefix", 1, false, {"prefix", "pgo/prefix", NULL}},
+	{"dep-tree", 1, false, {"deps.hash", "deps.tree", NULL}},
+	{"pgo", 1, false, {"pgo/raw", "pgo/profile", NULL}},
+};
+
+#define SCHEMA_COUNT (sizeof SCHEMAS / sizeof *SCHEMAS)
+
+static int clear_out_subpath(char const* rel) {
+	char* STR_CLEANUP err = NULL;
+
+	char* STR_CLEANUP path = NULL;
+	asprintf_c(&path, "%s/%s", abs_out_path, rel);
+
+	if (rm_background(path, &err) < 0) {
+		LOG_FATAL("Failed to clear \"%s\": %s", path, err);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int clear_schema(schema_t const* schema) {
+	for (size_t i = 0; schema->bsys_outputs && i < sizeof BSYS / sizeof *BSYS; i++) {
+		char const* const key = BSYS[i]->key;
+
+		if (key == NULL) {
+			continue;
+		}
+
+		char* STR_CLEANUP pgo_gen = NULL;
+		asprintf_c(&pgo_gen, "%s.pgo-gen", key);
+
+		if (clear_out_subpath(key) < 0 || clear_out_subpath(pgo_gen) < 0) {
+			return -1;
+		}
+	}
+
+	for (size_t i = 0; schema->paths[i] != NULL; i++) {
+		if (clear_out_subpath(schema->paths[i]) < 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int clear_out_path_if_bob_update(void) {
+	char* STR_CLEANUP err = NULL;
+
+	char* STR_CLEANUP version_path = NULL;
+	asprintf_c(&version_path, "%s/version", abs_out_path);
+
+	FILE* const f = fopen(version_path, "r");
+
+	// If version file doesn't exist, clear cache.
+	// Don't log here, because it might just be the first time creating this directory.
+
+	if (f == NULL) {
+		goto clear;
+	}
+
+	char stored[1024] = {0};
+	fread(stored, 1, sizeof stored - 1, f);
+	fclose(f);
+
+	// Older versions of Bob just stored their build ID, in which case we don't know what's still valid and have to clear everything.
+
+	if (strncmp(stored, SCHEMAS_HEADER "\n", strlen(SCHEMAS_HEADER "\n")) != 0) {
+		LOG_INFO("Bob was updated, clearing output path.");
+		goto clear;
+	}
+
+	// Otherwise, only clear the kinds of artifacts whose format changed.
+
+	bool changed = false;
+
+	for (size_t i = 0; i < SCHEMA_COUNT; i++) {
+		schema_t const* const schema = &SCHEMAS[i];
+		unsigned version = 0;
+
+		char* STR_CLEANUP key = NULL;
+		asprintf_c(&key, "\n%s ", schema->kind);
+
+		char const* const line = strstr(stored, key);
+
+		if (line != NULL) {
+			sscanf(line + strlen(key), "%u", &version);
+		}
+
+		if (version == schema->version) {
+			continue;
+		}
+
+		LOG_INFO("Bob was updated, clearing %s from output path.", schema->kind);
+		changed = true;
+
+		if (clear_schema(schema) < 0) {
+			return -1;
+		}
+	}
+
+	if (!changed) {
+		return 0;
+	}
+
+	goto write;
+
+clear:
+
+	if (rm_background(abs_out_path, &err) < 0) {
+		LOG_FATAL("Failed to clear output path (\"%s\"): %s", abs_out_path, err);
+		return -1;
+	}
+
+	if (mkdir_recursive(abs_out_path, 0755) < 0) {
+		LOG_FATAL("mkdir_recursive(\"%s\"): %s", abs_out_path, strerror(errno));
+		return -1;
+	}
+
+write:;
+
+	FILE* const new_version_f = fopen(version_path, "w");
+
+	if (new_version_f == NULL) {
+		LOG_FATAL("fopen(\"%s\"): %s", version_path, strerror(errno));
+		return -1;
+	}
+
+	fputs(SCHEMAS_HEADER "\n", new_version_f);
+
+	for (size_t i = 0; i < SCHEMA_COUNT; i++) {
+		fprintf(new_version_f, "%s %u\n", SCHEMAS[i].kind, SCHEMAS[i].version);
+	}
+
+	set_owner_fd(fileno(new_version_f), version_path);
+	fclose(new_version_f);
+
+	return 0;
+}
+
+char* project_target(void) {
+	char const* const target = getenv("BOB_TARGET");
+
+	if (target != NULL) {
+		return strdup_c(target);
+	}
+
+	struct utsname u;
+
+	if (uname(&u) < 0) {
+		LOG_WARN("uname(): %s", strerror(errno));
+		return strdup_c("unknown");
+	}
+
+	char* host = NULL;
+	asprintf_c(&host, "%s-%s", u.machine, u.sysname);
+
+	return host;
+}
+
+int project_open(char const* path, bool pgo_training, bsys_t const** bsys_ref) {
+	if (chdir(path) < 0) {
+		LOG_FATAL("chdir(\"%s\"): %s", path, strerror(errno));
+		return -1;
+	}
+
+	// Get the owner of the project directory.
+	// If running as root, we'll use this owner for the binary output directory.
+
+	if (getuid() == 0) {
+		struct stat sb;
+
+		if (stat(".", &sb) < 0) {
+			LOG_FATAL("stat(\"%s\"): %s", path, strerror(errno));
+			return -1;
+		}
+
+		running_as_root = true;
+		owner = sb.st_uid;
+	}
+
+	// Ensure the output path exists.
+
+	if (mkdir_wrapped(targetless_out_path, 0755) < 0 && errno != EEXIST) {
+		LOG_FATAL("mkdir(\"%s\"): %s", targetless_out_path, strerror(errno));
+		return -1;
+	}
+
+	// Get target and append to out path.
+
+	char* const STR_CLEANUP target = project_target();
+	char* STR_CLEANUP out_path = NULL;
+	asprintf_c(&out_path, "%s/%s", targetless_out_path, target);
+
+	// Ensure the target path exists too.
+
+	if (mkdir_wrapped(out_path, 0755) < 0 && errno != EEXIST) {
+		LOG_FATAL("mkdir(\"%s\"): %s", out_path, strerror(errno));
+		return -1;
+	}
+
+	// Other Bob processes might be opening this same project at the same time (e.g. when discovering the dependencies of sibling dependencies which share it).
+	// The lock file is next to the output path rather than in it, as the output path itself might be cleared.
+
+	char* STR_CLEANUP lock_path = NULL;
+	asprintf_c(&lock_path, "%s.lock", out_path);
+
+	int const lock_fd = open(lock_path, O_RDONLY | O_CREAT | O_CLOEXEC, 0644);
+
+	if (lock_fd < 0) {
+		LOG_FATAL("open(\"%s\"): %s", lock_path, strerror(errno));
+		return -1;
+	}
+
+	set_owner_fd(lock_fd, lock_path);
+
+	// Get absolute output path.
+
+	abs_out_path = realerpath(out_path);
+
+	if (abs_out_path == NULL) {
+		LOG_FATAL("realpath(\"%s\"): %s", out_path, strerror(errno));
+		close(lock_fd);
+		return -1;
+	}
+
+	// Clear the parts of the output directory whose format changed if Bob was updated.
+	// Has to be done before we ensure the temporary installation prefix exists, or we might remove it and it won't be recreated.
+	// Only one process may do this at a time, so that one doesn't clear the output path from under another which has already checked it.
+
+	if (flock(lock_fd, LOCK_EX) < 0) {
+		LOG_WARN("flock(\"%s\"): %s", lock_path, strerror(errno));
+	}
+
+	// Also take the opportunity to remove whatever a previous clear might've left behind in the output path or next to it.
+
+	char* STR_CLEANUP pgo_path = NULL;
+	asprintf_c(&pgo_path, "%s/pgo", abs_out_path);
+
+	// The output path's parent could be anything (e.g. the project directory itself with '-o .'), so only its own trash is removed from there.
+
+	char* const STR_CLEANUP out_parent = strdup_c(abs_out_path);
+	char* const out_name = strrchr(out_parent, '/');
+	*out_name = '\0';
+
+	rm_stale_trash(out_parent, out_name + 1);
+	rm_stale_trash(abs_out_path, NULL);
+	rm_stale_trash(pgo_path, NULL);
+
+	int const rv = clear_out_path_if_bob_update();
+	close(lock_fd);
+
+	if (rv < 0) {
+		return -1;
+	}
+
+	// Get default final and temporary install prefixes.
+
+	// Instrumented builds get their own temporary installation prefix so they don't clobber the actual build.
+
+	default_final_install_prefix = "/usr/local";
+	asprintf_c(&default_tmp_install_prefix, pgo_mode == PGO_GENERATE ? "%s/pgo/prefix" : "%s/prefix", abs_out_path);
+
+	if (pgo_init(pgo_training) < 0) {
+		return -1;
+	}
+
+	// Ensure all installation prefixes (explicitly set, final, and temporary) exist.
+
+	char const* const prefixes[] = {
+		install_prefix,
+		default_final_install_prefix,
+		default_tmp_install_prefix
+	};
+
+	for (size_t i = 0; i < sizeof prefixes / sizeof *prefixes; i++) {
+		char const* const prefix = prefixes[i];
+
+		if (prefix == NULL) {
+			continue;
+		}
+
+		if (mkdir_recursive(prefix, 0755) < 0 && errno != EEXIST) {
+			LOG_FATAL("mkdir(\"%s\"): %s", prefix, strerror(errno));
+			return -1;
+		}
+	}
+
+	// Get the dependencies path and ensure it exists.
+
+	if (get_and_ensure_deps_path() < 0) {
+		return -1;
+	}
+
+	// Identify the build system.
+
+	bsys_t const* const bsys = bsys_identify();
+	bsys_out_path = NULL;
+
+	if (bsys == NULL) {
+		LOG_FATAL("Could not identify build system.");
+		return -1;
+	}
+
+	if (bsys->key != NULL) {
+		// XXX We don't use the absolute path here, because this would mean that some hashes for cookies generated for paths containing 'bsys_out_path' would break when we move the current directory (and makes testing for different platforms annoying).
+		// Instrumented builds also get their own cookie space.
+
+		asprintf_c(&bsys_out_path, "%s/%s%s", out_path, bsys->key, pgo_mode == PGO_GENERATE ? ".pgo-gen" : "");
+	}
+
+	if (dep_config_count > 0 && !bsys->supports_config) {
+		LOG_WARN("%s build system does not support config options; -D flags will be ignored.", bsys->name);
+	}
+
+	if (bsys->setup && bsys->setup() < 0) {
+		return -1;
+	}
+
+	*bsys_ref = bsys;
+	return 0;
+}
+
+int project_suspend(project_state_t* state, bsys_t const* bsys) {
+	state->cwd_fd = open(".", O_RDONLY | O_DIRECTORY);
+
+	if (state->cwd_fd < 0) {
+		LOG_FATAL("open(\".\"): %s", strerror(errno));
+		return -1;
+	}
+
+	state->instr = instr;
+	state->targetless_out_path = targetless_out_path;
+	state->abs_out_path = abs_out_path;
+	state->bsys_out_path = bsys_out_path;
+	state->deps_path = deps_path;
+
+	state->build_deps = build_deps;
+	state->own_prefix = own_prefix;
+	state->install_prefix = install_prefix;
+	state->default_tmp_install_prefix = default_tmp_install_prefix;
+
+	state->pgo_mode = pgo_mode;
+	state->pgo_raw_path = pgo_raw_path;
+	state->pgo_profile_path = pgo_profile_path;
+
+	state->dep_config_count = dep_config_count;
+	state->dep_config_keys = dep_config_keys;
+	state->dep_config_vals = dep_config_vals;
+
+	state->running_as_root = running_as_root;
+	state->owner = owner;
+
+	// The build steps of the current project have already been added, so set them aside.
+
+	state->build_step_count = build_step_count;
+	state->build_steps = build_steps;
+
+	build_step_count = 0;
+	build_steps = NULL;
+
+	state->bsys = bsys;
+	state->bsys_state = bsys->suspend == NULL ? NULL : bsys->suspend();
+	state->manifest = manifest_suspend();
+
+	// Cookie, ownership, library search, and binary caches are keyed by paths which may be relative to the project (e.g. '-L' flags as written), so they mean something else in another one.
+
+	reset_cookies();
+	reset_owner_cache();
+	frugal_forget_libs();
+	cmd_forget_bins();
+
+	return 0;
+}
+
+int project_resume(project_state_t* state) {
+	int rv = 0;
+
+	if (fchdir(state->cwd_fd) < 0) {
+		LOG_FATAL("fchdir(): %s", strerror(errno));
+		rv = -1;
+	}
+
+	close(state->cwd_fd);
+
+	instr = state->instr;
+	targetless_out_path = state->targetless_out_path;
+	abs_out_path = state->abs_out_path;
+	bsys_out_path = state->bsys_out_path;
+	deps_path = state->deps_path;
+
+	build_deps = state->build_deps;
+	own_prefix = state->own_prefix;
+	install_prefix = state->install_prefix;
+	default_tmp_install_prefix = state->default_tmp_install_prefix;
+
+	pgo_mode = state->pgo_mode;
+	pgo_raw_path = state->pgo_raw_path;
+	pgo_profile_path = state->pgo_profile_path;
+
+	dep_config_count = state->dep_config_count;
+	dep_config_keys = state->dep_config_keys;
+	dep_config_vals = state->dep_config_vals;
+
+	running_as_root = state->running_as_root;
+	owner = state->owner;
+
+	free_build_steps();
+	build_step_count = state->build_step_count;
+	build_steps = state->build_steps;
+
+	if (state->bsys->resume != NULL) {
+		state->bsys->resume(state->bsys_state);
+	}
+
+	manifest_resume(state->manifest);
+
+	reset_cookies();
+	reset_owner_cache();
+	frugal_forget_libs();
+	cmd_forget_bins();
+
+	return rv;
+}
@@ -0,0 +1,91 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2026 Aymeric Wibo
+
+/*
+ * Projects.
+ *
+ * Opening a project means changing into its directory, setting up its output path, identifying its build system, and setting that up (which, for Bob, means evaluating its build script).
+ * Most of this state is global, so to open a dependency in the same process (see 'BOB_DEPS_IN_PROCESS'), the current project must first be suspended, and then resumed once the dependency is done with.
+ */
+
+#pragma once
+
+#include <bsys.h>
+#include <build_step.h>
+#include <pgo.h>
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+typedef struct {
+	int cwd_fd;
+
+	char const* instr;
+	char const* targetless_out_path;
+	char const* abs_out_path;
+	char* bsys_out_path;
+	char* deps_path;
+
+	bool build_deps;
+	bool own_prefix;
+	char const* install_prefix;
+	char* default_tmp_install_prefix;
+
+	pgo_t pgo_mode;
+	char* pgo_raw_path;
+	char* pgo_profile_path;
+
+	size_t dep_config_count;
+	char** dep_config_keys;
+	char** dep_config_vals;
+
+	bool running_as_root;
+	uid_t owner;
+
+	size_t build_step_count;
+	build_step_t* build_steps;
+
+	bsys_t const* bsys;
+	void* bsys_state;
+	void* manifest;
+} project_state_t;
+
+/**
+ * Get the target projects are built for.
+ *
+ * This is the 'BOB_TARGET' envvar if set, or the host's architecture and OS otherwise.
+ *
+ * @return Heap-allocated target name; caller must free.
+ */
+char* project_target(void);
+
+/**
+ * Open a project.
+ *
+ * @param path Absolute path to the project.
+ * @param pgo_training Whether we're about to train the project for PGO.
+ * @param bsys_ref Set to the project's build system.
+ * @return 0 on success, -1 on failure.
+ */
+int project_open(char const* path, bool pgo_training, bsys_t const** bsys_ref);
+
+/**
+ * Save the state of the current project so that another one can be opened.
+ *
+ * This function is not thread-safe; nothing else may be using the project's state at the same time.
+ *
+ * @param state Where to save the state.
+ * @param bsys The current project's build system.
+ * @return 0 on success, -1 on failure.
+ */
+int project_suspend(project_state_t* state, bsys_t const* bsys);
+
+/**
+ * Restore the state of a project saved with {@link project_suspend}.
+ *
+ * Whatever project was opened in the meantime must have already been destroyed.
+ *
+ * @param state The saved state.
+ * @return 0 on success, -1 on failure.
+ */
+int project_resume(project_state_t* state);
@@ -0,0 +1,528 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2026 Aymeric Wibo
+
+#include <common.h>
+
+#include <alloc.h>
+#include <cmd.h>
+#include <logging.h>
+#include <spawn_server.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+bool spawn_server_active = false;
+
+static pthread_mutex_t req_lock = PTHREAD_MUTEX_INITIALIZER;
+static int req_fd = -1;
+static int exit_fd = -1;
+
+// Request header.
+// It's followed by a payload of NUL-terminated strings: the working directory, the path to the executable, 'argc' arguments, and 'envc' environment variables.
+// The stdio file descriptors are passed along with the header as ancillary data, in the order of the 'has_*' fields.
+
+typedef struct {
+	uint32_t size;
+	uint32_t argc;
+	uint32_t envc;
+	uint8_t has_out;
+	uint8_t has_in;
+} request_t;
+
+static int write_full(int fd, void const* buf, size_t size) {
+	while (size > 0) {
+		ssize_t const bytes = write(fd, buf, size);
+
+		if (bytes < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (bytes <= 0) {
+			return -1;
+		}
+
+		buf = (char const*) buf + bytes;
+		size -= bytes;
+	}
+
+	return 0;
+}
+
+static int read_full(int fd, void* buf, size_t size) {
+	while (size > 0) {
+		ssize_t const bytes = read(fd, buf, size);
+
+		if (bytes < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (bytes <= 0) {
+			return -1;
+		}
+
+		buf = (char*) buf + bytes;
+		size -= bytes;
+	}
+
+	return 0;
+}
+
+static int make_socketpair(int fds[2]) {
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+		return -1;
+	}
+
+	// We don't want commands we spawn (from either process) to inherit these.
+
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+	return 0;
+}
+
+// Server side.
+// Everything here runs in the forked server process, which is single-threaded.
+
+static int sigchld_fds[2] = {-1, -1};
+
+static void on_sigchld(int sig) {
+	int const saved_errno = errno;
+	write(sigchld_fds[1], "", 1);
+	errno = saved_errno;
+}
+
+static void reap_all(int exit_fd) {
+	pid_t pid;
+	int wstatus;
+
+	while ((pid = waitpid(-1, &wstatus, WNOHANG)) > 0) {
+		spawn_server_exit_t const record = {
+			.pid = pid,
+			.wstatus = wstatus,
+		};
+
+		if (write_full(exit_fd, &record, sizeof record) < 0) {
+			_exit(EXIT_FAILURE);
+		}
+	}
+}
+
+static int handle_request(int req_fd) {
+	// Receive the header along with the file descriptors.
+
+	request_t req;
+	int fds[2] = {-1, -1};
+	size_t fd_count = 0;
+
+	union {
+		char buf[CMSG_SPACE(sizeof fds)];
+		struct cmsghdr align;
+	} control;
+
+	struct iovec iov = {
+		.iov_base = &req,
+		.iov_len = sizeof req,
+	};
+
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buf,
+		.msg_controllen = sizeof control.buf,
+	};
+
+	ssize_t const bytes = recvmsg(req_fd, &msg, 0);
+
+	if (bytes <= 0) {
+		return -1; // Bob closed its end, so it's time to go.
+	}
+
+	for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+			fd_count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof *fds;
+			memcpy(fds, CMSG_DATA(cmsg), fd_count * sizeof *fds);
+		}
+	}
+
+	// Only the copies dup'ed onto the command's stdio should be inherited.
+
+	for (size_t i = 0; i < fd_count; i++) {
+		fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+	}
+
+	if ((size_t) bytes < sizeof req && read_full(req_fd, (char*) &req + bytes, sizeof req - bytes) < 0) {
+		return -1;
+	}
+
+	size_t const expected_fds = req.has_out + req.has_in;
+
+	if (fd_count != expected_fds) {
+		return -1;
+	}
+
+	int const out_fd = req.has_out ? fds[0] : -1;
+	int const in_fd = req.has_in ? fds[req.has_out] : -1;
+
+	// Receive the payload and split it up into strings.
+
+	char* const payload = malloc_c(req.size);
+
+	if (read_full(req_fd, payload, req.size) < 0) {
+		return -1;
+	}
+
+	char** const strs = malloc_c((2 + req.argc + 1 + req.envc + 1) * sizeof *strs);
+	char* cur = payload;
+
+	for (size_t i = 0; i < 2 + req.argc + req.envc; i++) {
+		// Leave room for the NULL sentinel at the end of the arguments.
+
+		strs[i + (i >= 2 + req.argc)] = cur;
+		cur += strlen(cur) + 1;
+	}
+
+	char* const cwd = strs[0];
+	char* const path = strs[1];
+	char** const argv = &strs[2];
+	char** const envp = &strs[2 + req.argc + 1];
+
+	argv[req.argc] = NULL;
+	envp[req.envc] = NULL;
+
+	// Actually spawn the command.
+
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+
+	if (out_fd >= 0) {
+		posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+		posix_spawn_file_actions_adddup2(&actions, out_fd, STDERR_FILENO);
+	}
+
+	if (in_fd >= 0) {
+		posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+	}
+
+	int32_t rv;
+	pid_t pid;
+
+	if (chdir(cwd) < 0) {
+		rv = -errno;
+	}
+
+	else {
+		int const err = posix_spawn(&pid, path, &actions, NULL, argv, envp);
+		rv = err == 0 ? pid : -err;
+	}
+
+	posix_spawn_file_actions_destroy(&actions);
+
+	for (size_t i = 0; i < fd_count; i++) {
+		close(fds[i]);
+	}
+
+	free(strs);
+	free(payload);
+
+	return write_full(req_fd, &rv, sizeof rv);
+}
+
+static _Noreturn void serve(int req_fd, int exit_fd) {
+	if (pipe(sigchld_fds) < 0) {
+		_exit(EXIT_FAILURE);
+	}
+
+	fcntl(sigchld_fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(sigchld_fds[1], F_SETFD, FD_CLOEXEC);
+	fcntl(sigchld_fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(sigchld_fds[1], F_SETFL, O_NONBLOCK);
+
+	struct sigaction sa = {
+		.sa_handler = on_sigchld,
+		.sa_flags = SA_RESTART | SA_NOCLDSTOP,
+	};
+
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGCHLD, &sa, NULL);
+
+	for (;;) {
+		struct pollfd fds[2] = {
+			{.fd = req_fd, .events = POLLIN},
+			{.fd = sigchld_fds[0], .events = POLLIN},
+		};
+
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			_exit(EXIT_FAILURE);
+		}
+
+		if (fds[1].revents) {
+			char buf[64];
+			while (read(sigchld_fds[0], buf, sizeof buf) > 0)
+				;
+
+			reap_all(exit_fd);
+		}
+
+		if (fds[0].revents && handle_request(req_fd) < 0) {
+			_exit(EXIT_SUCCESS);
+		}
+	}
+}
+
+// Client side.
+
+int spawn_server_init(void) {
+	if (req_fd >= 0) {
+		return 0;
+	}
+
+	int req_fds[2];
+	int exit_fds[2];
+
+	if (make_socketpair(req_fds) < 0 || make_socketpair(exit_fds) < 0) {
+		LOG_FATAL("socketpair: %s", strerror(errno));
+		return -1;
+	}
+
+	// Flush anything pending so it isn't output twice.
+
+	logging_flush();
+	fflush(stdout);
+	fflush(stderr);
+
+	pid_t const pid = fork();
+
+	if (pid < 0) {
+		LOG_FATAL("fork: %s", strerror(errno));
+		return -1;
+	}
+
+	if (pid == 0) {
+		close(req_fds[0]);
+		close(exit_fds[0]);
+
+		serve(req_fds[1], exit_fds[1]);
+	}
+
+	close(req_fds[1]);
+	close(exit_fds[1]);
+
+	req_fd = req_fds[0];
+	exit_fd = exit_fds[0];
+
+	fcntl(exit_fd, F_SETFL, O_NONBLOCK);
+
+	spawn_server_active = true;
+	return 0;
+}
+
+int spawn_server_exit_fd(void) {
+	return exit_fd;
+}
+
+static void append(char** buf, size_t* size, char const* str) {
+	size_t const len = strlen(str) + 1;
+
+	*buf = realloc_c(*buf, *size + len);
+	memcpy(*buf + *size, str, len);
+	*size += len;
+}
+
+pid_t spawn_server_spawn(char const* path, char* const* argv, int out_fd, int in_fd) {
+	extern char** environ;
+
+	// Build up the request.
+
+	char cwd[PATH_MAX];
+
+	if (getcwd(cwd, sizeof cwd) == NULL) {
+		LOG_ERROR("getcwd: %s", strerror(errno));
+		return -1;
+	}
+
+	request_t req = {
+		.has_out = out_fd >= 0,
+		.has_in = in_fd >= 0,
+	};
+
+	char* payload = NULL;
+	size_t size = 0;
+
+	append(&payload, &size, cwd);
+	append(&payload, &size, path);
+
+	for (; argv[req.argc] != NULL; req.argc++) {
+		append(&payload, &size, argv[req.argc]);
+	}
+
+	for (; environ[req.envc] != NULL; req.envc++) {
+		append(&payload, &size, environ[req.envc]);
+	}
+
+	req.size = size;
+
+	// Attach the file descriptors.
+
+	int fds[2];
+	size_t fd_count = 0;
+
+	if (out_fd >= 0) {
+		fds[fd_count++] = out_fd;
+	}
+
+	if (in_fd >= 0) {
+		fds[fd_count++] = in_fd;
+	}
+
+	union {
+		char buf[CMSG_SPACE(sizeof fds)];
+		struct cmsghdr align;
+	} control;
+
+	memset(&control, 0, sizeof control);
+
+	struct iovec iov = {
+		.iov_base = &req,
+		.iov_len = sizeof req,
+	};
+
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+	};
+
+	if (fd_count > 0) {
+		msg.msg_control = control.buf;
+		msg.msg_controllen = CMSG_SPACE(fd_count * sizeof *fds);
+
+		struct cmsghdr* const cmsg = CMSG_FIRSTHDR(&msg);
+
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(fd_count * sizeof *fds);
+
+		memcpy(CMSG_DATA(cmsg), fds, fd_count * sizeof *fds);
+	}
+
+	// Send it off and wait for the reply.
+	// Requests from different threads mustn't interleave.
+
+	int32_t rv = -EPIPE;
+	pthread_mutex_lock(&req_lock);
+
+	ssize_t sent;
+
+	while ((sent = sendmsg(req_fd, &msg, 0)) < 0 && errno == EINTR)
+		;
+
+	if (sent < 0) {
+		rv = -errno;
+	}
+
+	else if (
+		((size_t) sent < sizeof req && write_full(req_fd, (char*) &req + sent, sizeof req - sent) < 0) ||
+		write_full(req_fd, payload, size) < 0 ||
+		read_full(req_fd, &rv, sizeof rv) < 0
+	) {
+		rv = -EPIPE;
+	}
+
+	pthread_mutex_unlock(&req_lock);
+	free(payload);
+
+	if (rv < 0) {
+		LOG_ERROR("Spawn server failed to spawn '%s': %s", path, strerror(-rv));
+		return -1;
+	}
+
+	return rv;
+}
+
+// Benchmark.
+
+static double bench(size_t count, bool served) {
+	spawn_server_active = served;
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (size_t i = 0; i < count; i++) {
+		cmd_t CMD_CLEANUP cmd = {0};
+		cmd_create(&cmd, "true", NULL);
+
+		if (cmd_exec(&cmd) < 0) {
+			return -1;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double const elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	return count / elapsed;
+}
+
+int spawn_server_bench(int argc, char* argv[]) {
+	size_t const count = argc > 0 ? strtoul(argv[0], NULL, 10) : 1000;
+	size_t const heap_mib = argc > 1 ? strtoul(argv[1], NULL, 10) : 512;
+
+	if (count == 0) {
+		LOG_FATAL("Number of spawns must be positive.");
+		return -1;
+	}
+
+	// The spawn server must be started before we grow the heap, as it would be in a real build.
+
+	bool const was_active = spawn_server_active;
+
+	if (spawn_server_init() < 0) {
+		return -1;
+	}
+
+	// Simulate the heap of an evaluated build script, with lots of small allocations which are all touched.
+
+	size_t const chunk_size = 4096;
+	size_t const chunk_count = heap_mib * 1024 * 1024 / chunk_size;
+	char** const chunks = malloc_c(chunk_count * sizeof *chunks);
+
+	for (size_t i = 0; i < chunk_count; i++) {
+		chunks[i] = malloc_c(chunk_size);
+		memset(chunks[i], 1, chunk_size);
+	}
+
+	LOG_INFO("Spawning 'true' %zu times with a %zu MiB heap...", count, heap_mib);
+
+	double const direct = bench(count, false);
+	double const served = bench(count, true);
+
+	spawn_server_active = was_active;
+
+	for (size_t i = 0; i < chunk_count; i++) {
+		free(chunks[i]);
+	}
+
+	free(chunks);
+
+	if (direct < 0 || served < 0) {
+		LOG_FATAL("Failed to spawn 'true'.");
+		return -1;
+	}
+
+	LOG_SUCCESS("Direct: %.0f spawns/s, spawn server: %.0f spawns/s (%.2fx).", direct, served, served / direct);
+	return 0;
+}
@@ -0,0 +1,77 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2026 Aymeric Wibo
+
+/*
+ * Spawn server.
+ *
+ * Once the build script has been evaluated, Bob's address space can be quite large, which makes every 'posix_spawn()' more expensive (the kernel has to deal with all those mappings even if it doesn't end up copying them).
+ * The spawn server is a small helper process forked at startup, before any of that allocation happens, which spawns commands on Bob's behalf.
+ * Requests are sent over a socket along with the file descriptors the command should use for its stdio.
+ *
+ * Commands spawned this way are children of the spawn server, not of Bob, so Bob can't wait on them itself.
+ * Instead, the spawn server reaps them and sends their exit status back over a second socket, which the child process supervisor polls (see 'src/cmd.c').
+ *
+ * This is opt-in, by setting the 'BOB_SPAWN_SERVER' environment variable to "1".
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * Whether commands are currently spawned through the spawn server.
+ */
+extern bool spawn_server_active;
+
+/**
+ * Exit status record sent by the spawn server when one of its children exits.
+ */
+typedef struct {
+	int32_t pid;
+	int32_t wstatus;
+} spawn_server_exit_t;
+
+/**
+ * Start the spawn server.
+ *
+ * This must be called as early as possible, while the process is still small and single-threaded.
+ * Does nothing if it's already running.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int spawn_server_init(void);
+
+/**
+ * Spawn a command through the spawn server.
+ *
+ * This function is thread-safe.
+ *
+ * @param path Path to the executable (as resolved by 'find_bin()').
+ * @param argv NULL-terminated argument vector.
+ * @param out_fd File descriptor to use as the command's stdout and stderr, or -1 to inherit them.
+ * @param in_fd File descriptor to use as the command's stdin, or -1 to inherit it.
+ * @return PID of the spawned command, or -1 on failure.
+ */
+pid_t spawn_server_spawn(char const* path, char* const* argv, int out_fd, int in_fd);
+
+/**
+ * Get the file descriptor on which the spawn server sends exit records.
+ *
+ * It is non-blocking, and each record is a {@link spawn_server_exit_t}.
+ *
+ * @return File descriptor, or -1 if the spawn server isn't running.
+ */
+int spawn_server_exit_fd(void);
+
+/**
+ * Benchmark spawning commands with and without the spawn server.
+ *
+ * This is what the 'spawn-bench' instruction runs.
+ *
+ * @param argc Number of arguments.
+ * @param argv Arguments: number of spawns (default 1000), and size of the heap to simulate in MiB (default 512).
+ * @return 0 on success, -1 on failure.
+ */
+int spawn_server_bench(int argc, char* argv[]);
@@ -0,0 +1,406 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2026 Aymeric Wibo
+
+#include <common.h>
+
+#include <alloc.h>
+#include <cmd.h>
+#include <fsutil.h>
+#include <logging.h>
+#include <ncpu.h>
+#include <pgo.h>
+#include <str.h>
+#include <toolchain.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static pthread_once_t kind_once = PTHREAD_ONCE_INIT;
+static toolchain_kind_t kind = TOOLCHAIN_UNKNOWN;
+static unsigned kind_major = 0;
+
+// '$CC' and '$AR' are read once per process, so that every task of a build uses the same ones.
+
+static pthread_once_t env_once = PTHREAD_ONCE_INIT;
+static char* env_cc = NULL;
+static char* env_ar = NULL;
+
+static void read_env(void) {
+	char const* const cc = getenv("CC");
+	char const* const ar = getenv("AR");
+
+	env_cc = strdup_c(cc == NULL ? "cc" : cc);
+	env_ar = ar == NULL ? NULL : strdup_c(ar);
+}
+
+char const* toolchain_cc(void) {
+	pthread_once(&env_once, read_env);
+	return env_cc;
+}
+
+static void detect_kind(void) {
+	cmd_t CMD_CLEANUP cmd = {0};
+	cmd_create(&cmd, toolchain_cc(), "--version", NULL);
+	cmd_set_redirect(&cmd, CMD_REDIRECT, CMD_FORCE_REDIRECT);
+
+	if (cmd_exec(&cmd) < 0) {
+		LOG_WARN("Couldn't run '%s --version' to identify the C compiler.", toolchain_cc());
+		return;
+	}
+
+	char* const out = cmd_read_out(&cmd);
+
+	// Clang (and Apple's Clang) always say "clang version X.Y.Z" somewhere, even when it's called 'cc' or 'gcc'.
+	// GCC's first line looks like "gcc (GCC) X.Y.Z" or "cc (Debian X.Y.Z-N) X.Y.Z", so the version is what comes after the first closing parenthesis.
+
+	char const* const clang = strstr(out, "clang version ");
+
+	if (clang != NULL) {
+		kind = TOOLCHAIN_CLANG;
+		kind_major = strtoul(clang + strlen("clang version "), NULL, 10);
+		return;
+	}
+
+	if (strstr(out, "Free Software Foundation") == NULL) {
+		return;
+	}
+
+	kind = TOOLCHAIN_GCC;
+	char const* const paren = strchr(out, ')');
+
+	if (paren != NULL) {
+		kind_major = strtoul(paren + 1, NULL, 10);
+	}
+}
+
+toolchain_kind_t toolchain_kind(unsigned* major) {
+	pthread_once(&kind_once, detect_kind);
+
+	if (major != NULL) {
+		*major = kind_major;
+	}
+
+	return kind;
+}
+
+int toolchain_get_lto(flamingo_val_t* inst, char const* log_prefix, lto_t* lto) {
+	*lto = LTO_NONE;
+
+	for (size_t i = 0; i < inst->inst.scope->vars_size; i++) {
+		flamingo_var_t* const var = &inst->inst.scope->vars[i];
+
+		if (flamingo_cstrcmp(var->key, "lto_mode", var->key_size) != 0) {
+			continue;
+		}
+
+		flamingo_val_t* const mode = var->val;
+
+		if (mode == NULL || mode->kind != FLAMINGO_VAL_KIND_STR) {
+			LOG_FATAL("%s: Expected 'lto_mode' to be a string.", log_prefix);
+			return -1;
+		}
+
+		if (flamingo_cstrcmp(mode->str.str, "none", mode->str.size) == 0) {
+			*lto = LTO_NONE;
+		}
+
+		else if (flamingo_cstrcmp(mode->str.str, "full", mode->str.size) == 0) {
+			*lto = LTO_FULL;
+		}
+
+		else if (flamingo_cstrcmp(mode->str.str, "thin", mode->str.size) == 0) {
+			*lto = LTO_THIN;
+		}
+
+		else {
+			LOG_FATAL("%s: Unknown LTO mode '%.*s' (expected 'none', 'full', or 'thin').", log_prefix, (int) mode->str.size, mode->str.str);
+			return -1;
+		}
+
+		return 0;
+	}
+
+	return 0;
+}
+
+static void add_extra(size_t* count, char* extra[static 4], char const* fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	vasprintf_c(&extra[(*count)++], fmt, args);
+	va_end(args);
+}
+
+static void add_pgo_extras(size_t* count, char* extra[static 4]) {
+	if (pgo_mode == PGO_NONE) {
+		return;
+	}
+
+	bool const clang = toolchain_kind(NULL) == TOOLCHAIN_CLANG;
+
+	if (pgo_mode == PGO_GENERATE) {
+		add_extra(count, extra, "-fprofile-generate=%s", pgo_raw_path);
+	}
+
+	else if (clang) {
+		add_extra(count, extra, "-fprofile-use=%s/default.profdata", pgo_profile_path);
+	}
+
+	else {
+		add_extra(count, extra, "-fprofile-use=%s", pgo_profile_path);
+	}
+
+	// GCC names profiles after the absolute path of the object file.
+	// The instrumented and optimized objects live in different cookie spaces, so strip that part to make their names match up.
+
+	if (!clang) {
+		add_extra(count, extra, "-fprofile-prefix-path=%s/%s", abs_out_path, strrchr(bsys_out_path, '/') + 1);
+	}
+}
+
+flamingo_val_t* toolchain_flags(flamingo_val_t* flags, lto_t lto) {
+	size_t count = 0;
+	char* extra[4];
+
+	// GCC has no ThinLTO, but its regular LTO is already partitioned (WHOPR) so it's the closest thing.
+
+	if (lto != LTO_NONE) {
+		add_extra(&count, extra, "%s", lto == LTO_THIN && toolchain_kind(NULL) == TOOLCHAIN_CLANG ? "-flto=thin" : "-flto");
+	}
+
+	add_pgo_extras(&count, extra);
+
+	if (count == 0) {
+		return flamingo_val_incref(flags);
+	}
+
+	flamingo_val_t* const vec = flamingo_val_make_none();
+	vec->kind = FLAMINGO_VAL_KIND_VEC;
+
+	vec->vec.count = flags->vec.count + count;
+	vec->vec.elems = malloc_c(vec->vec.count * sizeof *vec->vec.elems);
+
+	for (size_t i = 0; i < flags->vec.count; i++) {
+		vec->vec.elems[i] = flamingo_val_incref(flags->vec.elems[i]);
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		vec->vec.elems[flags->vec.count + i] = flamingo_val_make_cstr(extra[i]);
+		free(extra[i]);
+	}
+
+	return vec;
+}
+
+char* toolchain_pgo_profile(char const* out) {
+	if (pgo_mode != PGO_USE) {
+		return NULL;
+	}
+
+	char* profile = NULL;
+
+	if (toolchain_kind(NULL) == TOOLCHAIN_CLANG) {
+		asprintf_c(&profile, "%s/default.profdata", pgo_profile_path);
+	}
+
+	// With the prefix stripped, GCC's profile for an object is its path relative to the cookie space with the extension replaced.
+	// GCC mangles the slashes left in that path (i.e. those of the cookie shard) to '#'.
+
+	else {
+		size_t const prefix_len = strlen(bsys_out_path) + strlen("/");
+		char const* const name = strncmp(out, bsys_out_path, prefix_len - 1) == 0 && out[prefix_len - 1] == '/' ? out + prefix_len : out;
+		char const* const ext = strrchr(name, '.');
+		int const len = ext == NULL ? (int) strlen(name) : (int) (ext - name);
+
+		asprintf_c(&profile, "%s/%.*s.gcda", pgo_profile_path, len, name);
+
+		char* const mangled = profile + strlen(pgo_profile_path) + strlen("/");
+
+		for (int i = 0; i < len; i++) {
+			if (mangled[i] == '/') {
+				mangled[i] = '#';
+			}
+		}
+	}
+
+	// Objects which weren't part of the training simply don't have a profile.
+
+	if (access(profile, F_OK) < 0) {
+		free(profile);
+		return NULL;
+	}
+
+	return profile;
+}
+
+static int merge_llvm_profiles(void) {
+	DIR* const dp = opendir(pgo_raw_path);
+
+	if (dp == NULL) {
+		LOG_FATAL("opendir(\"%s\"): %s", pgo_raw_path, strerror(errno));
+		return -1;
+	}
+
+	cmd_t CMD_CLEANUP cmd = {0};
+
+#if defined(__APPLE__)
+	cmd_create(&cmd, "xcrun", "llvm-profdata", NULL);
+#else
+	char const* const profdata = getenv("LLVM_PROFDATA");
+	cmd_create(&cmd, profdata == NULL ? "llvm-profdata" : profdata, NULL);
+#endif
+
+	cmd_add(&cmd, "merge");
+	cmd_add(&cmd, "-o");
+	cmd_addf(&cmd, "%s/default.profdata", pgo_profile_path);
+
+	size_t raw_count = 0;
+	struct dirent* entry;
+
+	while ((entry = readdir(dp)) != NULL) {
+		size_t const len = strlen(entry->d_name);
+
+		if (len > 8 && strcmp(entry->d_name + len - 8, ".profraw") == 0) {
+			cmd_addf(&cmd, "%s/%s", pgo_raw_path, entry->d_name);
+			raw_count++;
+		}
+	}
+
+	closedir(dp);
+
+	if (raw_count == 0) {
+		LOG_FATAL("Training didn't produce any profiles in '%s'.", pgo_raw_path);
+		return -1;
+	}
+
+	if (mkdir_recursive(pgo_profile_path, 0755) < 0) {
+		LOG_FATAL("mkdir_recursive(\"%s\"): %s", pgo_profile_path, strerror(errno));
+		return -1;
+	}
+
+	int const rv = cmd_exec(&cmd);
+	cmd_log(&cmd, NULL, "PGO", "merge profiles", "merged profiles", false);
+
+	return rv;
+}
+
+int toolchain_pgo_merge(void) {
+	if (toolchain_kind(NULL) == TOOLCHAIN_CLANG) {
+		return merge_llvm_profiles();
+	}
+
+	// GCC already accumulates counters across runs into its '.gcda' files, so there's nothing to merge.
+	// We still copy them over so a failed training run doesn't clobber the last good profiles.
+
+	char* STR_CLEANUP err = NULL;
+
+	if (copy(pgo_raw_path, pgo_profile_path, false, &err) < 0) {
+		LOG_FATAL("Failed to copy PGO profiles to '%s': %s", pgo_profile_path, err);
+		return -1;
+	}
+
+	set_owner(pgo_profile_path);
+	return 0;
+}
+
+static bool has_flag(flamingo_val_t* flags, char* flag) {
+	for (size_t i = 0; i < flags->vec.count; i++) {
+		flamingo_val_t* const val = flags->vec.elems[i];
+
+		if (val->kind == FLAMINGO_VAL_KIND_STR && flamingo_cstrcmp(val->str.str, flag, val->str.size) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void toolchain_add_lto_link_args(cmd_t* cmd, lto_t lto, flamingo_val_t* flags, char const* out) {
+	if (lto == LTO_NONE) {
+		return;
+	}
+
+	// The LTO link is what actually runs the optimizer and code generator, so it's the expensive part.
+	// Split it up into as many jobs as Bob itself is allowed to run; the link step runs on its own, so nothing else is competing for these.
+	// Bob doesn't run a make jobserver, so '-flto=jobserver' isn't an option here.
+
+	size_t const jobs = ncpu();
+	unsigned major;
+	toolchain_kind_t const kind = toolchain_kind(&major);
+
+	char cache[strlen(out) + 11];
+	snprintf(cache, sizeof cache, "%s.lto-cache", out);
+
+	if (kind == TOOLCHAIN_GCC) {
+		cmd_addf(cmd, "-flto=%zu", jobs);
+
+		// Incremental LTO only exists since GCC 15.
+
+		if (major >= 15 && mkdir_wrapped(cache, 0755) == 0) {
+			cmd_addf(cmd, "-flto-incremental=%s", cache);
+		}
+
+		return;
+	}
+
+	if (kind != TOOLCHAIN_CLANG) {
+		return;
+	}
+
+	bool const lld = has_flag(flags, "-fuse-ld=lld");
+
+	if (lto == LTO_FULL) {
+		// Full LTO is monolithic with Clang; only LLD knows how to split up the code generation.
+
+		if (lld) {
+			cmd_addf(cmd, "-Wl,--lto-partitions=%zu", jobs);
+		}
+
+		return;
+	}
+
+	cmd_addf(cmd, "-flto-jobs=%zu", jobs);
+
+	// ThinLTO caches the result of each module's backend, so only the modules affected by a change need to be re-optimized.
+	// The linker creates and prunes this directory itself.
+
+#if defined(__APPLE__)
+	cmd_addf(cmd, "-Wl,-cache_path_lto,%s", cache);
+#else
+	if (lld) {
+		cmd_addf(cmd, "-Wl,--thinlto-cache-dir=%s", cache);
+	}
+
+	else {
+		cmd_addf(cmd, "-Wl,-plugin-opt,cache-dir=%s", cache);
+	}
+#endif
+}
+
+char const* toolchain_ar(lto_t lto) {
+	pthread_once(&env_once, read_env);
+
+	if (env_ar != NULL) {
+		return env_ar;
+	}
+
+	if (lto == LTO_NONE) {
+		return "ar";
+	}
+
+	// Regular ar(1) doesn't know how to build a symbol table for LTO objects (unless the linker plugin is installed where it can find it).
+
+	switch (toolchain_kind(NULL)) {
+	case TOOLCHAIN_GCC:
+		return cmd_exists("gcc-ar") ? "gcc-ar" : "ar";
+	case TOOLCHAIN_CLANG:
+		return cmd_exists("llvm-ar") ? "llvm-ar" : "ar";
+	default:
+		return "ar";
+	}
+}
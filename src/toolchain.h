@@ -0,0 +1,112 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2026 Aymeric Wibo
+
+/*
+ * Toolchain-specific knowledge.
+ *
+ * Most of what Bob asks of the C compiler is common to GCC and Clang, but some features (e.g. LTO) are spelled differently depending on which one '$CC' actually is.
+ * This figures that out once per process and translates the build script's intent into the right flags.
+ */
+
+#pragma once
+
+#include <cmd.h>
+
+#include <flamingo/flamingo.h>
+
+typedef enum {
+	TOOLCHAIN_UNKNOWN,
+	TOOLCHAIN_GCC,
+	TOOLCHAIN_CLANG,
+} toolchain_kind_t;
+
+typedef enum {
+	LTO_NONE = 0,
+	LTO_FULL,
+	LTO_THIN,
+} lto_t;
+
+/**
+ * Get the C compiler command to use.
+ *
+ * This is '$CC' if set, or "cc" otherwise.
+ *
+ * @return C compiler command.
+ */
+char const* toolchain_cc(void);
+
+/**
+ * Identify which toolchain '$CC' belongs to.
+ *
+ * This runs '$CC --version' the first time it is called, and caches the result for the rest of the process.
+ * This function is thread-safe.
+ *
+ * @param major Set to the major version of the compiler (0 if it couldn't be determined). May be NULL.
+ * @return Toolchain kind.
+ */
+toolchain_kind_t toolchain_kind(unsigned* major);
+
+/**
+ * Read the LTO mode of a 'Cc' or 'Linker' instance.
+ *
+ * This is set in the build script with the 'lto()' method, which sets the 'lto_mode' member.
+ *
+ * @param inst The instance.
+ * @param log_prefix Log prefix for error messages.
+ * @param lto Set to the LTO mode.
+ * @return 0 on success, -1 if the mode is invalid.
+ */
+int toolchain_get_lto(flamingo_val_t* inst, char const* log_prefix, lto_t* lto);
+
+/**
+ * Create the effective flags vector for a compile or link.
+ *
+ * These are the flags passed by the build script, plus whatever flags the build modes (like LTO or PGO) set.
+ * Because these are what's used to check if flags changed, switching build modes will trigger a rebuild.
+ * Only flags which affect the output artifact should go here; flags which only affect how the work is done (like the number of LTO jobs) are added with e.g. {@link toolchain_add_lto_link_args}.
+ *
+ * @param flags Flags vector passed by the build script.
+ * @param lto LTO mode.
+ * @return New reference to the flags vector, to be released with 'flamingo_val_decref()' (the original one is returned if no extra flags are needed).
+ */
+flamingo_val_t* toolchain_flags(flamingo_val_t* flags, lto_t lto);
+
+/**
+ * Add the arguments for a parallel LTO link to a link command.
+ *
+ * The number of LTO jobs is taken from Bob's job budget (see {@link ncpu}), and incremental LTO caches (when the toolchain supports them) are kept next to the output cookie.
+ *
+ * @param cmd Link command.
+ * @param lto LTO mode.
+ * @param flags Effective link flags (used to figure out which linker is used).
+ * @param out Output cookie path.
+ */
+void toolchain_add_lto_link_args(cmd_t* cmd, lto_t lto, flamingo_val_t* flags, char const* out);
+
+/**
+ * Get the archiver command to use.
+ *
+ * This is '$AR' if set, or "ar" otherwise.
+ * LTO objects need an archiver which understands them, so when LTO is enabled and '$AR' is not set, this returns the archiver which comes with the toolchain.
+ *
+ * @param lto LTO mode.
+ * @return Archiver command.
+ */
+char const* toolchain_ar(lto_t lto);
+
+/**
+ * Get the path to the PGO profile which an object file is optimized with.
+ *
+ * Rebuilding the object when this changes is what makes retraining take effect.
+ *
+ * @param out Output cookie path of the object.
+ * @return Path to the profile (to be freed by the caller), or NULL if not in {@link PGO_USE} mode or if there's no profile for this object.
+ */
+char* toolchain_pgo_profile(char const* out);
+
+/**
+ * Merge the raw profiles written by the instrumented build into the profiles used by {@link PGO_USE} mode.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int toolchain_pgo_merge(void);
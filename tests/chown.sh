@@ -64,6 +64,41 @@ if [ $dep_owner != "root" ]; then
 	exit 1
 fi
 
+# When owning the prefix, a symlink installed into it should be chown'd itself, never whatever it points to.
+# Here, the symlink points to a file owned by root outside of anything Bob is allowed to touch.
+
+LINK_PROJ=$(realpath $TEST_OUT)/chown_link
+LINK_PREFIX=$LINK_PROJ/prefix
+LINK_TARGET=$(realpath $TEST_OUT)/chown_link_target
+
+SUDO rm -rf $LINK_PROJ $LINK_TARGET
+mkdir -p $LINK_PROJ $LINK_PREFIX
+SUDO touch $LINK_TARGET
+ln -s $LINK_TARGET $LINK_PROJ/link
+
+build_fl $LINK_PROJ <<EOF
+install = {
+	"link": "share/link",
+}
+EOF
+
+SUDO chown -Rh bobtestuser $LINK_PROJ
+SUDO bob -C $LINK_PROJ -p $LINK_PREFIX -O install
+
+if [ ! -L $LINK_PREFIX/share/link ]; then
+	echo "Symlink was not installed as a symlink." >&2
+	exit 1
+fi
+
+target_owner=$(ls -ld $LINK_TARGET | awk '{print $3}')
+
+if [ $target_owner != "root" ]; then
+	echo "Target of a symlink installed into an owned prefix was chown'd." >&2
+	exit 1
+fi
+
+SUDO rm -rf $LINK_PROJ $LINK_TARGET
+
 # chown back to the original user, so things aren't annoying.
 
 uid=$(id -u)
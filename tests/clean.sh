@@ -19,3 +19,53 @@ if [ -d .bob/$BOB_TARGET ]; then
 	 echo "Clean did not remove output directory."
 	 exit 1
 fi
+
+# The output directory is removed in the background, so building again straight away should work.
+# Symlinks in it should never be followed.
+
+mkdir -p $TEST_OUT/linked
+touch $TEST_OUT/linked/file
+
+.bootstrap/bob build
+ln -s $(pwd)/$TEST_OUT/linked .bob/$BOB_TARGET/link
+
+.bootstrap/bob clean < /dev/null
+.bootstrap/bob build
+
+[ -d .bob/$BOB_TARGET ]
+
+for i in $(seq 1 100); do
+	if [ -z "$(ls -d .bob/$BOB_TARGET.trash.* 2>/dev/null)" ]; then
+		break
+	fi
+
+	sleep 0.1
+done
+
+if [ -n "$(ls -d .bob/$BOB_TARGET.trash.* 2>/dev/null)" ]; then
+	echo "Output directory was never removed in the background."
+	exit 1
+fi
+
+[ -f $TEST_OUT/linked/file ]
+
+# Trash left behind by a removal which never finished (e.g. because it was killed) should be removed the next time the project is opened.
+
+# Anything else next to the output directory which just happens to look like trash isn't ours, and should be left alone.
+
+mkdir -p .bob/$BOB_TARGET.trash.STALE1/sub .bob/$BOB_TARGET/bob.trash.STALE2 .bob/notes.trash.backup
+touch .bob/$BOB_TARGET.trash.STALE1/file .bob/$BOB_TARGET.trash.STALE1/sub/file .bob/$BOB_TARGET/bob.trash.STALE2/file .bob/notes.trash.backup/file
+
+.bootstrap/bob build
+
+if [ -e .bob/$BOB_TARGET.trash.STALE1 ] || [ -e .bob/$BOB_TARGET/bob.trash.STALE2 ]; then
+	echo "Stale trash was not removed."
+	exit 1
+fi
+
+if [ ! -f .bob/notes.trash.backup/file ]; then
+	echo "Something which wasn't trash was removed."
+	exit 1
+fi
+
+rm -r .bob/notes.trash.backup
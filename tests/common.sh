@@ -3,6 +3,7 @@
 export ASAN_OPTIONS=detect_leaks=0 # XXX For now, let's not worry about leaks.
 export TEST_OUT=.test-out
 export BOB_DEPS_PATH=$(pwd)/.deps
+export BOB_PREBUILT_PATH=$(pwd)/$TEST_OUT/prebuilt
 export BOB_TARGET=bob-testing-target
 
 # Find doas or sudo.
@@ -21,6 +22,16 @@ else
 	exit 1
 fi
 
+# Write a build script for a generated project, whose body (i.e. everything after the import) is read from stdin.
+
+build_fl() {
+	(
+		echo "import bob"
+		echo
+		cat
+	) > $1/build.fl
+}
+
 # Some multi-platform functions.
 
 generic_timeout() {
@@ -0,0 +1,18 @@
+#!/bin/sh
+set -e
+
+. tests/common.sh
+
+BOB_PATH=tests/static_link/.bob
+rm -rf $BOB_PATH
+
+OUT=$BOB_PATH/$BOB_TARGET/bob
+
+# Cookies should be sharded, not all in the output path directly.
+
+bob -C tests/static_link build
+
+[ -f $OUT/*/*/lib1.c.cookie.*.o ]
+[ -f $OUT/*/*/lib1.c.cookie.*.o.flags ]
+! ls $OUT | grep -q "lib1.c.cookie"
+
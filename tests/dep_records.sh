@@ -0,0 +1,58 @@
+#!/bin/sh
+set -e
+
+. tests/common.sh
+
+# Test that dependencies which are already installed aren't built again.
+
+cp tests/deps/build.normal.fl tests/deps/build.fl
+rm -rf tests/deps/.bob tests/deps/dep1/.bob tests/deps/dep2/.bob
+
+PREFIX=tests/deps/.bob/$BOB_TARGET/prefix
+
+bob -C tests/deps build >/dev/null 2>&1
+[ $(ls $PREFIX/share/bob/deps | wc -l) = 2 ]
+
+# Nothing changed, so neither dependency should be built.
+
+out=$(bob -C tests/deps build 2>&1)
+
+if echo "$out" | grep -q "Building dependency"; then
+	echo "Unchanged dependencies were built again: $out" >&2
+	exit 1
+fi
+
+# Removing something a dependency installed should only have that dependency built again.
+
+rm $PREFIX/include/dep2.h
+out=$(bob -C tests/deps build 2>&1)
+
+if ! echo "$out" | grep -q "dep2.*Building dependency" || echo "$out" | grep -q "dep1.*Building dependency"; then
+	echo "Only the dependency whose installed files changed should have been built again: $out" >&2
+	exit 1
+fi
+
+[ -f $PREFIX/include/dep2.h ]
+
+# The same goes for files in a directory a dependency installed.
+
+rm $PREFIX/share/dep2/sub/f
+out=$(bob -C tests/deps build 2>&1)
+
+if ! echo "$out" | grep -q "dep2.*Building dependency"; then
+	echo "Dependency whose installed directory changed wasn't built again: $out" >&2
+	exit 1
+fi
+
+[ -f $PREFIX/share/dep2/sub/f ]
+
+# Changing the sources of a dependency should have it, and everything depending on it, built again.
+
+sleep 1
+touch tests/deps/dep2/dep2.h
+out=$(bob -C tests/deps build 2>&1)
+
+if [ $(echo "$out" | grep -c "Building dependency") != 2 ]; then
+	echo "Changed dependency and its dependants weren't built again: $out" >&2
+	exit 1
+fi
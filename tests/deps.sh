@@ -17,3 +17,15 @@ if [ $? != 0 ]; then
 	echo "Failed to run binary pre-installed by dependency: $out" >&2
 	exit 1
 fi
+
+# 'dep2' is a dependency of both the project and 'dep1', so it should only be built once, and before 'dep1'.
+
+if [ $(echo "$out" | grep -c "dep2.*Building dependency") != 1 ]; then
+	echo "Shared dependency was not built exactly once: $out" >&2
+	exit 1
+fi
+
+if [ "$(echo "$out" | grep "Building dependency" | head -n1 | grep -c dep2)" != 1 ]; then
+	echo "Dependency was built before its own dependency: $out" >&2
+	exit 1
+fi
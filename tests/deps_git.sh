@@ -0,0 +1,159 @@
+#!/bin/sh
+set -e
+
+. tests/common.sh
+
+# Test git dependencies, using local repos so we don't need network access.
+# 'a' and 'b' both depend on 'c', so their dependency trees are discovered (and 'c' is cloned) concurrently.
+
+export BOB_DEPS_PATH=$(realpath $TEST_OUT)/deps_git/deps
+export BOB_PREBUILT_PATH=$(realpath $TEST_OUT)/deps_git/prebuilt
+REPOS=$(realpath $TEST_OUT)/deps_git/repos
+PROJ=$TEST_OUT/deps_git/proj
+PROJ2=$TEST_OUT/deps_git/proj2
+
+rm -rf $TEST_OUT/deps_git
+mkdir -p $REPOS $PROJ $PROJ2
+
+repo() {
+	mkdir $REPOS/$1
+	echo "int $1(void) { return 0; }" > $REPOS/$1/$1.c
+
+	build_fl $REPOS/$1 <<EOF
+deps = [$2]
+
+install = {
+	Linker(["-shared"]).link(Cc(["-fPIC"]).compile(["$1.c"])): "lib/lib$1.so",
+}
+EOF
+
+	git -C $REPOS/$1 init -q -b main
+	git -C $REPOS/$1 add .
+	git -C $REPOS/$1 -c user.name=bob -c user.email=bob@example.com commit -q -m "Initial commit"
+}
+
+repo c ""
+repo a "Dep.git(\"file://$REPOS/c\", \"main\")"
+repo b "Dep.git(\"file://$REPOS/c\", \"main\")"
+
+echo "int main(void) { return 0; }" > $PROJ/main.c
+
+build_fl $PROJ <<EOF
+deps = [
+	Dep.git("file://$REPOS/a", "main"),
+	Dep.git("file://$REPOS/b", "main"),
+]
+
+Cc([]).compile(["main.c"])
+EOF
+
+out=$(bob -C $PROJ build 2>&1)
+
+# Every repo should've been cloned into the dependency cache exactly once, without leaving any temporary clones around.
+
+for dep in a b c; do
+	if [ $(ls -d $BOB_DEPS_PATH/$dep.*.git | wc -l) != 1 ]; then
+		echo "Git dependency '$dep' wasn't cloned exactly once: $out" >&2
+		exit 1
+	fi
+done
+
+if ls -d $BOB_DEPS_PATH/*.tmp.* >/dev/null 2>&1; then
+	echo "Temporary clones were left in the dependency cache." >&2
+	exit 1
+fi
+
+# 'c' is shared by 'a' and 'b', so it should only be built once, and before both of them.
+
+if [ $(echo "$out" | grep -c "^c.*Building dependency") != 1 ]; then
+	echo "Shared git dependency was not built exactly once: $out" >&2
+	exit 1
+fi
+
+if [ "$(echo "$out" | grep "Building dependency" | head -n1 | grep -c "^c")" != 1 ]; then
+	echo "Git dependency was built before its own dependency: $out" >&2
+	exit 1
+fi
+
+# Nothing should be cloned again on the next build.
+
+if bob -C $PROJ build 2>&1 | grep -q "Git cloning"; then
+	echo "Git dependencies were cloned again." >&2
+	exit 1
+fi
+
+# Another project needing the same dependencies shouldn't have to build them again, and should just get them from the prebuilt cache.
+
+echo "int main(void) { return 0; }" > $PROJ2/main.c
+
+build_fl $PROJ2 <<EOF
+deps = [
+	Dep.git("file://$REPOS/a", "main"),
+]
+
+Cc([]).compile(["main.c"])
+EOF
+
+out=$(bob -C $PROJ2 build 2>&1)
+
+if echo "$out" | grep -q "Building dependency"; then
+	echo "Prebuilt dependencies were built again: $out" >&2
+	exit 1
+fi
+
+if [ $(echo "$out" | grep -c "Installed dependency from prebuilt cache") != 2 ]; then
+	echo "Dependencies weren't installed from the prebuilt cache: $out" >&2
+	exit 1
+fi
+
+for dep in a c; do
+	if [ ! -f $PROJ2/.bob/$BOB_TARGET/prefix/lib/lib$dep.so ]; then
+		echo "Prebuilt dependency '$dep' wasn't installed into the prefix." >&2
+		exit 1
+	fi
+done
+
+# Once installed from the cache, dependencies are recorded like any other.
+
+if ! bob -C $PROJ2 build 2>&1 | grep -q "^a.*Dependency already installed"; then
+	echo "Dependency installed from the prebuilt cache wasn't recorded." >&2
+	exit 1
+fi
+
+# The same repo built from two different build paths is two different dependencies, both of which should be built.
+
+mkdir -p $REPOS/multi/x $REPOS/multi/y $TEST_OUT/deps_git/proj3
+
+for sub in x y; do
+	echo "int $sub(void) { return 0; }" > $REPOS/multi/$sub/$sub.c
+
+	build_fl $REPOS/multi/$sub <<EOF
+install = {
+	Linker(["-shared"]).link(Cc(["-fPIC"]).compile(["$sub.c"])): "lib/lib$sub.so",
+}
+EOF
+done
+
+git -C $REPOS/multi init -q -b main
+git -C $REPOS/multi add .
+git -C $REPOS/multi -c user.name=bob -c user.email=bob@example.com commit -q -m "Initial commit"
+
+echo "int main(void) { return 0; }" > $TEST_OUT/deps_git/proj3/main.c
+
+build_fl $TEST_OUT/deps_git/proj3 <<EOF
+deps = [
+	Dep.git("file://$REPOS/multi", "main").cd("x"),
+	Dep.git("file://$REPOS/multi", "main").cd("y"),
+]
+
+Cc([]).compile(["main.c"])
+EOF
+
+out=$(bob -C $TEST_OUT/deps_git/proj3 build 2>&1)
+
+for sub in x y; do
+	if [ ! -f $TEST_OUT/deps_git/proj3/.bob/$BOB_TARGET/prefix/lib/lib$sub.so ]; then
+		echo "Dependency built from build path '$sub' wasn't installed: $out" >&2
+		exit 1
+	fi
+done
@@ -0,0 +1,54 @@
+#!/bin/sh
+
+. tests/common.sh
+
+# Test building Bob dependencies in-process.
+
+export BOB_DEPS_IN_PROCESS=1
+
+cp tests/deps/build.normal.fl tests/deps/build.fl
+rm -rf tests/deps/.bob tests/deps/dep1/.bob tests/deps/dep2/.bob
+
+out=$(bob -C tests/deps run dep2 2>&1)
+
+if [ $? != 0 ]; then
+	echo "Failed to run binary pre-installed by in-process dependency: $out" >&2
+	exit 1
+fi
+
+# Both dependencies should've been built in this process, not by a child Bob.
+
+if [ $(echo "$out" | grep -c "Successfully built dependency in-process") != 2 ] || echo "$out" | grep -q "Successfully built dependency\."; then
+	echo "Dependencies weren't built in-process: $out" >&2
+	exit 1
+fi
+
+# A child Bob's output is only shown if it fails, so the dependencies' own logs showing up also means they were built here.
+
+if ! echo "$out" | grep -q "bin/dep2.*Successfully linked"; then
+	echo "In-process dependency's own build wasn't logged: $out" >&2
+	exit 1
+fi
+
+# Each dependency should've been built in its own output path, not in the project's.
+
+if [ ! -d tests/deps/dep1/.bob ] || [ ! -d tests/deps/dep2/.bob ]; then
+	echo "In-process dependencies weren't built in their own output paths." >&2
+	exit 1
+fi
+
+# The project itself should still have been built after its dependencies.
+
+if ! ls tests/deps/.bob/$BOB_TARGET/bob/*/*/main.c.cookie.*.o >/dev/null 2>&1; then
+	echo "Project wasn't built after its in-process dependencies: $out" >&2
+	exit 1
+fi
+
+# Building again shouldn't rebuild anything, in the project or its dependencies.
+
+out=$(bob -C tests/deps build 2>&1)
+
+if [ $? != 0 ] || echo "$out" | grep -q "Compiling"; then
+	echo "Rebuilding with in-process dependencies wasn't a no-op: $out" >&2
+	exit 1
+fi
@@ -30,9 +30,9 @@ build() {
 }
 
 get_mtimes() {
-	export src1_${1}mtime=$(date -r $BOB_PATH/$BOB_TARGET/bob/src1.c.cookie.6531c664ecf.o +%s)
-	export src2_${1}mtime=$(date -r $BOB_PATH/$BOB_TARGET/bob/src2.c.cookie.6531c665310.o +%s)
-	export linked_${1}mtime=$(date -r $BOB_PATH/$BOB_TARGET/bob/linker.link.cookie.12a65fcdd69986e8.l +%s)
+	export src1_${1}mtime=$(date -r $BOB_PATH/$BOB_TARGET/bob/*/*/src1.c.cookie.6531c664ecf.o +%s)
+	export src2_${1}mtime=$(date -r $BOB_PATH/$BOB_TARGET/bob/*/*/src2.c.cookie.6531c665310.o +%s)
+	export linked_${1}mtime=$(date -r $BOB_PATH/$BOB_TARGET/bob/linker.link.cookie.*.l +%s)
 
 	export obj1_${1}mtime=$(date -r $BOB_PATH/$BOB_TARGET/prefix/obj1.o +%s)
 	export obj2_${1}mtime=$(date -r $BOB_PATH/$BOB_TARGET/prefix/obj2.o +%s)
@@ -46,19 +46,20 @@ update() {
 	build
 	get_mtimes ""
 
-	# If the mtime of the installed file is less than that of the cookie, then it was not reinstalled, which is bad!.
+	# If the installed file differs from the cookie, then it was not reinstalled, which is bad!.
+	# Note that an installed file may well be older than its cookie, if the cookie was rebuilt with the exact same contents.
 
-	if [ $obj1_mtime -lt $src1_mtime ]; then
+	if ! cmp -s $BOB_PATH/$BOB_TARGET/bob/*/*/src1.c.cookie.6531c664ecf.o $BOB_PATH/$BOB_TARGET/prefix/obj1.o; then
 		echo "obj1.o's cookie was updated, but it was not preinstalled." >&2
 		exit 1
 	fi
 
-	if [ $obj2_mtime -lt $src2_mtime ]; then
+	if ! cmp -s $BOB_PATH/$BOB_TARGET/bob/*/*/src2.c.cookie.6531c665310.o $BOB_PATH/$BOB_TARGET/prefix/obj2.o; then
 		echo "obj2.o's cookie was updated, but it was not preinstalled." >&2
 		exit 1
 	fi
 
-	if [ $bin_mtime -lt $linked_mtime ]; then
+	if ! cmp -s $BOB_PATH/$BOB_TARGET/bob/linker.link.cookie.*.l $BOB_PATH/$BOB_TARGET/prefix/bin; then
 		echo "bin's cookie was updated, but it was not preinstalled." >&2
 		exit 1
 	fi
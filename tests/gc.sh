@@ -0,0 +1,84 @@
+#!/bin/sh
+set -e
+
+. tests/common.sh
+
+# Generate a project whose sources we can remove.
+
+PROJ=$TEST_OUT/gc
+OUT=$PROJ/.bob/$BOB_TARGET/bob
+mkdir -p $PROJ
+
+gen() {
+	build_fl $PROJ <<EOF
+let obj = Cc([]).compile([$1])
+let cmd = Linker([]).link(obj)
+
+install = {
+	cmd: "bin/cmd",
+	$2
+}
+EOF
+}
+
+echo "int main(void) { return 0; }" > $PROJ/main.c
+echo "int a(void) { return 0; }" > $PROJ/a.c
+echo "int b(void) { return 0; }" > $PROJ/b.c
+
+gen '"main.c", "a.c", "b.c"'
+bob -C $PROJ build
+
+[ -f $OUT/*/*/a.c.cookie.*.o ]
+[ -f $OUT/*/*/b.c.cookie.*.o ]
+
+# Nothing was removed, so nothing should be collected.
+
+bob -C $PROJ gc | grep -q "Nothing to collect"
+
+# Remove 'b.c'.
+# Its cookies are still referenced by the previous build's manifest, so they shouldn't be collected until that manifest is too old.
+
+rm $PROJ/b.c
+gen '"main.c", "a.c"'
+
+bob -C $PROJ build
+bob -C $PROJ gc
+
+[ -f $OUT/*/*/a.c.cookie.*.o ]
+[ -f $OUT/*/*/b.c.cookie.*.o ]
+
+BOB_GC_KEEP=1 bob -C $PROJ gc | grep -q "Removed"
+
+[ -f $OUT/*/*/a.c.cookie.*.o ]
+[ -f $OUT/*/*/main.c.cookie.*.o ]
+! ls $OUT/*/*/b.c.cookie.* 2>/dev/null
+[ $(ls $OUT/manifests | wc -l) = 1 ]
+
+# The old linker cookie should've been collected too, but not the current one.
+
+[ $(ls $OUT/linker.link.cookie.*.l | wc -l) = 1 ]
+
+# Nothing still referenced was collected, so rebuilding shouldn't recompile anything.
+
+bob -C $PROJ build | grep -q "up to date"
+
+# Records of installed files found to be identical to their sources should be collected once their sources are gone.
+
+echo "data" > $PROJ/data.txt
+
+rm -rf $TEST_OUT/gc_prefix
+mkdir -p $TEST_OUT/gc_prefix
+PREFIX=$(realpath $TEST_OUT/gc_prefix)
+
+gen '"main.c", "a.c"' '"data.txt": "share/data.txt",'
+bob -C $PROJ -p $PREFIX install >/dev/null
+
+sleep 1
+touch $PROJ/data.txt
+bob -C $PROJ -p $PREFIX install | grep -q "Unchanged, so already installed"
+[ $(ls $OUT/installed | wc -l) = 1 ]
+
+rm $PROJ/data.txt
+gen '"main.c", "a.c"'
+bob -C $PROJ gc | grep -q "Removed"
+[ $(ls $OUT/installed | wc -l) = 0 ]
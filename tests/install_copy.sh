@@ -0,0 +1,53 @@
+#!/bin/sh
+set -e
+
+. tests/common.sh
+
+BOB_PATH=tests/static_link/.bob
+rm -rf $BOB_PATH
+
+CMD=$BOB_PATH/$BOB_TARGET/prefix/bin/cmd
+
+# Installed files should be identical to their cookies, with the same permissions.
+
+bob -C tests/static_link build
+[ -x $CMD ]
+
+mkdir -p $TEST_OUT/prefix
+bob -C tests/static_link -p $(pwd)/$TEST_OUT/prefix install
+
+cmp $CMD $TEST_OUT/prefix/bin/cmd
+cmp $BOB_PATH/$BOB_TARGET/prefix/lib/lib1.a $TEST_OUT/prefix/lib/lib1.a
+[ -x $TEST_OUT/prefix/bin/cmd ]
+
+# Rebuilding a cookie with the exact same contents shouldn't touch the installed file.
+
+sleep 1
+touch $TEST_OUT/before tests/static_link/lib1.c
+bob -C tests/static_link -p $(pwd)/$TEST_OUT/prefix install
+
+[ $BOB_PATH/$BOB_TARGET/bob/*/*/lib1.c.cookie.*.o -nt $TEST_OUT/before ]
+[ ! $TEST_OUT/prefix/lib/lib1.a -nt $TEST_OUT/before ]
+
+# Hardlinking only works natively, which is only done on Linux.
+
+if [ $(uname) != Linux ]; then
+	exit 0
+fi
+
+# By default, files in the temporary prefix are copies.
+
+[ $(stat -c %h $CMD) = 1 ]
+
+# When asked to, files in the temporary prefix are hardlinked to their cookies instead.
+
+rm -rf $BOB_PATH
+BOB_INSTALL_HARDLINKS=1 bob -C tests/static_link build
+[ $(stat -c %h $CMD) = 2 ]
+
+# But never in other prefixes.
+
+rm -rf $TEST_OUT/prefix
+mkdir -p $TEST_OUT/prefix
+BOB_INSTALL_HARDLINKS=1 bob -C tests/static_link -p $(pwd)/$TEST_OUT/prefix install
+[ $(stat -c %h $TEST_OUT/prefix/bin/cmd) = 1 ]
@@ -0,0 +1,45 @@
+#!/bin/sh
+set -e
+
+. tests/common.sh
+
+# Generate a project which installs a directory.
+
+PROJ=$TEST_OUT/install_dir
+PREFIX=$(pwd)/$TEST_OUT/prefix
+DST=$PREFIX/share/install_dir
+mkdir -p $PROJ/share/sub $PREFIX
+
+build_fl $PROJ <<EOF
+install = {
+	"share": "share/install_dir",
+}
+EOF
+
+echo a > $PROJ/share/a
+echo b > $PROJ/share/sub/b
+ln -s a $PROJ/share/link
+
+bob -C $PROJ -p $PREFIX install
+
+[ "$(cat $DST/a)" = a ]
+[ "$(cat $DST/sub/b)" = b ]
+[ "$(readlink $DST/link)" = a ]
+
+# Nothing changed, so nothing should be copied.
+
+sleep 1
+touch $TEST_OUT/before
+bob -C $PROJ -p $PREFIX install | grep -q "Already installed"
+
+# Only the changed file should be copied, and files removed from the source should be removed from the destination.
+
+echo c > $PROJ/share/sub/b
+rm $PROJ/share/a
+
+bob -C $PROJ -p $PREFIX install
+
+[ "$(cat $DST/sub/b)" = c ]
+[ ! -e $DST/a ]
+[ $DST/sub/b -nt $TEST_OUT/before ]
+[ ! $DST/link -nt $TEST_OUT/before ]
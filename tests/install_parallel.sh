@@ -0,0 +1,88 @@
+#!/bin/sh
+set -e
+
+. tests/common.sh
+
+# Generate a project which installs a lot of files to a few directories.
+
+PROJ=$TEST_OUT/install_parallel
+PREFIX=$(pwd)/$TEST_OUT/prefix
+mkdir -p $PROJ $PREFIX
+
+(
+	echo "install = {"
+
+	for i in $(seq 1 50); do
+		echo "	\"$i.h\": \"include/dir$((i % 5))/$i.h\","
+	done
+
+	echo "}"
+) | build_fl $PROJ
+
+for i in $(seq 1 50); do
+	echo $i > $PROJ/$i.h
+done
+
+# Everything should be installed, and logged in the order of the install map even though entries are installed in parallel.
+
+bob -C $PROJ -p $PREFIX install > $TEST_OUT/out
+
+for i in $(seq 1 50); do
+	[ "$(cat $PREFIX/include/dir$((i % 5))/$i.h)" = $i ]
+done
+
+ESC=$(printf '\033')
+grep "installed" $TEST_OUT/out | sed "s/$ESC\[[0-9;]*m//g" | cut -d: -f1 > $TEST_OUT/order
+
+for i in $(seq 1 50); do
+	echo "include/dir$((i % 5))/$i.h"
+done | cmp - $TEST_OUT/order
+
+# Entries whose destinations overlap are installed in the order of the install map, not concurrently.
+# Here, the directory is synced first (removing whatever isn't in it), and only then are files nested under it installed.
+# Two entries sharing a destination mustn't race either.
+
+PROJ=$TEST_OUT/install_overlap
+mkdir -p $PROJ/dir
+
+(
+	echo "install = {"
+	echo "	\"dir\": \"share/x\","
+
+	for i in $(seq 1 20); do
+		echo "	\"$i.txt\": \"share/x/$i.txt\","
+	done
+
+	echo "	\"first.txt\": \"share/y\","
+	echo "	\"last.txt\": \"share/y\","
+	echo "}"
+) | build_fl $PROJ
+
+echo dir > $PROJ/dir/in_dir.txt
+
+# Make the directory big enough that syncing it takes a while.
+
+for i in $(seq 1 300); do
+	echo $i > $PROJ/dir/$i.dat
+done
+echo first > $PROJ/first.txt
+echo last > $PROJ/last.txt
+
+for i in $(seq 1 20); do
+	echo $i > $PROJ/$i.txt
+done
+
+for attempt in $(seq 1 5); do
+	PREFIX=$(pwd)/$TEST_OUT/overlap_prefix
+	rm -rf $PREFIX
+	mkdir -p $PREFIX
+
+	bob -C $PROJ -p $PREFIX install > /dev/null
+
+	[ "$(cat $PREFIX/share/x/in_dir.txt)" = dir ]
+	[ "$(cat $PREFIX/share/y)" = first ] || [ "$(cat $PREFIX/share/y)" = last ]
+
+	for i in $(seq 1 20); do
+		[ "$(cat $PREFIX/share/x/$i.txt)" = $i ]
+	done
+done
@@ -30,3 +30,51 @@ echo "$out" | grep -q "Bob was updated"
 
 [ -f $VERSION_FILE ]
 [ "$(cat $VERSION_FILE)" != "old-version" ]
+
+# If only the format of one kind of artifact changed, only that kind should be cleared.
+
+BOB_PATH=tests/static_link/.bob
+VERSION_FILE=$BOB_PATH/$BOB_TARGET/version
+rm -rf $BOB_PATH
+
+bob -C tests/static_link build > /dev/null 2>&1
+grep -q "^prefix " $VERSION_FILE
+
+sed "s/^prefix .*/prefix 0/" $VERSION_FILE > $TEST_OUT/version
+mv $TEST_OUT/version $VERSION_FILE
+
+out=$(bob -C tests/static_link build 2>&1)
+
+echo "$out" | grep -q "clearing prefix"
+echo "$out" | grep -q "up to date"
+echo "$out" | grep -q "Successfully preinstalled"
+
+[ -x $BOB_PATH/$BOB_TARGET/prefix/bin/cmd ]
+grep -q "^prefix [1-9]" $VERSION_FILE
+
+# Nothing changed this time around.
+
+out=$(bob -C tests/static_link build 2>&1)
+
+if echo "$out" | grep -q "Bob was updated"; then
+	exit 1
+fi
+
+# A change to how Bob invokes compilers should have everything built again.
+
+sed "s/^invocation .*/invocation 0/" $VERSION_FILE > $TEST_OUT/version
+mv $TEST_OUT/version $VERSION_FILE
+
+out=$(bob -C tests/static_link build 2>&1)
+
+echo "$out" | grep -q "clearing invocation"
+echo "$out" | grep -q "Compiling"
+
+# So should a change of compiler, which isn't something Bob can know about from its version.
+
+out=$(CC=$(command -v ${CC:-cc}) bob -C tests/static_link build 2>&1)
+
+if echo "$out" | grep -q "Bob was updated" || ! echo "$out" | grep -q "Compiling"; then
+	echo "Changing the compiler didn't rebuild everything: $out" >&2
+	exit 1
+fi
@@ -0,0 +1,61 @@
+#!/bin/sh
+set -e
+
+. tests/common.sh
+
+# Generate a source file which makes the compiler output a lot of warnings.
+
+PROJ=$TEST_OUT/log_stream
+BOB_PATH=$PROJ/.bob
+mkdir -p $PROJ
+
+build_fl $PROJ <<EOF
+let cmd = Linker([]).link(Cc([]).compile(["warn.c"]))
+EOF
+
+for i in $(seq 1 3000); do
+	echo "#warning warning number $i"
+done > $PROJ/warn.c
+
+echo "int main(void) { return 0; }" >> $PROJ/warn.c
+
+# The log file should have the full output.
+# It's also all printed as it comes in, each line prefixed by the source file.
+
+bob -C $PROJ build > $TEST_OUT/out
+
+LOG=$(echo $BOB_PATH/$BOB_TARGET/bob/*/*/warn.c.cookie.*.o.log)
+
+grep -q "warning number 1$" $LOG
+grep -q "warning number 3000$" $LOG
+grep -q "^warn.c.*: .*warning number 1$" $TEST_OUT/out
+grep -q "^warn.c.*: .*warning number 3000$" $TEST_OUT/out
+
+if grep -q "bytes of output elided" $TEST_OUT/out; then
+	exit 1
+fi
+
+# No temporary log files should be left behind.
+
+[ $(ls $BOB_PATH/$BOB_TARGET/bob | grep -c "\.log\.") = 0 ]
+
+# Up-to-date objects are only summarized, unless in verbose mode, in which case their cached warnings are replayed.
+
+bob -C $PROJ build > $TEST_OUT/out
+grep -q "1 object up to date (1 with cached warnings" $TEST_OUT/out
+
+if grep -q "warning number" $TEST_OUT/out; then
+	exit 1
+fi
+
+bob -C $PROJ -v build > $TEST_OUT/out
+grep -q "Already compiled" $TEST_OUT/out
+grep -q "warning number 3000$" $TEST_OUT/out
+
+# Once the warnings are gone, so should the log file be.
+
+sleep 1
+echo "int main(void) { return 0; }" > $PROJ/warn.c
+bob -C $PROJ build
+
+[ ! -f $LOG ]
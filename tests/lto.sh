@@ -0,0 +1,56 @@
+#!/bin/sh
+set -e
+
+. tests/common.sh
+
+BOB_PATH=tests/lto/.bob
+rm -rf $BOB_PATH
+
+CMD=$BOB_PATH/$BOB_TARGET/prefix/bin/cmd
+FLAGS="$BOB_PATH/$BOB_TARGET/bob/*/*/*.o.flags"
+
+# Build without LTO first.
+
+bob -C tests/lto build
+[ "$($CMD)" = 49 ]
+cmd_mtime=$(date -r $CMD +%s)
+
+# Enabling LTO changes the effective flags, so everything should be rebuilt.
+
+sleep 1
+LTO=full bob -C tests/lto build
+[ "$($CMD)" = 49 ]
+[ $cmd_mtime -lt $(date -r $CMD +%s) ]
+cmd_mtime=$(date -r $CMD +%s)
+
+grep -q -- -flto $FLAGS
+
+# Nothing changed, so nothing should be rebuilt.
+# Changing the number of jobs doesn't change the output either.
+
+sleep 1
+LTO=full bob -C tests/lto -j 1 build
+[ $cmd_mtime -eq $(date -r $CMD +%s) ]
+
+# Thin LTO (which is just regular LTO on GCC).
+
+LTO=thin bob -C tests/lto build
+[ "$($CMD)" = 49 ]
+
+# Invalid LTO modes should be rejected.
+
+if LTO=bogus bob -C tests/lto build 2>/dev/null; then
+	exit 1
+fi
+
+# Disabling LTO again should rebuild everything.
+
+sleep 1
+cmd_mtime=$(date -r $CMD +%s)
+bob -C tests/lto build
+[ "$($CMD)" = 49 ]
+[ $cmd_mtime -lt $(date -r $CMD +%s) ]
+
+if grep -q -- -flto $FLAGS; then
+	exit 1
+fi
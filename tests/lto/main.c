@@ -0,0 +1,11 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2026 Aymeric Wibo
+
+#include <stdio.h>
+
+int square(int x);
+
+int main(void) {
+	printf("%d\n", square(7));
+	return 0;
+}
@@ -0,0 +1,58 @@
+#!/bin/sh
+set -e
+
+. tests/common.sh
+
+BOB_PATH=tests/pgo/.bob
+rm -rf $BOB_PATH
+
+CMD=$BOB_PATH/$BOB_TARGET/prefix/bin/cmd
+PGO_CMD=$BOB_PATH/$BOB_TARGET/pgo/prefix/bin/cmd
+LINKED="$BOB_PATH/$BOB_TARGET/bob/linker.link.cookie.*.l"
+PROFILE=$BOB_PATH/$BOB_TARGET/pgo/profile
+FLAGS="$BOB_PATH/$BOB_TARGET/bob/*/*/*.o.flags"
+
+# Reusing profiles shouldn't work if we never trained.
+
+if BOB_PGO=use bob -C tests/pgo build 2>/dev/null; then
+	exit 1
+fi
+
+# Train and build the optimized project.
+# The instrumented build should be kept separate from the optimized one.
+
+bob -C tests/pgo pgo
+
+[ -x $PGO_CMD ]
+[ -x $CMD ]
+[ -n "$(ls $PROFILE)" ]
+[ "$($CMD)" = 999 ]
+
+grep -q -- -fprofile-use $FLAGS
+grep -q -- -fprofile-generate $BOB_PATH/$BOB_TARGET/bob.pgo-gen/*/*/*.o.flags
+
+# Reusing the profiles shouldn't rebuild anything.
+
+linked_mtime=$(date -r $LINKED +%s)
+
+sleep 1
+BOB_PGO=use bob -C tests/pgo build
+[ $linked_mtime -eq $(date -r $LINKED +%s) ]
+
+# Retraining should rebuild, as the profiles changed.
+# The installed command itself may not change though, as training on the same input gives the same profiles, so look at the linked cookie instead.
+
+sleep 1
+bob -C tests/pgo pgo
+[ $linked_mtime -lt $(date -r $LINKED +%s) ]
+linked_mtime=$(date -r $LINKED +%s)
+
+# Building without PGO should rebuild without profiles.
+
+sleep 1
+bob -C tests/pgo build
+[ $linked_mtime -lt $(date -r $LINKED +%s) ]
+
+if grep -q -- -fprofile $FLAGS; then
+	exit 1
+fi
@@ -0,0 +1,15 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2026 Aymeric Wibo
+
+#include <stdio.h>
+
+int main(int argc, char* argv[]) {
+	unsigned sum = 0;
+
+	for (int i = 0; i < 1000; i++) {
+		sum += i % (argc + 2);
+	}
+
+	printf("%u\n", sum);
+	return 0;
+}
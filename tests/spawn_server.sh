@@ -0,0 +1,34 @@
+#!/bin/sh
+set -e
+
+. tests/common.sh
+
+export BOB_SPAWN_SERVER=1
+
+BOB_PATH=tests/static_link/.bob
+rm -rf $BOB_PATH
+
+CMD=$BOB_PATH/$BOB_TARGET/prefix/bin/cmd
+
+# Building through the spawn server should work just like building without it.
+
+bob -C tests/static_link build
+[ -x $CMD ]
+
+# Failing commands should still fail the build.
+
+sleep 1
+cp tests/static_link/lib1.c $TEST_OUT/lib1.c
+echo "syntax error" >> tests/static_link/lib1.c
+
+if bob -C tests/static_link build; then
+	cp $TEST_OUT/lib1.c tests/static_link/lib1.c
+	exit 1
+fi
+
+cp $TEST_OUT/lib1.c tests/static_link/lib1.c
+bob -C tests/static_link build
+
+# The benchmark should run both paths.
+
+bob spawn-bench 10 1 | grep -q "spawns/s"
@@ -7,16 +7,36 @@ set -e
 # https://github.com/inobulles/bob/pull/85
 # https://github.com/inobulles/bob/pull/120
 
-BOB_PATH=tests/static_link/.bob
+# Touching a library's source isn't enough to test relinking, as a library rebuilt with the exact same contents isn't reinstalled.
+# So actually change the source, on a copy of the project so the fixture itself is never modified.
+
+PROJ=$TEST_OUT/static_link
+rm -rf $PROJ
+mkdir -p $TEST_OUT
+cp -R tests/static_link $PROJ
+rm -rf $(find $PROJ -name .bob)
+
+modifications=0
+
+modify() {
+	modifications=$((modifications + 1))
+	echo "int modification_$modifications;" >> $1
+}
+
+BOB_PATH=$PROJ/.bob
 rm -rf $BOB_PATH
 
 LIB1=$BOB_PATH/$BOB_TARGET/prefix/lib/lib1.a
 LIB2=$BOB_PATH/$BOB_TARGET/prefix/lib/lib2.a
-CMD=$BOB_PATH/$BOB_TARGET/prefix/bin/cmd
+
+# Look at the linked cookie rather than the installed command to tell if it was relinked.
+# Relinking can produce the exact same command (e.g. if it doesn't use what changed in a library), in which case it isn't reinstalled.
+
+CMD="$BOB_PATH/$BOB_TARGET/bob/linker.link.cookie.*.l"
 
 # Build everything and get initial times.
 
-bob -C tests/static_link build
+bob -C $PROJ build
 lib1_mtime=$(date -r $LIB1 +%s)
 lib2_mtime=$(date -r $LIB2 +%s)
 cmd_mtime=$(date -r $CMD +%s)
@@ -25,7 +45,7 @@ cmd_mtime=$(date -r $CMD +%s)
 # We expect none of the files to be rebuilt.
 
 sleep 1
-bob -C tests/static_link build
+bob -C $PROJ build
 
 [ $lib1_mtime -eq $(date -r $LIB1 +%s) ]
 [ $lib2_mtime -eq $(date -r $LIB2 +%s) ]
@@ -35,8 +55,8 @@ bob -C tests/static_link build
 # cmd doesn't depend on this, so we only expect lib2 to be rebuilt.
 
 sleep 1
-touch tests/static_link/lib2.c
-bob -C tests/static_link build
+modify $PROJ/lib2.c
+bob -C $PROJ build
 
 new_lib2_mtime=$(date -r $LIB2 +%s)
 
@@ -50,8 +70,8 @@ lib2_mtime=$new_lib2_mtime
 # cmd does depend on this, so we expect cmd to be rebuilt as well.
 
 sleep 1
-touch tests/static_link/lib1.c
-bob -C tests/static_link build
+modify $PROJ/lib1.c
+bob -C $PROJ build
 
 new_lib1_mtime=$(date -r $LIB1 +%s)
 new_cmd_mtime=$(date -r $CMD +%s)
@@ -60,84 +80,97 @@ new_cmd_mtime=$(date -r $CMD +%s)
 [ $lib2_mtime -eq $(date -r $LIB2 +%s) ]
 [ $cmd_mtime -lt $new_cmd_mtime ]
 
+# Touch lib1 without changing it.
+# It's rebuilt with the exact same contents, so it shouldn't be reinstalled, and the next builds shouldn't even have to compare it with its installed copy again.
+
+sleep 1
+touch $PROJ/lib1.c
+bob -C $PROJ build | grep -q "lib/lib1.a.*Unchanged"
+[ $new_lib1_mtime -eq $(date -r $LIB1 +%s) ]
+
+if bob -C $PROJ build | grep -q "lib/lib1.a.*Preinstalling"; then
+	echo "Library rebuilt with the same contents was compared with its installed copy again." >&2
+	exit 1
+fi
+
 # Test: changed static lib in install_prefix/lib causes relink.
 
-BOB_PATH=tests/static_link/dash_l/.bob
-CMD=$BOB_PATH/$BOB_TARGET/prefix/bin/cmd
+BOB_PATH=$PROJ/dash_l/.bob
+CMD="$BOB_PATH/$BOB_TARGET/bob/linker.link.cookie.*.l"
 rm -rf $BOB_PATH
 
-bob -C tests/static_link/dash_l build
+bob -C $PROJ/dash_l build
 cmd_mtime=$(date -r $CMD +%s)
 
 sleep 1
-bob -C tests/static_link/dash_l build
+bob -C $PROJ/dash_l build
 [ $cmd_mtime -eq $(date -r $CMD +%s) ]
 
 sleep 1
-touch tests/static_link/dash_l/lib.c
-bob -C tests/static_link/dash_l build
+modify $PROJ/dash_l/lib.c
+bob -C $PROJ/dash_l build
 [ $cmd_mtime -lt $(date -r $CMD +%s) ]
 
 # Test: changed static lib in a custom -L search path causes relink.
 
-BOB_PATH=tests/static_link/custom_l/.bob
-CMD=$BOB_PATH/$BOB_TARGET/prefix/bin/cmd
-rm -rf $BOB_PATH tests/static_link/custom_l/custom-libs
+BOB_PATH=$PROJ/custom_l/.bob
+CMD="$BOB_PATH/$BOB_TARGET/bob/linker.link.cookie.*.l"
+rm -rf $BOB_PATH $PROJ/custom_l/custom-libs
 
-mkdir -p tests/static_link/custom_l/custom-libs
-printf 'void custom_fn(void){}\n' | cc -x c - -c -o tests/static_link/custom_l/custom-libs/empty.o
-ar rcs tests/static_link/custom_l/custom-libs/libcustom.a tests/static_link/custom_l/custom-libs/empty.o
+mkdir -p $PROJ/custom_l/custom-libs
+printf 'void custom_fn(void){}\n' | cc -x c - -c -o $PROJ/custom_l/custom-libs/empty.o
+ar rcs $PROJ/custom_l/custom-libs/libcustom.a $PROJ/custom_l/custom-libs/empty.o
 
-bob -C tests/static_link/custom_l build
+bob -C $PROJ/custom_l build
 cmd_mtime=$(date -r $CMD +%s)
 
 sleep 1
-bob -C tests/static_link/custom_l build
+bob -C $PROJ/custom_l build
 [ $cmd_mtime -eq $(date -r $CMD +%s) ]
 
 sleep 1
-touch tests/static_link/custom_l/custom-libs/libcustom.a
-bob -C tests/static_link/custom_l build
+touch $PROJ/custom_l/custom-libs/libcustom.a
+bob -C $PROJ/custom_l build
 [ $cmd_mtime -lt $(date -r $CMD +%s) ]
 
 # Test: changed static lib given by -l: causes relink.
 # The -l: syntax is not supported by the Apple linker, so skip on macOS.
 
 if [ $(uname) != Darwin ]; then
-	BOB_PATH=tests/static_link/colon_l/.bob
-	CMD=$BOB_PATH/$BOB_TARGET/prefix/bin/cmd
+	BOB_PATH=$PROJ/colon_l/.bob
+	CMD="$BOB_PATH/$BOB_TARGET/bob/linker.link.cookie.*.l"
 	rm -rf $BOB_PATH
 
-	bob -C tests/static_link/colon_l build
+	bob -C $PROJ/colon_l build
 	cmd_mtime=$(date -r $CMD +%s)
 
 	sleep 1
-	bob -C tests/static_link/colon_l build
+	bob -C $PROJ/colon_l build
 	[ $cmd_mtime -eq $(date -r $CMD +%s) ]
 
 	sleep 1
-	touch tests/static_link/colon_l/lib.c
-	bob -C tests/static_link/colon_l build
+	modify $PROJ/colon_l/lib.c
+	bob -C $PROJ/colon_l build
 	[ $cmd_mtime -lt $(date -r $CMD +%s) ]
 fi
 
 # Test: changed shared object does NOT cause relink.
 
-BOB_PATH=tests/static_link/shared/.bob
-CMD=$BOB_PATH/$BOB_TARGET/prefix/bin/cmd
-rm -rf $BOB_PATH tests/static_link/shared/fake-libs
+BOB_PATH=$PROJ/shared/.bob
+CMD="$BOB_PATH/$BOB_TARGET/bob/linker.link.cookie.*.l"
+rm -rf $BOB_PATH $PROJ/shared/fake-libs
 
-mkdir -p tests/static_link/shared/fake-libs
-printf 'void shared_fn(void){}\n' | cc -shared -fPIC -x c - -o tests/static_link/shared/fake-libs/libshared.so
+mkdir -p $PROJ/shared/fake-libs
+printf 'void shared_fn(void){}\n' | cc -shared -fPIC -x c - -o $PROJ/shared/fake-libs/libshared.so
 
-bob -C tests/static_link/shared build
+bob -C $PROJ/shared build
 cmd_mtime=$(date -r $CMD +%s)
 
 sleep 1
-bob -C tests/static_link/shared build
+bob -C $PROJ/shared build
 [ $cmd_mtime -eq $(date -r $CMD +%s) ]
 
 sleep 1
-touch tests/static_link/shared/fake-libs/libshared.so
-bob -C tests/static_link/shared build
+touch $PROJ/shared/fake-libs/libshared.so
+bob -C $PROJ/shared build
 [ $cmd_mtime -eq $(date -r $CMD +%s) ]